@@ -2,6 +2,16 @@
 //Edgar Ramirez
 
 #include "ciLisp.h"
+#include "ciLispBudget.h"
+#include "ciLispFunction.h"
+#include "ciLispImage.h"
+#include "ciLispOperators.h"
+#include "ciLispProfile.h"
+#include "ciLispScope.h"
+#include "ciLispSession.h"
+#include "ciLispStats.h"
+#include "ciLispTypes.h"
+#include "ciLispWalk.h"
 
 void yyerror(char *s) {
     fprintf(stderr, "\nERROR: %s\n", s);
@@ -9,43 +19,22 @@ void yyerror(char *s) {
     // CLion will display stderr in a different color from stdin and stdout
 }
 
-// Array of string values for operations.
-// Must be in sync with funcs in the OPER_TYPE enum in order for resolveFunc to work.
-char *funcNames[] = {
-        "neg",
-        "abs",
-        "exp",
-        "sqrt",
-        "add",
-        "sub",
-        "mult",
-        "div",
-        "remainder",
-        "log",
-        "pow",
-        "max",
-        "min",
-        "exp2",
-        "cbrt",
-        "hypot",
-        "read",
-        "rand",
-        "print",
-        "equal",
-        "less",
-        "greater",
-        ""
-};
-
-OPER_TYPE resolveFunc(char *funcName)
+// Interns the operator names in OPER_TYPE order before anything else is
+// interned, so the id of each built-in function name is its OPER_TYPE.
+// Must run before the first token is scanned.
+void internFuncNames(void)
 {
-    int i = 0;
-    while (funcNames[i][0] != '\0')
+    for (int i = 0; i < numOpers; i++)
     {
-        if (strcmp(funcNames[i], funcName) == 0)
-            return i;
-        i++;
+        if (internString(operTable[i].name, strlen(operTable[i].name)) != (SYMBOL_ID) i)
+            yyerror("function names must be interned before any other identifier");
     }
+}
+
+OPER_TYPE resolveFunc(SYMBOL_ID funcName)
+{
+    if (funcName < (SYMBOL_ID) numOpers)
+        return (OPER_TYPE) funcName;
     return CUSTOM_OPER;
 }
 
@@ -61,8 +50,8 @@ AST_NODE *createNumberNode(double value, NUM_TYPE type)
 
     // allocate space for the fixed sie and the variable part (union)
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-        yyerror("Memory allocation failed!");
+    node = memAlloc(NODE_MEM_KIND(NUM_NODE_TYPE), nodeSize);
+    chargeAllocation(nodeSize);
 
     // TODO set the AST_NODE's type, assign values to contained NUM_AST_NODE
     node->type = NUM_NODE_TYPE;
@@ -80,38 +69,43 @@ void setParent(AST_NODE *parent, AST_NODE *child)
 }
 
 
-AST_NODE *createFunctionNode(char *funcName, AST_NODE *opList)
+AST_NODE *createFunctionNode(SYMBOL_ID funcName, OP_VECTOR *opList)
 {
     AST_NODE *node;
     size_t nodeSize;
 
     // allocate space (or error)
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-        yyerror("Memory allocation failed!");
-
-    // TODO set the AST_NODE's type, populate contained FUNC_AST_NODE
-    // NOTE: you do not need to populate the "ident" field unless the function is type CUSTOM_OPER.
-    // When you do have a CUSTOM_OPER, you do NOT need to allocate and strcpy here.
-    // The funcName will be a string identifier for which space should be allocated in the tokenizer.
-    // For CUSTOM_OPER functions, you should simply assign the "ident" pointer to the passed in funcName.
-    // For functions other than CUSTOM_OPER, you should free the funcName after you're assigned the OPER_TYPE.
+    node = memAlloc(NODE_MEM_KIND(FUNC_NODE_TYPE), nodeSize);
+    chargeAllocation(nodeSize);
+
+    // funcName is an interned id, nothing to copy or free.
     node->type = FUNC_NODE_TYPE;
     node->data.function.oper = resolveFunc(funcName);
-    node->data.function.opList = opList;
-    setParent(node, opList);
+    node->data.function.ident = funcName;
+
+    // the node keeps the operand array, trimmed to size, the vector itself goes
+    if (opList != NULL)
+    {
+        node->data.function.ops = memRealloc(MEM_OPERANDS, opList->ops, opList->capacity * sizeof(AST_NODE *),
+                                             opList->numOps * sizeof(AST_NODE *));
+        node->data.function.numOps = opList->numOps;
+        memFree(MEM_OPERANDS, opList, sizeof(OP_VECTOR));
+    }
+    for (int i = 0; i < node->data.function.numOps; i++)
+        setParent(node, node->data.function.ops[i]);
     return node;
 }
 
-AST_NODE *createSymbolNode(char *ident)
+AST_NODE *createSymbolNode(SYMBOL_ID ident)
 {
     AST_NODE *node;
     size_t nodeSize;
 
     // allocate space (or error)
     nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
-        yyerror("Memory allocation failed!");
+    node = memAlloc(NODE_MEM_KIND(SYM_NODE_TYPE), nodeSize);
+    chargeAllocation(nodeSize);
 
     node->type = SYM_NODE_TYPE;
     node->data.symbol.ident = ident;
@@ -120,13 +114,10 @@ AST_NODE *createSymbolNode(char *ident)
 }
 
 
-SYMBOL_TABLE_NODE *createSymbolTableNode(char *ident, AST_NODE *val, NUM_TYPE typeNum)
+SYMBOL_TABLE_NODE *createSymbolTableNode(SYMBOL_ID ident, AST_NODE *val, NUM_TYPE typeNum)
 {
-    SYMBOL_TABLE_NODE *symTabNode = calloc(1, sizeof(SYMBOL_TABLE_NODE));
-    if(symTabNode == NULL)
-    {
-        exit(EXIT_FAILURE+1);
-    }
+    SYMBOL_TABLE_NODE *symTabNode = memAlloc(MEM_SYMBOL_TABLE, sizeof(SYMBOL_TABLE_NODE));
+    chargeAllocation(sizeof(SYMBOL_TABLE_NODE));
     if(typeNum == false) {
         symTabNode->val_type = DOUBLE_TYPE;
     }
@@ -137,672 +128,314 @@ SYMBOL_TABLE_NODE *createSymbolTableNode(char *ident, AST_NODE *val, NUM_TYPE ty
     return symTabNode;
 }
 
+// Attaches a let section to node. The bound values hang off node as well,
+// so symbols inside them resolve through node's scope chain.
 AST_NODE *setSymbolTable(SYMBOL_TABLE_NODE *symbolTable, AST_NODE * node)
 {
-    SYMBOL_TABLE_NODE **scope = &(node->symbolTable);
-    if(*scope != NULL)
-        scope = &((**scope).next);
-    *scope = symbolTable;
-
-    return node;
-}
-
-SYMBOL_TABLE_NODE *addSymbolToList(SYMBOL_TABLE_NODE *let_list, SYMBOL_TABLE_NODE *let_element)
-{
-    if(let_list == NULL)
-        return let_element;
-
-    SYMBOL_TABLE_NODE *iter = let_list;
-    while (iter->next != NULL)
+    // the body was a syntax error
+    if (node == NULL)
     {
-        iter = iter->next;
+        freeSymbolTable(symbolTable);
+        return NULL;
     }
-    iter->next = let_element;
-
-    return let_list;
-}
-
-AST_NODE *addOpToList (AST_NODE *op, AST_NODE *opList)
-{
-    if(opList == NULL)
-        return op;
-
-    op->next = opList;
-
-    return op;
-}
-// Called after execution is done on the base of the tree.
-// (see the program production in ciLisp.y)
-// Recursively frees the whole abstract syntax tree.
-// You'll need to update and expand freeNode as the project develops.
-void freeNode(AST_NODE *node)
-{
-    if (!node)
-        return;
 
-    if (node->type == FUNC_NODE_TYPE)
+    bool definesFunction = false;
+    SYMBOL_TABLE_NODE *tail = NULL;
+    for (SYMBOL_TABLE_NODE *iter = symbolTable; iter != NULL; iter = iter->next)
     {
-        // Recursive calls to free child nodes
-        freeNode(node->data.function.opList);
-
-        // Free up identifier string if necessary
-        if (node->data.function.oper == CUSTOM_OPER)
-        {
-            free(node->data.function.ident);
-        }
+        setParent(node, iter->val);
+        definesFunction |= iter->function != NULL;
+        tail = iter;
     }
 
-    free(node);
-}
-
-// Evaluates an AST_NODE.
-// returns a RET_VAL storing the the resulting value and type.
-// You'll need to update and expand eval (and the more specific eval functions below)
-// as the project develops.
-RET_VAL eval(AST_NODE *node)
-{
-    if (!node)
-        return (RET_VAL){INT_TYPE, NAN};
-
-    RET_VAL result = {INT_TYPE, NAN}; // see NUM_AST_NODE, because RET_VAL is just an alternative name for it.
-
-    // TODO complete the switch.
-    // Make calls to other eval functions based on node type.
-    // Use the results of those calls to populate result.
-    switch (node->type)
+    // A let around a let body shares the body's node. Its bindings go in
+    // front of the list, but the index keeps the names the body's own let
+    // already binds, so those still shadow it.
+    node->scope = extendScope(node->scope, symbolTable);
+    if (tail != NULL)
     {
-        case FUNC_NODE_TYPE:
-            result = evalFuncNode(&node->data.function);
-            break;
-        case NUM_NODE_TYPE:
-            result = evalNumNode(&node->data.number);
-            break;
-        case SYM_NODE_TYPE:
-            result = evalSymNode(node);
-            break;
-        default:
-            yyerror("Invalid AST_NODE_TYPE, probably invalid writes somewhere!");
+        tail->next = node->symbolTable;
+        node->symbolTable = symbolTable;
     }
 
-    return result;
+    // the scope is complete now, so calls to its lambdas can be inlined
+    if (definesFunction)
+        inlineCalls(node, NULL);
+
+    return node;
 }
 
-// returns a pointer to the NUM_AST_NODE (aka RET_VAL) referenced by node.
-// DOES NOT allocate space for a new RET_VAL.
-RET_VAL evalNumNode(NUM_AST_NODE *numNode)
+// Records the bytes a node was read from (see ciLispSource.h); a let around
+// a body widens the body's span to the whole form.
+AST_NODE *setSpan(AST_NODE *node, SOURCE_SPAN span)
 {
-    if (!numNode)
-        return (RET_VAL){INT_TYPE, NAN};
-
-    RET_VAL result = {INT_TYPE, NAN};
-
-    // TODO populate result with the values stored in the node.
-    // SEE: AST_NODE, AST_NODE_TYPE, NUM_AST_NODE
-    switch(numNode->type)
-    {
-        case INT_TYPE:
-            result.type = INT_TYPE;
-            result.value = numNode->value;
-            break;
-        case DOUBLE_TYPE:
-            result.type = DOUBLE_TYPE;
-            result.value = numNode->value;
-            break;
-        default:
-            yyerror("ERROR IN EvalNumNode, POSSIBLE WRONG VALUE IN VALUE");
-            break;
-    }
-
-    return result;
+    if (node != NULL)
+        node->span = span;
+    return node;
 }
 
-
-RET_VAL evalFuncNode(FUNC_AST_NODE *funcNode)
+// Pushes let_element on the front, so long let sections are built in
+// linear time; the grammar reverses the finished list back into order.
+SYMBOL_TABLE_NODE *addSymbolToList(SYMBOL_TABLE_NODE *let_list, SYMBOL_TABLE_NODE *let_element)
 {
-    if (!funcNode)
-        return (RET_VAL){INT_TYPE, NAN};
-
-    RET_VAL result = {INT_TYPE, 0};
-
-    if(funcNode->opList == false)
-    {
-        printf("ERROR: too few parameters for the function \n");
-        return (RET_VAL) {INT_TYPE, NAN};
-    }
-
-    RET_VAL op1 = eval(funcNode->opList);
-    RET_VAL op2 = eval(funcNode->opList->next);
-
-
-    // TODO populate result with the result of running the function on its operands.
-    // SEE: AST_NODE, AST_NODE_TYPE, FUNC_AST_NODE
-    switch(funcNode->oper)
-    {
-        case NEG_OPER:
-            if(singleOp("neg", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = -(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = -(op1.value);
-                }
-            }
-            else
-                singleOp("neg", funcNode);
-            break;
-        case ABS_OPER:
-            if(singleOp("abs", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = fabs(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = fabs(op1.value);
-                }
-            }
-            else
-                singleOp("abs", funcNode);
-            break;
-        case EXP_OPER:
-            if(singleOp("exp", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = exp(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = exp(op1.value);
-                }
-            }
-            else
-                singleOp("exp", funcNode);
-
-            break;
-        case SQRT_OPER:
-            if(singleOp("sqrt", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = sqrt(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = sqrt(op1.value);
-                }
-            }
-            else
-                singleOp("sqrt", funcNode);
-            break;
-        case ADD_OPER:
-            //nOps("add", funcNode);
-            return addHelperFunc(funcNode);
-        case SUB_OPER:
-            doubleOps("sub", funcNode);
-            if(op1.type == INT_TYPE && op2.type == INT_TYPE)
-            {
-                result.type = INT_TYPE;
-                result.value = (op1.value - op2.value);
-            }
-
-            if(op1.type == DOUBLE_TYPE || op2.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = (op1.value - op2.value);
-            }
-            break;
-        case MULT_OPER:
-            //nOps("mult", funcNode);
-            return multHelperFunc(funcNode);
-        case DIV_OPER:
-            doubleOps("div", funcNode);
-            if(op1.type == INT_TYPE && op2.type == INT_TYPE)
-            {
-                result.type = INT_TYPE;
-                result.value = (op1.value / op2.value);
-            }
-
-            if(op1.type == DOUBLE_TYPE || op2.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = (op1.value / op2.value);
-            }
-            break;
-        case REMAINDER_OPER:
-            doubleOps("remainder", funcNode);
-            if(op1.type == INT_TYPE && op2.type == INT_TYPE)
-            {
-                result.type = INT_TYPE;
-                result.value = fmod(op1.value,op2.value);
-            }
-
-            if(op1.type == DOUBLE_TYPE || op2.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = fmod(op1.value,op2.value);
-            }
-            break;
-        case LOG_OPER:
-            if(singleOp("log", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = log(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = log(op1.value);
-                }
-            }
-            else
-                singleOp("log", funcNode);
-            break;
-        case POW_OPER:
-            doubleOps("pow", funcNode);
-            if(op1.type == INT_TYPE && op2.type == INT_TYPE)
-            {
-                result.type = INT_TYPE;
-                result.value = pow(op1.value,op2.value);
-            }
-
-            if(op1.type == DOUBLE_TYPE || op2.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = pow(op1.value,op2.value);
-            }
-            break;
-        case MAX_OPER:
-            return maxHelperFunc(funcNode);
-        case MIN_OPER:
-            return minHelperFunc(funcNode);
-        case EXP2_OPER:
-            if(singleOp("exp2", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = exp2(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = exp2(op1.value);
-                }
-            }
-            else
-                singleOp("exp2", funcNode);
-            break;
-        case CBRT_OPER:
-            if(singleOp("cbrt", funcNode).type == DOUBLE_TYPE)
-            {
-                if(op1.type == INT_TYPE)
-                {
-                    result.type = INT_TYPE;
-                    result.value = cbrt(op1.value);
-                }
-                else{
-                    result.type = DOUBLE_TYPE;
-                    result.value = cbrt(op1.value);
-                }
-            }
-            else
-                singleOp("cbrt", funcNode);
-            break;
-        case HYPOT_OPER:
-            return hypotHelperFunc(funcNode);
-        case PRINT_OPER:
-            printf("=>");
-            AST_NODE *currNode = funcNode->opList;
-            while (currNode != NULL)
-            {
-                if(eval(currNode).type == INT_TYPE)
-                {
-                    printf("%.0lf ", eval(currNode).value);
-                }
-                else{
-                    printf("%lf ", eval(currNode).value);
-                }
-                currNode = currNode->next;
-            }
-            printf("\n");
-            break;
-        default:
-            yyerror("IN EvalFuncNode, THERE IS NO CASE TO POPULATE RESULT");
-    }
-    return result;
+    let_element->next = let_list;
+    return let_element;
 }
 
-RET_VAL evalSymNode(AST_NODE *node)
+SYMBOL_TABLE_NODE *reverseSymbolList(SYMBOL_TABLE_NODE *list)
 {
-    if (!node)
-        return (RET_VAL){INT_TYPE, NAN};
-
-    SYMBOL_TABLE_NODE *iter = findSymbol(node->data.symbol.ident, node);
-
-    if(iter == NULL)
+    SYMBOL_TABLE_NODE *reversed = NULL;
+    while (list != NULL)
     {
-        printf("ERROR: In evalSymNode\n");
-        return (RET_VAL) {INT_TYPE, NAN};
+        SYMBOL_TABLE_NODE *next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
     }
-
-    RET_VAL result = eval(iter->val);
-
-    if(iter->val_type == INT_TYPE && iter->val->data.number.type == DOUBLE_TYPE)
-    {
-        result.type = iter->val_type;
-        result.value = floor(result.value);
-        printf("WARNING: precision loss in the assignment for variable <%s> \n", node->data.symbol.ident);
-    }
-    if(iter->val_type == DOUBLE_TYPE && iter->val->data.number.type == INT_TYPE)
-    {
-        result.type = iter->val_type;
-    }
-
-    return result;
-
+    return reversed;
 }
 
-SYMBOL_TABLE_NODE * findSymbol(char *ident, AST_NODE *symNode)
+OP_VECTOR *addOpToList (OP_VECTOR *opList, AST_NODE *op)
 {
-    if(symNode == NULL)
-        return NULL;
-
-    SYMBOL_TABLE_NODE *iter = symNode->symbolTable;
+    if(opList == NULL)
+        opList = memAlloc(MEM_OPERANDS, sizeof(OP_VECTOR));
 
-    while(iter!= NULL)
+    if(opList->numOps == opList->capacity)
     {
-        if(strcmp(ident, iter->ident) == 0)
-        {
-            return iter;
-        }
-        iter = iter->next;
+        int capacity = opList->capacity == 0 ? 4 : opList->capacity * 2;
+        opList->ops = memRealloc(MEM_OPERANDS, opList->ops, opList->capacity * sizeof(AST_NODE *),
+                                 capacity * sizeof(AST_NODE *));
+        chargeAllocation((capacity - opList->capacity) * sizeof(AST_NODE *));
+        opList->capacity = capacity;
     }
+    opList->ops[opList->numOps++] = op;
 
-    return findSymbol(ident, symNode->parent);
+    return opList;
 }
 
-int evalOpList (AST_NODE *opList)
+// Frees an operand list the parser dropped during error recovery.
+void freeOpList(OP_VECTOR *opList)
 {
-    int numOps = 0;
+    if (opList == NULL)
+        return;
 
-    while(opList != NULL)
-    {
-        numOps++;
-        opList = opList->next;
-    }
-    return numOps;
+    for (int i = 0; i < opList->numOps; i++)
+        freeNode(opList->ops[i]);
+    memFree(MEM_OPERANDS, opList->ops, opList->capacity * sizeof(AST_NODE *));
+    memFree(MEM_OPERANDS, opList, sizeof(OP_VECTOR));
 }
 
-RET_VAL singleOp (char *funcName, FUNC_AST_NODE *funcNode)
+// Frees the bindings of a let section and pushes their values (for a
+// lambda, its body) to be freed by freeTree.
+static void releaseBindings(WALK_STACK *stack, SYMBOL_TABLE_NODE *symbolTable)
 {
-    int numOps = evalOpList(funcNode->opList);
-    if(numOps == 0) {
-        printf("ERROR: too few parameters for the functions <%s>\n", funcName);
-        return (RET_VAL) {INT_TYPE, NAN};
-    }
-    if(numOps < 1)
+    while (symbolTable != NULL)
     {
-        printf("ERROR: too few parameters for the functions <%s>\n", funcName);
-        return (RET_VAL) {INT_TYPE, NAN};
+        SYMBOL_TABLE_NODE *next = symbolTable->next;
+        pushWalk(stack, symbolTable->val, NULL, false);
+        freeFunctionDef(symbolTable->function);
+        memFree(MEM_SYMBOL_TABLE, symbolTable, sizeof(SYMBOL_TABLE_NODE));
+        symbolTable = next;
     }
-    else if (numOps > 1)
-    {
-        printf("WARNING: too many parameters for the function <%s>\n", funcName);
-    }
-    return (RET_VAL) {DOUBLE_TYPE, NAN};
 }
 
-RET_VAL doubleOps (char *funcName, FUNC_AST_NODE *funcNode)
+// Frees every node on the stack and everything under them.
+static void freeTree(WALK_STACK *stack)
 {
-    int numOps = evalOpList(funcNode->opList);
-    if( numOps < 2)
-    {
-        RET_VAL result = {INT_TYPE, NAN};
-        printf("ERROR: too few parameters for the functions <%s>\n", funcName);
-        return result;
-    }
-    else if (numOps > 2)
+    WALK_ITEM item;
+
+    while (popWalk(stack, &item))
     {
-        printf("WARNING: too many parameters for the function <%s>\n", funcName);
-    }
-    return (RET_VAL) {DOUBLE_TYPE, NAN};
-}
+        AST_NODE *node = item.node;
 
+        if (node->type == FUNC_NODE_TYPE)
+        {
+            // (identifiers are interned and never freed)
+            pushOperands(stack, node, NULL);
+            memFree(MEM_OPERANDS, node->data.function.ops, node->data.function.numOps * sizeof(AST_NODE *));
+        }
 
-RET_VAL nOps (char *funcName, FUNC_AST_NODE *funcNode)
-{
-    int numOps = evalOpList(funcNode->opList);
-    if(numOps <= 1) {
-        RET_VAL result = {INT_TYPE, NAN};
-        printf("ERROR: too few parameters for the function <%s>\n", funcName);
-        return result;
+        releaseBindings(stack, node->symbolTable);
+        freeScopeIndex(node->scope);
+        memFree(NODE_MEM_KIND(node->type), node, sizeof(AST_NODE));
     }
-    return (RET_VAL) {DOUBLE_TYPE, NAN};
 }
 
-RET_VAL addHelperFunc(FUNC_AST_NODE *funcNode)
+// Frees a let section or a definition: each binding's value (for a lambda,
+// its body) and its function.
+void freeSymbolTable(SYMBOL_TABLE_NODE *symbolTable)
 {
-    if(nOps("add", funcNode).type == INT_TYPE)
-    {
-        return (RET_VAL){INT_TYPE, NAN};
-    }
-    else
-    {
-        RET_VAL result = (RET_VAL) {INT_TYPE, 0};
-        result = addRecursive(funcNode->opList, result);
-        return result;
-    }
+    WALK_STACK stack;
+
+    initWalk(&stack);
+    releaseBindings(&stack, symbolTable);
+    freeTree(&stack);
+    endWalk(&stack);
 }
 
-RET_VAL addRecursive(AST_NODE *opList, RET_VAL result)
+// Changes what a node is, keeping the allocation counters in step.
+void setNodeType(AST_NODE *node, AST_NODE_TYPE type)
 {
-    RET_VAL currNode = eval(opList);
+    memRetag(NODE_MEM_KIND(node->type), NODE_MEM_KIND(type), sizeof(AST_NODE));
+    node->type = type;
+}
 
-    switch(result.type)
-    {
-        case INT_TYPE:
-            if(currNode.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = currNode.value + result.value;
-            }
-            else
-            {
-                 result.value = (long) currNode.value + (long) result.value;
-            }
-            break;
-        case DOUBLE_TYPE:
-            result.value = currNode.value + result.value;
-            break;
-    }
-    if(opList->next == NULL)
-        return result;
+// Called after execution is done on the base of the tree.
+// (see the program production in ciLisp.y)
+// Frees the whole abstract syntax tree, however deeply it is nested.
+void freeNode(AST_NODE *node)
+{
+    WALK_STACK stack;
 
-    return addRecursive(opList->next, result);
+    initWalk(&stack);
+    pushWalk(&stack, node, NULL, false);
+    freeTree(&stack);
+    endWalk(&stack);
 }
 
-RET_VAL multHelperFunc(FUNC_AST_NODE *funcNode)
+// returns a pointer to the NUM_AST_NODE (aka RET_VAL) referenced by node.
+// DOES NOT allocate space for a new RET_VAL.
+RET_VAL evalNumNode(NUM_AST_NODE *numNode)
 {
-    if(nOps("mult", funcNode).type == INT_TYPE)
-    {
+    if (!numNode)
         return (RET_VAL){INT_TYPE, NAN};
-    }
-    else
-    {
-        RET_VAL result = (RET_VAL) {INT_TYPE, 1};
-        result = multRecursive(funcNode->opList, result);
-        return result;
-    }
-}
 
-RET_VAL multRecursive(AST_NODE *opList, RET_VAL result)
-{
-    RET_VAL currNode = eval(opList);
+    RET_VAL result = {INT_TYPE, NAN};
 
-    switch(result.type)
+    // TODO populate result with the values stored in the node.
+    // SEE: AST_NODE, AST_NODE_TYPE, NUM_AST_NODE
+    switch(numNode->type)
     {
         case INT_TYPE:
-            if(currNode.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = currNode.value * result.value;
-            }
-            else
-            {
-                result.value = (long) currNode.value * (long) result.value;
-            }
+            result.type = INT_TYPE;
+            result.value = numNode->value;
             break;
         case DOUBLE_TYPE:
-            result.value = currNode.value * result.value;
+            result.type = DOUBLE_TYPE;
+            result.value = numNode->value;
+            break;
+        default:
+            yyerror("ERROR IN EvalNumNode, POSSIBLE WRONG VALUE IN VALUE");
             break;
     }
-    if(opList->next == NULL)
-        return result;
 
-    return multRecursive(opList->next, result);
+    return result;
 }
 
-RET_VAL minHelperFunc(FUNC_AST_NODE *funcNode)
+// Converts a bound value to the type its binding was declared with.
+RET_VAL castToBinding(SYMBOL_TABLE_NODE *binding, RET_VAL result)
 {
-    if(nOps("min", funcNode).type == INT_TYPE)
+    if(binding->val_type == INT_TYPE && result.type == DOUBLE_TYPE)
     {
-        return (RET_VAL){INT_TYPE, NAN};
+        result.type = binding->val_type;
+        result.value = floor(result.value);
+        outPrintf("WARNING: precision loss in the assignment for variable <%s> \n", symbolName(binding->ident));
     }
-    else
+    if(binding->val_type == DOUBLE_TYPE && result.type == INT_TYPE)
     {
-        RET_VAL result = minRecur(funcNode->opList->next, eval(funcNode->opList));
-        return result;
+        result.type = binding->val_type;
     }
+
+    return result;
 }
 
-RET_VAL minRecur(AST_NODE *opList, RET_VAL result)
+// Walks the scope chain outwards; the innermost let binding ident wins.
+SYMBOL_TABLE_NODE * findSymbol(SYMBOL_ID ident, AST_NODE *symNode)
 {
-    RET_VAL currNode = eval(opList);
-
-    switch(result.type)
+    for (; symNode != NULL; symNode = symNode->parent)
     {
-        case INT_TYPE:
-            if(currNode.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = fmin(currNode.value, result.value);
-            }
-            else
-            {
-                result.value = fmin((long) currNode.value, (long) result.value);
-            }
-            break;
-        case DOUBLE_TYPE:
-            result.value = fmin(currNode.value,result.value);
-            break;
+        SYMBOL_TABLE_NODE *binding = scopeLookup(symNode->scope, ident);
+        if (binding != NULL)
+            return binding;
     }
-    if(opList->next == NULL)
-        return result;
 
-    return minRecur(opList->next, result);
+    return NULL;
 }
 
-RET_VAL maxHelperFunc(FUNC_AST_NODE *funcNode)
+// Evaluates a top-level expression within its budget.
+// An expression that runs out of steps, time or memory reports why and
+// evaluates to NAN instead of whatever partial value it had reached.
+RET_VAL evalTopLevel(AST_NODE *node)
 {
-    if(nOps("max", funcNode).type == INT_TYPE)
-    {
-        return (RET_VAL){INT_TYPE, NAN};
-    }
-    else
-    {
-        RET_VAL result = maxRecur(funcNode->opList->next, eval(funcNode->opList));
-        return result;
-    }
-}
+    RET_VAL result = {INT_TYPE, NAN};
+    NUM_TYPE type;
 
-RET_VAL maxRecur(AST_NODE *opList, RET_VAL result)
-{
-    RET_VAL currNode = eval(opList);
+    inferTypes(node, NULL, &type);
+    if (budgetStatus == BUDGET_OK)
+        result = eval(node);
 
-    switch(result.type)
+    if (budgetStatus != BUDGET_OK)
     {
-        case INT_TYPE:
-            if(currNode.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = fmax(currNode.value, result.value);
-            }
-            else
-            {
-                result.value = fmax((long) currNode.value, (long) result.value);
-            }
-            break;
-        case DOUBLE_TYPE:
-            result.value = fmax(currNode.value,result.value);
-            break;
+        outPrintf("ERROR: %s\n", budgetError());
+        result = (RET_VAL){INT_TYPE, NAN};
     }
-    if(opList->next == NULL)
-        return result;
 
-    return maxRecur(opList->next, result);
+    return result;
 }
 
-RET_VAL hypotHelperFunc(FUNC_AST_NODE *funcNode)
+void runExpression(AST_NODE *node)
 {
-    if(nOps("hypot", funcNode).type == INT_TYPE)
+    if (node != NULL)
     {
-        return (RET_VAL){INT_TYPE, NAN};
-    }
-    else
-    {
-        RET_VAL result = hypotRecur(funcNode->opList->next, eval(funcNode->opList));
-        return result;
+        if (imageCompiling)
+            writeImageExpression(node);
+        else
+        {
+            statsEnter(EVAL_PHASE);
+            RET_VAL result = evalTopLevel(node);
+            statsExit();
+            statsEnter(PRINT_PHASE);
+            printRetVal(result);
+            statsExit();
+        }
+        freeNode(node);
     }
+    endFormMemory(false);
+    statsEndForm(false);
 }
-RET_VAL hypotRecur(AST_NODE *opList, RET_VAL result)
-{
-    RET_VAL currNode = eval(opList);
 
-    switch(result.type)
+void runDefinition(SYMBOL_TABLE_NODE *binding)
+{
+    if (imageCompiling)
     {
-        case INT_TYPE:
-            if(currNode.type == DOUBLE_TYPE)
-            {
-                result.type = DOUBLE_TYPE;
-                result.value = hypot(currNode.value, result.value);
-            }
-            else
-            {
-                result.value = hypot((long) currNode.value, (long) result.value);
-            }
-            break;
-        case DOUBLE_TYPE:
-            result.value = hypot(currNode.value,result.value);
-            break;
+        writeImageDefinition(binding);
+        freeSymbolTable(binding);
+        endFormMemory(false);
+        statsEndForm(true);
+        return;
     }
-    if(opList->next == NULL)
-        return result;
 
-    return hypotRecur(opList->next, result);
+    statsEnter(EVAL_PHASE);
+    defineSymbol(binding);
+    statsExit();
+    endFormMemory(true);
+    statsEndForm(true);
 }
 
 // prints the type and value of a RET_VAL
+// LOSSLESS_FORMAT prints the shortest digits that read back to the same value,
+// so results can be fed back in as literals.
 void printRetVal(RET_VAL val)
 {
-    // TODO print the type and value of the value passed in.
+    bool lossless = getOutputFormat() == LOSSLESS_FORMAT;
+
+    statsCountResult(val);
+
     switch(val.type)
     {
         case INT_TYPE:
-            printf("<INT>: ");
-            printf("%.0lf", round(val.value));
+            outPuts("<INT>: ");
+            if(lossless)
+                outShortestValue(val.value, false);
+            else
+                outIntValue(round(val.value));
             break;
         case DOUBLE_TYPE:
-            printf("<DOUBLE>: ");
-            printf("%lf", (val.value));
+            outPuts("<DOUBLE>: ");
+            if(lossless)
+                outShortestValue(val.value, true);
+            else
+                outFixedValue(val.value);
             break;
         default:
             yyerror("ERROR IN PrintRetVal, NOT DETECTING CASE TYPE");
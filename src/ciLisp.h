@@ -8,12 +8,12 @@
 #include <math.h>
 #include <stdbool.h>
 
+#include "ciLispIntern.h"
+#include "ciLispMemory.h"
+#include "ciLispOutput.h"
+#include "ciLispSource.h"
 #include "ciLispParser.h"
 
-int yyparse(void);
-
-int yylex(void);
-
 void yyerror(char *);
 
 // Enum of all operators.
@@ -41,10 +41,13 @@ typedef enum oper {
     EQUAL_OPER,
     LESS_OPER,
     GREATER_OPER,
+    COND_OPER,
+    RANGE_OPER,
     CUSTOM_OPER =255
 } OPER_TYPE;
 
-OPER_TYPE resolveFunc(char *);
+OPER_TYPE resolveFunc(SYMBOL_ID);
+void internFuncNames(void);
 
 // Types of Abstract Syntax Tree nodes.
 // Initially, there are only numbers and functions.
@@ -52,9 +55,13 @@ OPER_TYPE resolveFunc(char *);
 typedef enum {
     NUM_NODE_TYPE,
     FUNC_NODE_TYPE,
-    SYM_NODE_TYPE
+    SYM_NODE_TYPE,
+    ARG_NODE_TYPE
 } AST_NODE_TYPE;
 
+// Allocation kind of a node of the given type.
+#define NODE_MEM_KIND(type) ((MEM_KIND) (MEM_NUM_NODE + (type)))
+
 // Types of numeric values
 typedef enum {
     INT_TYPE,
@@ -62,10 +69,13 @@ typedef enum {
 } NUM_TYPE;
 
 //A node that stores ident, value of symbol, and the next symbol in the linked list
+//For a lambda, val is the body, val_type the return type and function the
+//compiled definition (see ciLispFunction.h).
 typedef struct symbol_table_node {
     NUM_TYPE val_type;
-    char *ident;
+    SYMBOL_ID ident;
     struct ast_node *val;
+    struct function_def *function;
     struct symbol_table_node *next;
 } SYMBOL_TABLE_NODE;
 
@@ -84,59 +94,82 @@ typedef NUM_AST_NODE RET_VAL;
 // Node to store a function call with its inputs
 typedef struct {
     OPER_TYPE oper;
-    char* ident; // only needed for custom functions
-    struct ast_node *opList;
+    SYMBOL_ID ident; // only needed for custom functions
+    struct ast_node **ops;  // numOps operands, in order
+    int numOps;
+    // filled in by inferTypes (see ciLispTypes.h)
+    bool typed;             // staticType is what this call always returns
+    NUM_TYPE staticType;
+    unsigned intOperands;   // leading operands known to be INT
+    double (*kernel)(double, double);   // BINARY_SHAPE kernel for the operand types
 } FUNC_AST_NODE;
 
 typedef struct symbol_ast_node {
-    char *ident;
+    SYMBOL_ID ident;
 } SYMBOL_AST_NODE;
 
+// A lambda parameter, resolved when the lambda is defined.
+// Reads slot of the innermost call frame.
+typedef struct {
+    SYMBOL_ID ident;
+    size_t slot;
+} ARG_AST_NODE;
+
 // Generic Abstract Syntax Tree node. Stores the type of node,
 // and reference to the corresponding specific node (a number, function call, or symbol).
 typedef struct ast_node {
     AST_NODE_TYPE type;
     SYMBOL_TABLE_NODE *symbolTable;
+    struct scope_index *scope;  // lookup index over symbolTable (see ciLispScope.h)
     struct ast_node *parent;
+    SOURCE_SPAN span;           // where it was read (see ciLispSource.h)
     union {
         NUM_AST_NODE number;
         FUNC_AST_NODE function;
         SYMBOL_AST_NODE symbol;
+        ARG_AST_NODE arg;
     } data;
-    struct ast_node *next;
 } AST_NODE;
 
+// Operands of a call while s_expr_list collects them.
+// Appending is amortized O(1); createFunctionNode takes over the array.
+typedef struct op_vector {
+    AST_NODE **ops;
+    int numOps;
+    int capacity;
+} OP_VECTOR;
+
 AST_NODE *createNumberNode(double value, NUM_TYPE type);
-AST_NODE *createFunctionNode(char *funcName, AST_NODE *opList);
-AST_NODE *createSymbolNode(char *ident);
-SYMBOL_TABLE_NODE *createSymbolTableNode(char *ident, AST_NODE *val, NUM_TYPE typeNum);
+AST_NODE *createFunctionNode(SYMBOL_ID funcName, OP_VECTOR *opList);
+AST_NODE *createSymbolNode(SYMBOL_ID ident);
+SYMBOL_TABLE_NODE *createSymbolTableNode(SYMBOL_ID ident, AST_NODE *val, NUM_TYPE typeNum);
 
 AST_NODE *setSymbolTable(SYMBOL_TABLE_NODE *, AST_NODE *);
+AST_NODE *setSpan(AST_NODE *node, SOURCE_SPAN span);
 SYMBOL_TABLE_NODE *addSymbolToList (SYMBOL_TABLE_NODE *let_list, SYMBOL_TABLE_NODE *let_element);
-AST_NODE *addOpToList (AST_NODE *op, AST_NODE *opList);
+SYMBOL_TABLE_NODE *reverseSymbolList(SYMBOL_TABLE_NODE *list);
+OP_VECTOR *addOpToList (OP_VECTOR *opList, AST_NODE *op);
+void setNodeType(AST_NODE *node, AST_NODE_TYPE type);
 
 void freeNode(AST_NODE *node);
+void freeOpList(OP_VECTOR *opList);
+void freeSymbolTable(SYMBOL_TABLE_NODE *symbolTable);
 
 
+// Evaluates node on an explicit stack (see ciLispEval.c), so its depth is
+// limited by --max-stack rather than the C stack. Reentrant.
 RET_VAL eval(AST_NODE *node);
+RET_VAL evalTopLevel(AST_NODE *node);
+
+// What the program does with each top-level form (see ciLisp.y), also used
+// for forms loaded from an image: evaluate and print an expression, or define
+// a binding, and free what the form does not keep. With --compile-to the form
+// is written to the image instead (see ciLispImage.h).
+void runExpression(AST_NODE *node);
+void runDefinition(SYMBOL_TABLE_NODE *binding);
 RET_VAL evalNumNode(NUM_AST_NODE *numNode);
-RET_VAL evalFuncNode(FUNC_AST_NODE *funcNode);
-RET_VAL evalSymNode(AST_NODE *node);
-SYMBOL_TABLE_NODE * findSymbol(char *ident, AST_NODE *symNode);
-int evalOpList (AST_NODE *opList);
-RET_VAL singleOp (char *funcName, FUNC_AST_NODE *funcNode);
-RET_VAL doubleOps (char *funcName, FUNC_AST_NODE *funcNode);
-RET_VAL nOps (char *funcName, FUNC_AST_NODE *funcNode);
-RET_VAL addHelperFunc(FUNC_AST_NODE *funcNode);
-RET_VAL addRecursive(AST_NODE *opList, RET_VAL result);
-RET_VAL multHelperFunc(FUNC_AST_NODE *funcNode);
-RET_VAL multRecursive(AST_NODE *opList, RET_VAL result);
-RET_VAL minHelperFunc(FUNC_AST_NODE *funcNode);
-RET_VAL minRecur(AST_NODE *opList, RET_VAL result);
-RET_VAL maxHelperFunc(FUNC_AST_NODE *funcNode);
-RET_VAL maxRecur(AST_NODE *opList, RET_VAL result);
-RET_VAL hypotHelperFunc(FUNC_AST_NODE *funcNode);
-RET_VAL hypotRecur(AST_NODE *opList, RET_VAL result);
+RET_VAL castToBinding(SYMBOL_TABLE_NODE *binding, RET_VAL result);
+SYMBOL_TABLE_NODE * findSymbol(SYMBOL_ID ident, AST_NODE *symNode);
 
 
 void printRetVal(RET_VAL val);
@@ -1,31 +1,121 @@
 %{
     #include "ciLisp.h"
+    #include "ciLispBudget.h"
+    #include "ciLispFunction.h"
+    #include "ciLispImage.h"
+    #include "ciLispRange.h"
+    #include "ciLispStats.h"
+
+    // The parser's stack is capped by --max-stack like the evaluator's.
+    #define YYMAXDEPTH parseStackLimit(sizeof(YYSTYPE) + sizeof(YYLTYPE) + sizeof(yytype_int16))
+
+    // A rule's span runs from its first symbol to its last; an empty one
+    // starts and ends where the symbol before it ends.
+    #define YYLLOC_DEFAULT(Current, Rhs, N)                                 \
+        do {                                                                \
+            (Current).first = (N) ? YYRHSLOC(Rhs, 1).first : YYRHSLOC(Rhs, 0).last; \
+            (Current).last = YYRHSLOC(Rhs, (N) ? (N) : 0).last;             \
+        } while (0)
+
+    // The parser passes the location of a syntax error along; nothing reports it.
+    #define yyerror(span, message) (yyerror)(message)
 %}
 
+%code requires {
+    #include "ciLispSource.h"
+}
+
+// The driver in ciLisp.l pushes tokens as the scanner produces them, each
+// with the bytes it was read from, so every node gets its span.
+%define api.pure full
+%define api.push-pull push
+%define api.location.type {SOURCE_SPAN}
+%locations
+
 %union {
     double dval;
-    char *sval;
+    SYMBOL_ID ident;
     struct ast_node *astNode;
     struct symbol_table_node *symTabNode;
+    struct op_vector *opVector;
 };
 
 
-%token <sval> FUNC SYMBOL
+%token <ident> FUNC SYMBOL
 %token <dval> INT_LITERAL DOUBLE_LITERAL
-%token LPAREN RPAREN EOL LET QUIT INT DOUBLE
+%token LPAREN RPAREN EOL LET QUIT INT DOUBLE DEFINE LAMBDA RANGE SNAPSHOT
+
+// After an LPAREN, the empty let_section of (s_expr) is only reduced when
+// the next token cannot go on with something else: an LPAREN is shifted as
+// the start of a let section, so ((add 1 2)) is not a parenthesized call,
+// and a SYMBOL as the name of a call, so (f) calls f rather than reading it.
+%precedence EMPTY_LET
+%precedence LPAREN SYMBOL
 
-%type <astNode> s_expr f_expr number symbol s_expr_list
-%type <symTabNode> let_section let_list let_element
+// Every state that opens a form, including the one after (FUNC where a range
+// may start, is resolved this way; any other conflict fails the build.
+%expect 0
+
+%type <astNode> s_expr f_expr number symbol
+%type <opVector> s_expr_list
+%type <symTabNode> let_section let_list let_element definition arg_list arg
+
+// values dropped by error recovery
+%destructor { freeNode($$); } <astNode>
+%destructor { freeSymbolTable($$); } <symTabNode>
+%destructor { freeOpList($$); } <opVector>
 
 %%
 
+// Each top-level form is evaluated as soon as it is reduced; forms may span
+// lines, and EOL (a newline outside any form) just separates them.
 program:
-    s_expr EOL {
-        fprintf(stderr, "yacc: program ::= s_expr EOL\n");
-        if ($1) {
-            printRetVal(eval($1));
-            freeNode($1);
-        }
+    /* EMPTY */ {
+        fprintf(stderr, "yacc: program ::= <empty>\n");
+    }
+    | program s_expr {
+        fprintf(stderr, "yacc: program ::= program s_expr\n");
+        startBudgetClock();
+        runExpression($2);
+    }
+    | program definition {
+        fprintf(stderr, "yacc: program ::= program definition\n");
+        startBudgetClock();
+        runDefinition($2);
+    }
+    | program SNAPSHOT {
+        fprintf(stderr, "yacc: program ::= program SNAPSHOT\n");
+        writeSnapshot();
+    }
+    | program EOL {
+        fprintf(stderr, "yacc: program ::= program EOL\n");
+        yyerrok;
+    };
+
+definition:
+    LPAREN DEFINE SYMBOL s_expr RPAREN {
+        fprintf(stderr, "yacc: definition ::= LPAREN DEFINE SYMBOL s_expr RPAREN\n");
+        $$ = createSymbolTableNode($3, $4, DOUBLE_TYPE);
+    }
+    | LPAREN DEFINE INT SYMBOL s_expr RPAREN {
+        fprintf(stderr, "yacc: definition ::= LPAREN DEFINE INT SYMBOL s_expr RPAREN\n");
+        $$ = createSymbolTableNode($4, $5, INT_TYPE);
+    }
+    | LPAREN DEFINE DOUBLE SYMBOL s_expr RPAREN {
+        fprintf(stderr, "yacc: definition ::= LPAREN DEFINE DOUBLE SYMBOL s_expr RPAREN\n");
+        $$ = createSymbolTableNode($4, $5, DOUBLE_TYPE);
+    }
+    | LPAREN DEFINE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: definition ::= LPAREN DEFINE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+        $$ = createFunctionBinding($3, reverseSymbolList($6), $8, DOUBLE_TYPE);
+    }
+    | LPAREN DEFINE INT SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: definition ::= LPAREN DEFINE INT SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+        $$ = createFunctionBinding($4, reverseSymbolList($7), $9, INT_TYPE);
+    }
+    | LPAREN DEFINE DOUBLE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: definition ::= LPAREN DEFINE DOUBLE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+        $$ = createFunctionBinding($4, reverseSymbolList($7), $9, DOUBLE_TYPE);
     };
 
 s_expr:
@@ -39,11 +129,13 @@ s_expr:
     }
     | QUIT {
         fprintf(stderr, "yacc: s_expr ::= QUIT\n");
+        $$ = NULL;
         exit(EXIT_SUCCESS);
     }
     | error {
         fprintf(stderr, "yacc: s_expr ::= error\n");
-        yyerror("unexpected token");
+        yyerror(&@$, "unexpected token");
+        statsCountSyntaxError();
         $$ = NULL;
     }
     | symbol {
@@ -52,31 +144,29 @@ s_expr:
     }
     | LPAREN let_section s_expr RPAREN {
         fprintf(stderr, "yacc: s_expr ::= LPAREN let_section s_expr RPAREN\n");
-        $$ = setSymbolTable($2, $3);
+        $$ = setSpan(setSymbolTable($2, $3), @$);
     };
 
+// Not empty, so that after (FUNC an LPAREN may still open a range; calls
+// without operands are f_exprs of their own.
 s_expr_list:
-    /* EMPTY */ {
-        fprintf(stderr, "yacc: s_expr_list ::= <empty> \n");
-        $$ = NULL;
-    }
-    | s_expr {
+    s_expr {
         fprintf(stderr, "yacc: s_expr_list ::= s_expr\n");
-        $$ = $1;
+        $$ = addOpToList(NULL, $1);
     }
-    | s_expr s_expr_list {
-        fprintf(stderr, "yacc: s_expr_list ::= s_expr s_expr_list\n");
-        $$= addOpToList($1, $2);
+    | s_expr_list s_expr {
+        fprintf(stderr, "yacc: s_expr_list ::= s_expr_list s_expr\n");
+        $$ = addOpToList($1, $2);
     };
 
 let_section :
-    /* EMPTY */ {
+    /* EMPTY */ %prec EMPTY_LET {
         fprintf(stderr, "yacc: let_section ::= <empty> \n");
         $$ = NULL;
     }
      | LPAREN let_list RPAREN {
         fprintf(stderr, "yacc: let_section ::= LPAREN let_list RPAREN\n");
-        $$=$2;
+        $$ = reverseSymbolList($2);
     };
 
 let_list :
@@ -101,28 +191,84 @@ let_element :
     | LPAREN DOUBLE SYMBOL s_expr RPAREN {
         fprintf(stderr, "yacc: let_element ::= LPAREN DOUBLE SYMBOL s_expr RPAREN\n");
         $$ = createSymbolTableNode($3,$4,DOUBLE_TYPE);
+    }
+    | LPAREN SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: let_element ::= LPAREN SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+        $$ = createFunctionBinding($2, reverseSymbolList($5), $7, DOUBLE_TYPE);
+    }
+    | LPAREN INT SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: let_element ::= LPAREN INT SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+        $$ = createFunctionBinding($3, reverseSymbolList($6), $8, INT_TYPE);
+    }
+    | LPAREN DOUBLE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: let_element ::= LPAREN DOUBLE SYMBOL LAMBDA LPAREN arg_list RPAREN s_expr RPAREN\n");
+        $$ = createFunctionBinding($3, reverseSymbolList($6), $8, DOUBLE_TYPE);
+    };
+
+arg_list:
+    /* EMPTY */ {
+        fprintf(stderr, "yacc: arg_list ::= <empty>\n");
+        $$ = NULL;
+    }
+    | arg_list arg {
+        fprintf(stderr, "yacc: arg_list ::= arg_list arg\n");
+        $$ = addSymbolToList($1, $2);
+    };
+
+arg:
+    SYMBOL {
+        fprintf(stderr, "yacc: arg ::= SYMBOL\n");
+        $$ = createSymbolTableNode($1, NULL, DOUBLE_TYPE);
+    }
+    | INT SYMBOL {
+        fprintf(stderr, "yacc: arg ::= INT SYMBOL\n");
+        $$ = createSymbolTableNode($2, NULL, INT_TYPE);
+    }
+    | DOUBLE SYMBOL {
+        fprintf(stderr, "yacc: arg ::= DOUBLE SYMBOL\n");
+        $$ = createSymbolTableNode($2, NULL, DOUBLE_TYPE);
     };
 
 number:
     INT_LITERAL {
         fprintf(stderr, "yacc: number ::= INT_LITERAL\n");
-        $$ = createNumberNode($1, INT_TYPE);
+        $$ = setSpan(createNumberNode($1, INT_TYPE), @$);
     }
     | DOUBLE_LITERAL {
         fprintf(stderr, "yacc: number ::= DOUBLE_LITERAL\n");
-        $$ = createNumberNode($1, DOUBLE_TYPE);
+        $$ = setSpan(createNumberNode($1, DOUBLE_TYPE), @$);
     };
 
 symbol:
     SYMBOL {
         fprintf(stderr, "yacc: symbol ::= SYMBOL\n");
-        $$ = createSymbolNode($1);
+        $$ = setSpan(createSymbolNode($1), @$);
     };
 
 f_expr:
-    LPAREN FUNC s_expr_list RPAREN {
+    LPAREN FUNC RPAREN {
+        fprintf(stderr, "yacc: f_expr ::= LPAREN FUNC RPAREN\n");
+        $$ = setSpan(createFunctionNode($2, NULL), @$);
+    }
+    | LPAREN FUNC s_expr_list RPAREN {
     fprintf(stderr, "yacc: f_expr ::= LPAREN FUNC s_expr_list RPAREN\n");
-        $$ = createFunctionNode($2, $3);
+        $$ = setSpan(createFunctionNode($2, $3), @$);
+    }
+    | LPAREN SYMBOL RPAREN {
+        fprintf(stderr, "yacc: f_expr ::= LPAREN SYMBOL RPAREN\n");
+        $$ = setSpan(createFunctionNode($2, NULL), @$);
+    }
+    | LPAREN SYMBOL s_expr_list RPAREN {
+        fprintf(stderr, "yacc: f_expr ::= LPAREN SYMBOL s_expr_list RPAREN\n");
+        $$ = setSpan(createFunctionNode($2, $3), @$);
+    }
+    | LPAREN FUNC LPAREN RANGE arg s_expr s_expr RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: f_expr ::= LPAREN FUNC LPAREN RANGE arg s_expr s_expr RPAREN s_expr RPAREN\n");
+        $$ = setSpan(createRangeNode($2, $5, addOpToList(addOpToList(NULL, $6), $7), $9), @$);
+    }
+    | LPAREN FUNC LPAREN RANGE arg s_expr s_expr s_expr RPAREN s_expr RPAREN {
+        fprintf(stderr, "yacc: f_expr ::= LPAREN FUNC LPAREN RANGE arg s_expr s_expr s_expr RPAREN s_expr RPAREN\n");
+        $$ = setSpan(createRangeNode($2, $5, addOpToList(addOpToList(addOpToList(NULL, $6), $7), $8), $10), @$);
     };
 %%
 
@@ -0,0 +1,144 @@
+//CiLisp evaluation budgets
+//A step counter compared against a checkpoint keeps the common case to one
+//increment and one compare; the clock is only read at checkpoints.
+
+#include "ciLispBudget.h"
+
+#include <time.h>
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
+#endif
+
+BUDGET_STATUS budgetStatus = BUDGET_OK;
+uint64_t budgetSteps = 0;
+uint64_t budgetCheckpoint = UINT64_MAX;
+
+static EVAL_LIMITS evalLimits = {0, 0, 0, 0};
+static uint64_t budgetDeadline = 0; // CLOCK_MONOTONIC_COARSE nanoseconds
+static size_t budgetBytes = 0;
+static size_t stackBytes = 0;       // capacity of every evaluator stack
+
+static uint64_t nowNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+// Next step count at which checkBudget has to look at the limits.
+static uint64_t nextCheckpoint(void)
+{
+    uint64_t checkpoint = UINT64_MAX;
+    if (evalLimits.maxMillis != 0)
+        checkpoint = budgetSteps + BUDGET_CLOCK_INTERVAL;
+    if (evalLimits.maxSteps != 0 && evalLimits.maxSteps + 1 < checkpoint)
+        checkpoint = evalLimits.maxSteps + 1;
+    return checkpoint;
+}
+
+void setEvalLimits(EVAL_LIMITS limits)
+{
+    evalLimits = limits;
+}
+
+EVAL_LIMITS getEvalLimits(void)
+{
+    return evalLimits;
+}
+
+void beginBudget(void)
+{
+    budgetStatus = BUDGET_OK;
+    budgetSteps = 0;
+    budgetBytes = 0;
+    startBudgetClock();
+}
+
+void startBudgetClock(void)
+{
+    if (evalLimits.maxMillis != 0)
+        budgetDeadline = nowNanos() + evalLimits.maxMillis * 1000000u;
+    budgetCheckpoint = nextCheckpoint();
+}
+
+bool checkBudget(void)
+{
+    if (budgetStatus == BUDGET_OK)
+    {
+        if (evalLimits.maxSteps != 0 && budgetSteps > evalLimits.maxSteps)
+            budgetStatus = BUDGET_STEPS;
+        else if (evalLimits.maxMillis != 0 && nowNanos() >= budgetDeadline)
+            budgetStatus = BUDGET_TIME;
+    }
+
+    if (budgetStatus != BUDGET_OK)
+    {
+        // every later step takes the slow path and fails straight away
+        budgetCheckpoint = 0;
+        return false;
+    }
+
+    budgetCheckpoint = nextCheckpoint();
+    return true;
+}
+
+bool chargeAllocation(size_t bytes)
+{
+    budgetBytes += bytes;
+    if (evalLimits.maxBytes != 0 && budgetBytes > evalLimits.maxBytes && budgetStatus == BUDGET_OK)
+    {
+        budgetStatus = BUDGET_MEMORY;
+        budgetCheckpoint = 0;
+    }
+    return budgetStatus == BUDGET_OK;
+}
+
+size_t growStack(size_t capacity, size_t needed, size_t itemSize)
+{
+    size_t grown = capacity == 0 ? 1 : capacity;
+    while (grown < needed)
+        grown *= 2;
+
+    if (evalLimits.maxStackBytes != 0)
+    {
+        size_t room = evalLimits.maxStackBytes > stackBytes ? evalLimits.maxStackBytes - stackBytes : 0;
+        if (grown - capacity > room / itemSize)
+            grown = capacity + room / itemSize;
+        if (grown < needed)
+        {
+            if (budgetStatus == BUDGET_OK)
+            {
+                budgetStatus = BUDGET_STACK;
+                budgetCheckpoint = 0;
+            }
+            return 0;
+        }
+    }
+
+    stackBytes += (grown - capacity) * itemSize;
+    return grown;
+}
+
+size_t parseStackLimit(size_t entrySize)
+{
+    size_t limit = evalLimits.maxStackBytes != 0 ? evalLimits.maxStackBytes : SIZE_MAX / 4;
+    return limit / entrySize;
+}
+
+const char *budgetError(void)
+{
+    switch (budgetStatus)
+    {
+        case BUDGET_STEPS:
+            return "evaluation step limit exceeded";
+        case BUDGET_TIME:
+            return "evaluation time limit exceeded";
+        case BUDGET_MEMORY:
+            return "expression memory limit exceeded";
+        case BUDGET_STACK:
+            return "expression nested too deeply for the stack limit";
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef __cilisp_budget_h_
+#define __cilisp_budget_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-expression resource limits.
+// Each top-level expression gets a fresh budget of node evaluations, wall
+// clock time and bytes of AST / symbol table allocations. Once any of them
+// runs out, eval stops descending and the expression's result is an error.
+//
+// The stacks eval and the parser work on are capped as well, which is what
+// bounds how deeply an expression or a chain of calls can nest. They keep
+// their size from one expression to the next, so that cap is not reset.
+
+typedef enum {
+    BUDGET_OK,
+    BUDGET_STEPS,
+    BUDGET_TIME,
+    BUDGET_MEMORY,
+    BUDGET_STACK
+} BUDGET_STATUS;
+
+// 0 means unlimited
+typedef struct {
+    uint64_t maxSteps;
+    uint64_t maxMillis;
+    size_t maxBytes;
+    size_t maxStackBytes;   // evaluator stacks; the parser's stack gets a cap of its own this size
+} EVAL_LIMITS;
+
+// Steps between two reads of the clock.
+#define BUDGET_CLOCK_INTERVAL 1024
+
+extern BUDGET_STATUS budgetStatus;
+extern uint64_t budgetSteps;
+extern uint64_t budgetCheckpoint;
+
+void setEvalLimits(EVAL_LIMITS limits);
+EVAL_LIMITS getEvalLimits(void);
+
+// Resets the counters and starts the clock for the next top-level expression.
+void beginBudget(void);
+
+// Restarts the clock once the expression has been read, so a form that
+// arrives over several reads is not charged for the wait.
+void startBudgetClock(void);
+
+// Slow path of chargeStep, runs every BUDGET_CLOCK_INTERVAL steps.
+bool checkBudget(void);
+
+// Counts one node evaluation; false once the budget is exhausted.
+static inline bool chargeStep(void)
+{
+    if (++budgetSteps < budgetCheckpoint)
+        return true;
+    return checkBudget();
+}
+
+// Counts steps node evaluations made at once (see ciLispRange.h).
+static inline bool chargeSteps(uint64_t steps)
+{
+    budgetSteps += steps;
+    if (budgetSteps < budgetCheckpoint)
+        return true;
+    return checkBudget();
+}
+
+// Counts bytes allocated for the current expression; false once over the cap.
+bool chargeAllocation(size_t bytes);
+
+// New capacity, in items of itemSize bytes, for an evaluator stack that has
+// capacity items and needs room for needed: at least double, but no more
+// than the stack cap leaves. 0, and the expression fails, if needed does not
+// fit. The caller grows the stack to the returned capacity.
+size_t growStack(size_t capacity, size_t needed, size_t itemSize);
+
+// Most entries the parser's stack may grow to (see YYMAXDEPTH in ciLisp.y).
+size_t parseStackLimit(size_t entrySize);
+
+// Error message for the current status, NULL while within budget.
+const char *budgetError(void);
+
+#endif
@@ -0,0 +1,470 @@
+//CiLisp bulk scanner
+//Stage one classifies the input into bitmasks BULK_BLOCK bytes at a time,
+//stage two walks them and stores the tokens flex would return.
+
+#include "ciLispBulk.h"
+#include "ciLispNumber.h"
+#include "ciLispStats.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define BULK_CHUNK (1 << 20)
+#define MIN_BULK_TOKENS 4096
+#define NAME_SLOTS 64       // a power of two, more than twice the names
+
+// a character no rule matches, reported when its turn comes
+#define INVALID_TOKEN (-1)
+
+typedef struct {
+    int token;              // as yylex returns it, or INVALID_TOKEN
+    size_t length;
+    uint64_t offset;        // in the whole input
+    union {
+        double dval;
+        SYMBOL_ID ident;
+        char invalid;
+    } value;
+} BULK_TOKEN;
+
+// Bit i of a mask is byte i of a block; bits past the end of the input are 0.
+typedef struct {
+    uint64_t *letter;
+    uint64_t *digit;
+    uint64_t *blank;        // ' ', '\t' and '|', which flex skips
+} BULK_MASKS;
+
+typedef struct {
+    const char *name;
+    int token;
+    size_t length;
+} BULK_NAME;
+
+#define NAME(text, token) {text, token, sizeof(text) - 1}
+
+// The keywords and {func} of ciLisp.l, which this must be kept in step with.
+static const BULK_NAME names[] = {
+        NAME("let", LET), NAME("lambda", LAMBDA), NAME("range", RANGE), NAME("define", DEFINE), NAME("quit", QUIT),
+        NAME("snapshot", SNAPSHOT), NAME("int", INT), NAME("double", DOUBLE), NAME("neg", FUNC), NAME("abs", FUNC),
+        NAME("exp", FUNC), NAME("sqrt", FUNC), NAME("add", FUNC), NAME("sub", FUNC), NAME("mult", FUNC),
+        NAME("div", FUNC), NAME("remainder", FUNC), NAME("log", FUNC), NAME("pow", FUNC), NAME("max", FUNC),
+        NAME("min", FUNC), NAME("exp2", FUNC), NAME("cbrt", FUNC), NAME("hypot", FUNC), NAME("read", FUNC),
+        NAME("rand", FUNC), NAME("print", FUNC), NAME("equal", FUNC), NAME("less", FUNC), NAME("greater", FUNC),
+        NAME("cond", FUNC),
+};
+
+#define NUM_NAMES (sizeof(names) / sizeof(names[0]))
+
+// open addressing over names, by hashName; 0 is empty, otherwise index + 1
+static uint8_t nameSlots[NAME_SLOTS];
+
+bool bulkScanning = false;
+
+// The input not scanned yet, starting at inputOffset. There are BULK_BLOCK
+// bytes to spare after inputCapacity, so stage one can load whole blocks.
+static char *input = NULL;
+static size_t inputLength = 0;
+static size_t inputCapacity = 0;
+static uint64_t inputOffset = 0;
+static bool inputEnded = false;
+
+static BULK_MASKS masks;
+static size_t maskCapacity = 0;     // blocks
+
+static BULK_TOKEN *tokens = NULL;
+static size_t numTokens = 0;
+static size_t nextToken = 0;
+static size_t tokenCapacity = 0;
+
+static int scanDepth = 0;           // after the last token stored
+static int depth = 0;               // after the last token returned
+
+static void (*classify)(const unsigned char *bytes, size_t block);
+
+/*
+ * Stage one.
+ */
+
+static void storeClasses(size_t block, uint64_t letter, uint64_t digit, uint64_t blank)
+{
+    masks.letter[block] = letter;
+    masks.digit[block] = digit;
+    masks.blank[block] = blank;
+}
+
+#if defined(__SSE2__)
+
+// x >= low and x <= high, unsigned
+static inline __m128i inRange128(__m128i x, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8(low)), x),
+                         _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(high)), x));
+}
+
+static void classifySse2(const unsigned char *bytes, size_t block)
+{
+    uint64_t letter = 0, digit = 0, blank = 0;
+
+    for (int i = 0; i < BULK_BLOCK / 16; i++)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (bytes + 16 * i));
+        __m128i isLetter = inRange128(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+        __m128i isDigit = inRange128(x, '0', '9');
+        __m128i isBlank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+                                       _mm_cmpeq_epi8(x, _mm_set1_epi8('|')));
+        letter |= (uint64_t) (uint16_t) _mm_movemask_epi8(isLetter) << (16 * i);
+        digit |= (uint64_t) (uint16_t) _mm_movemask_epi8(isDigit) << (16 * i);
+        blank |= (uint64_t) (uint16_t) _mm_movemask_epi8(isBlank) << (16 * i);
+    }
+    storeClasses(block, letter, digit, blank);
+}
+
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BULK_AVX2
+
+__attribute__((target("avx2")))
+static inline __m256i inRange256(__m256i x, char low, char high)
+{
+    return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8(low)), x),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(high)), x));
+}
+
+__attribute__((target("avx2")))
+static void classifyAvx2(const unsigned char *bytes, size_t block)
+{
+    uint64_t letter = 0, digit = 0, blank = 0;
+
+    for (int i = 0; i < BULK_BLOCK / 32; i++)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (bytes + 32 * i));
+        __m256i isLetter = inRange256(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i isDigit = inRange256(x, '0', '9');
+        __m256i isBlank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                                          _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+                                          _mm256_cmpeq_epi8(x, _mm256_set1_epi8('|')));
+        letter |= (uint64_t) (uint32_t) _mm256_movemask_epi8(isLetter) << (32 * i);
+        digit |= (uint64_t) (uint32_t) _mm256_movemask_epi8(isDigit) << (32 * i);
+        blank |= (uint64_t) (uint32_t) _mm256_movemask_epi8(isBlank) << (32 * i);
+    }
+    storeClasses(block, letter, digit, blank);
+}
+
+#endif
+
+static void classifyBytes(const unsigned char *bytes, size_t block)
+{
+    uint64_t letter = 0, digit = 0, blank = 0;
+
+    for (int i = 0; i < BULK_BLOCK; i++)
+    {
+        unsigned char c = bytes[i];
+        letter |= (uint64_t) ((unsigned char) ((c | 0x20) - 'a') <= 'z' - 'a') << i;
+        digit |= (uint64_t) ((unsigned char) (c - '0') <= 9) << i;
+        blank |= (uint64_t) (c == ' ' || c == '\t' || c == '|') << i;
+    }
+    storeClasses(block, letter, digit, blank);
+}
+
+static size_t hashName(const char *text, size_t length)
+{
+    return ((unsigned char) text[0] * 7 + (unsigned char) text[length - 1] * 3 + length) & (NAME_SLOTS - 1);
+}
+
+static void indexNames(void)
+{
+    for (size_t i = 0; i < NUM_NAMES; i++)
+    {
+        size_t slot = hashName(names[i].name, names[i].length);
+        while (nameSlots[slot] != 0)
+            slot = (slot + 1) & (NAME_SLOTS - 1);
+        nameSlots[slot] = (uint8_t) (i + 1);
+    }
+}
+
+void enableBulkScanner(void)
+{
+    bulkScanning = true;
+    indexNames();
+    classify = classifyBytes;
+#if defined(__SSE2__)
+    classify = classifySse2;
+#endif
+#if defined(BULK_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        classify = classifyAvx2;
+#endif
+}
+
+static void classifyInput(void)
+{
+    size_t numBlocks = (inputLength + BULK_BLOCK - 1) / BULK_BLOCK;
+
+    // one more, empty, so that a run always ends
+    if (numBlocks + 1 > maskCapacity)
+    {
+        size_t capacity = maskCapacity == 0 ? BULK_CHUNK / BULK_BLOCK + 1 : maskCapacity;
+        while (capacity < numBlocks + 1)
+            capacity *= 2;
+        masks.letter = memRealloc(MEM_SCANNER, masks.letter, maskCapacity * sizeof(uint64_t), capacity * sizeof(uint64_t));
+        masks.digit = memRealloc(MEM_SCANNER, masks.digit, maskCapacity * sizeof(uint64_t), capacity * sizeof(uint64_t));
+        masks.blank = memRealloc(MEM_SCANNER, masks.blank, maskCapacity * sizeof(uint64_t), capacity * sizeof(uint64_t));
+        maskCapacity = capacity;
+    }
+
+    for (size_t block = 0; block < numBlocks; block++)
+        classify((const unsigned char *) input + block * BULK_BLOCK, block);
+
+    if (inputLength % BULK_BLOCK != 0)
+    {
+        uint64_t inside = ((uint64_t) 1 << inputLength % BULK_BLOCK) - 1;
+        masks.letter[numBlocks - 1] &= inside;
+        masks.digit[numBlocks - 1] &= inside;
+        masks.blank[numBlocks - 1] &= inside;
+    }
+    storeClasses(numBlocks, 0, 0, 0);
+}
+
+/*
+ * Stage two.
+ */
+
+// The first byte from pos on that is not in mask, inputLength at the latest.
+static size_t runEnd(const uint64_t *mask, size_t pos)
+{
+    size_t block = pos / BULK_BLOCK;
+    uint64_t ends = ~mask[block] & (~(uint64_t) 0 << pos % BULK_BLOCK);
+
+    while (ends == 0)
+        ends = ~mask[++block];
+    return block * BULK_BLOCK + __builtin_ctzll(ends);
+}
+
+static bool inMask(const uint64_t *mask, size_t pos)
+{
+    return mask[pos / BULK_BLOCK] >> pos % BULK_BLOCK & 1;
+}
+
+static BULK_TOKEN *addToken(int token, size_t pos, size_t length)
+{
+    if (numTokens == tokenCapacity)
+    {
+        size_t capacity = tokenCapacity == 0 ? MIN_BULK_TOKENS : 2 * tokenCapacity;
+        tokens = memRealloc(MEM_SCANNER, tokens, tokenCapacity * sizeof(BULK_TOKEN), capacity * sizeof(BULK_TOKEN));
+        tokenCapacity = capacity;
+    }
+
+    BULK_TOKEN *added = &tokens[numTokens++];
+    added->token = token;
+    added->offset = inputOffset + pos;
+    added->length = length;
+    return added;
+}
+
+// Whether a token ending at end may go on in input not read yet.
+static bool mayContinue(size_t end)
+{
+    return end == inputLength && !inputEnded;
+}
+
+// [+-]?{digit}+ or [+-]?{digit}+\.{digit}* from start, its digits from
+// digits. Returns where it ends, or start to wait for more input.
+static size_t scanNumber(size_t start, size_t digits)
+{
+    size_t end = runEnd(masks.digit, digits);
+    int token = INT_LITERAL;
+
+    if (end < inputLength && input[end] == '.')
+    {
+        end = runEnd(masks.digit, end + 1);
+        token = DOUBLE_LITERAL;
+    }
+    if (mayContinue(end))
+        return start;
+
+    BULK_TOKEN *added = addToken(token, start, end - start);
+    added->value.dval = token == INT_LITERAL ? parseIntLiteral(input + start, end - start) :
+                        parseDoubleLiteral(input + start, end - start);
+    return end;
+}
+
+// A run of letters is a keyword or {func} only as a whole, flex's longest
+// match; exp2 is the one name that goes on past them.
+static size_t scanName(size_t start)
+{
+    size_t end = runEnd(masks.letter, start);
+    if (mayContinue(end))
+        return start;
+
+    const char *text = input + start;
+    if (end - start == 3 && memcmp(text, "exp", 3) == 0 && end < inputLength && input[end] == '2')
+        end++;
+
+    size_t length = end - start;
+    int token = SYMBOL;
+    for (size_t slot = hashName(text, length); nameSlots[slot] != 0; slot = (slot + 1) & (NAME_SLOTS - 1))
+    {
+        const BULK_NAME *name = &names[nameSlots[slot] - 1];
+        if (name->length == length && memcmp(name->name, text, length) == 0)
+        {
+            token = name->token;
+            break;
+        }
+    }
+
+    BULK_TOKEN *added = addToken(token, start, length);
+    if (token == FUNC || token == SYMBOL)
+        added->value.ident = internString(text, length);
+    return end;
+}
+
+// Stores the token at pos, which is not blank. Returns where it ends, or pos
+// to wait for more input.
+static size_t scanToken(size_t pos)
+{
+    char c = input[pos];
+
+    switch (c)
+    {
+        case '(':
+            addToken(LPAREN, pos, 1);
+            scanDepth++;
+            return pos + 1;
+        case ')':
+            addToken(RPAREN, pos, 1);
+            if (scanDepth > 0)
+                scanDepth--;
+            return pos + 1;
+        case '\n':
+            // only a newline between forms ends a line
+            if (scanDepth == 0)
+                addToken(EOL, pos, 1);
+            return pos + 1;
+        case '+':
+        case '-':
+            if (mayContinue(pos + 1))
+                return pos;
+            if (pos + 1 < inputLength && inMask(masks.digit, pos + 1))
+                return scanNumber(pos, pos + 1);
+            break;
+        default:
+            if (inMask(masks.digit, pos))
+                return scanNumber(pos, pos);
+            if (inMask(masks.letter, pos))
+                return scanName(pos);
+            break;
+    }
+
+    addToken(INVALID_TOKEN, pos, 1)->value.invalid = c;
+    return pos + 1;
+}
+
+// Stores the tokens of the input, keeping what may be the start of a token
+// that goes on past it.
+static void scanInput(void)
+{
+    size_t pos = 0;
+
+    classifyInput();
+    for (;;)
+    {
+        pos = runEnd(masks.blank, pos);
+        if (pos >= inputLength)
+            break;
+        size_t end = scanToken(pos);
+        if (end == pos)
+            break;
+        pos = end;
+    }
+
+    memmove(input, input + pos, inputLength - pos);
+    inputLength -= pos;
+    inputOffset += pos;
+}
+
+// Reads whatever stdin has ready after what is left of the last chunk.
+static void readInput(void)
+{
+    if (inputLength == inputCapacity)
+    {
+        // a token longer than a chunk
+        size_t capacity = inputCapacity == 0 ? BULK_CHUNK : 2 * inputCapacity;
+        input = memRealloc(MEM_SCANNER, input, inputCapacity + BULK_BLOCK, capacity + BULK_BLOCK);
+        inputCapacity = capacity;
+    }
+
+    ssize_t got;
+    statsEnter(INPUT_PHASE);
+    while ((got = read(STDIN_FILENO, input + inputLength, inputCapacity - inputLength)) < 0 && errno == EINTR)
+        ;
+    statsExit();
+
+    if (got <= 0)
+    {
+        inputEnded = true;
+        return;
+    }
+    appendSource(input + inputLength, (size_t) got);
+    inputLength += (size_t) got;
+}
+
+// Scans more of the input; false once there are no tokens left in it.
+static bool scanMore(void)
+{
+    numTokens = 0;
+    nextToken = 0;
+    while (numTokens == 0 && !(inputEnded && inputLength == 0))
+    {
+        if (!inputEnded)
+            readInput();
+        scanInput();
+    }
+    return numTokens > 0;
+}
+
+int bulkLex(YYSTYPE *value, YYLTYPE *location)
+{
+    for (;;)
+    {
+        if (nextToken == numTokens && !scanMore())
+            return 0;
+
+        const BULK_TOKEN *token = &tokens[nextToken++];
+        *location = sourceSpan(token->offset, token->length);
+        switch (token->token)
+        {
+            case INVALID_TOKEN:
+                outPrintf("ERROR: invalid character: >>%s<<\n", (char[]) {token->value.invalid, '\0'});
+                continue;
+            case LPAREN:
+                depth++;
+                break;
+            case RPAREN:
+                if (depth > 0)
+                    depth--;
+                break;
+            case INT_LITERAL:
+            case DOUBLE_LITERAL:
+                value->dval = token->value.dval;
+                break;
+            case FUNC:
+            case SYMBOL:
+                value->ident = token->value.ident;
+                break;
+            default:
+                break;
+        }
+        return token->token;
+    }
+}
+
+int bulkDepth(void)
+{
+    return depth;
+}
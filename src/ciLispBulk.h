@@ -0,0 +1,38 @@
+#ifndef __cilisp_bulk_h_
+#define __cilisp_bulk_h_
+
+#include "ciLisp.h"
+
+// Bulk scanner: the tokens of the flex scanner in ciLisp.l, for large batch
+// inputs (--bulk).
+//
+// Input is read in large chunks and scanned in two stages, as simdjson does.
+// Stage one classifies BULK_BLOCK bytes at a time with SIMD compares into
+// bitmasks of letters, digits and blanks (AVX2 where the CPU has it, SSE2
+// otherwise on x86, a table elsewhere). Stage two walks the masks: blanks are
+// skipped and the end of each name or number found with a count of trailing
+// zeros rather than a byte at a time, and the tokens are stored in an array
+// with their values and spans. bulkLex then hands them out one by one.
+//
+// It accepts exactly what flex does, longest match first: names are keywords
+// or {func} only when the whole run of letters is one, exp2 is the one name
+// with a digit, signs only start numbers right before a digit, and every
+// other character is reported as invalid when its turn comes, so messages
+// come out where flex would print them. A token that may go on past the end
+// of a chunk is left for the next one. The debug printouts of the flex
+// rules are not made.
+
+#define BULK_BLOCK 64
+
+extern bool bulkScanning;
+
+// Makes bulkLex read stdin; flex is not used then.
+void enableBulkScanner(void);
+
+// Like yylex: the next token, 0 at the end of the input.
+int bulkLex(YYSTYPE *value, YYLTYPE *location);
+
+// Open parens among the tokens returned so far, like flex's yyextra.
+int bulkDepth(void);
+
+#endif
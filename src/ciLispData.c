@@ -0,0 +1,223 @@
+//CiLisp data
+//Numbers for read, from a mapped file or a buffered descriptor.
+
+#include "ciLispData.h"
+#include "ciLispNumber.h"
+#include "ciLispStats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// longest part of an invalid number that is quoted
+#define MAX_QUOTED 40
+
+static const bool separators[256] = {
+        [' '] = true, ['\t'] = true, ['\n'] = true, ['\r'] = true, ['\v'] = true, ['\f'] = true, [','] = true,
+};
+
+static bool dataOpen = false;
+static int dataFd = -1;
+
+// What has not been read yet is data[dataNext] up to data[dataLength]; data
+// is either the mapped file or buffer.
+static const char *data = NULL;
+static size_t dataNext = 0;
+static size_t dataLength = 0;
+static bool dataEnded = false;      // nothing more to come after dataLength
+
+static void *mapped = NULL;
+static size_t mappedSize = 0;
+
+static char *buffer = NULL;
+static size_t bufferCapacity = 0;
+
+static void closeData(void)
+{
+    if (mapped != NULL)
+        munmap(mapped, mappedSize);
+    mapped = NULL;
+    mappedSize = 0;
+    memFree(MEM_DATA, buffer, bufferCapacity);
+    buffer = NULL;
+    bufferCapacity = 0;
+    data = NULL;
+    dataNext = dataLength = 0;
+    dataEnded = false;
+    dataOpen = false;
+}
+
+// Maps fd if it is a regular file, from offset on.
+static bool mapData(int fd, const struct stat *info)
+{
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (!S_ISREG(info->st_mode) || offset < 0 || info->st_size <= offset)
+        return false;
+
+    void *base = mmap(NULL, info->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        return false;
+    madvise(base, info->st_size, MADV_SEQUENTIAL);
+
+    mapped = base;
+    mappedSize = info->st_size;
+    data = base;
+    dataNext = offset;
+    dataLength = info->st_size;
+    dataEnded = true;
+    return true;
+}
+
+bool openDataFd(int fd)
+{
+    struct stat info;
+
+    if (fd == STDIN_FILENO)
+    {
+        outPrintf("ERROR: the data cannot come from stdin, which holds the program\n");
+        return false;
+    }
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        outPrintf("ERROR: cannot read the data from descriptor %d\n", fd);
+        return false;
+    }
+
+    closeData();
+    dataOpen = true;
+    dataFd = fd;
+    // an empty file, or one that cannot be mapped, is read like a pipe
+    if (!mapData(fd, &info))
+        data = buffer;
+    return true;
+}
+
+bool openData(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        outPrintf("ERROR: cannot read the data <%s>\n", path);
+        return false;
+    }
+    if (!openDataFd(fd))
+    {
+        close(fd);
+        return false;
+    }
+
+    // a mapping outlives its descriptor
+    if (mapped != NULL)
+    {
+        close(fd);
+        dataFd = -1;
+    }
+    return true;
+}
+
+// Reads more after what is left in the buffer. False once there is no more.
+static bool readMore(void)
+{
+    if (dataEnded)
+        return false;
+
+    if (dataNext > 0)
+    {
+        memmove(buffer, buffer + dataNext, dataLength - dataNext);
+        dataLength -= dataNext;
+        dataNext = 0;
+    }
+    if (dataLength == bufferCapacity)
+    {
+        // a number longer than the buffer
+        size_t capacity = bufferCapacity == 0 ? DATA_CHUNK : 2 * bufferCapacity;
+        buffer = memRealloc(MEM_DATA, buffer, bufferCapacity, capacity);
+        bufferCapacity = capacity;
+    }
+    data = buffer;
+
+    ssize_t got;
+    statsEnter(INPUT_PHASE);
+    while ((got = read(dataFd, buffer + dataLength, bufferCapacity - dataLength)) < 0 && errno == EINTR)
+        ;
+    statsExit();
+
+    if (got <= 0)
+    {
+        dataEnded = true;
+        return false;
+    }
+    dataLength += (size_t) got;
+    return true;
+}
+
+static bool isDigit(char c)
+{
+    return (unsigned char) (c - '0') <= 9;
+}
+
+// text is INT or DOUBLE by the lexer's rules, or reported and nan. It is not
+// terminated and may end where the mapped file does, so nothing here reads
+// text[length]; the literal parsers copy it before any strtod.
+static RET_VAL parseData(const char *text, size_t length)
+{
+    size_t i = text[0] == '+' || text[0] == '-';
+    size_t digits = i;
+
+    while (i < length && isDigit(text[i]))
+        i++;
+    if (i > digits)
+    {
+        if (i == length)
+            return (RET_VAL){INT_TYPE, parseIntLiteral(text, length)};
+        if (text[i] == '.')
+        {
+            i++;
+            while (i < length && isDigit(text[i]))
+                i++;
+            if (i == length)
+                return (RET_VAL){DOUBLE_TYPE, parseDoubleLiteral(text, length)};
+        }
+    }
+
+    int quoted = length < MAX_QUOTED ? (int) length : MAX_QUOTED;
+    outPrintf("ERROR: invalid number >>%.*s%s<< in the data\n", quoted, text, length > MAX_QUOTED ? "..." : "");
+    return (RET_VAL){INT_TYPE, NAN};
+}
+
+RET_VAL readData(void)
+{
+    if (!dataOpen)
+    {
+        outPrintf("ERROR: there is no data to read (see --data)\n");
+        return (RET_VAL){INT_TYPE, NAN};
+    }
+
+    size_t end;
+    for (;;)
+    {
+        while (dataNext < dataLength && separators[(unsigned char) data[dataNext]])
+            dataNext++;
+        if (dataNext == dataLength)
+        {
+            if (readMore())
+                continue;
+            outPrintf("ERROR: there is no more data to read\n");
+            return (RET_VAL){INT_TYPE, NAN};
+        }
+
+        end = dataNext;
+        while (end < dataLength && !separators[(unsigned char) data[end]])
+            end++;
+        // the number may go on in what has not been read yet
+        if (end == dataLength && readMore())
+            continue;
+        break;
+    }
+
+    size_t start = dataNext;
+    dataNext = end;
+    return parseData(data + start, end - start);
+}
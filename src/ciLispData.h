@@ -0,0 +1,28 @@
+#ifndef __cilisp_data_h_
+#define __cilisp_data_h_
+
+#include "ciLisp.h"
+
+// Data for read: numbers taken one at a time from a file or descriptor other
+// than stdin (--data=FILE, --data-fd=N), so the program and its data stream
+// in independently.
+//
+// A regular file is mapped whole. Anything else, such as a pipe, is read
+// DATA_CHUNK bytes at a time, and a number cut off by the end of a chunk is
+// kept for the next one. Numbers are separated by whitespace or commas and
+// follow the lexer's literal rules: [+-]?digit+ is an INT and
+// [+-]?digit+.digit* a DOUBLE, parsed like literals (see ciLispNumber.h).
+// Anything else is reported and read as nan, and so is reading past the end.
+
+#define DATA_CHUNK (1 << 20)
+
+// Takes the data from path. Reports and returns false if it cannot be read.
+bool openData(const char *path);
+
+// Takes the data from fd, from its current offset on.
+bool openDataFd(int fd);
+
+// The next number of the data.
+RET_VAL readData(void);
+
+#endif
@@ -0,0 +1,767 @@
+//CiLisp evaluator
+//eval as one loop over an explicit stack of frames instead of native recursion.
+
+#include "ciLisp.h"
+#include "ciLispBudget.h"
+#include "ciLispFunction.h"
+#include "ciLispOperators.h"
+#include "ciLispProfile.h"
+#include "ciLispRange.h"
+#include "ciLispSampler.h"
+#include "ciLispSession.h"
+
+// A frame is one node whose evaluation is in flight: which of its operands
+// comes next and what has been computed from the ones before. Whenever a
+// frame needs the value of a node, that node is entered above it; numbers and
+// parameters are read on the spot, anything else gets a frame of its own. The
+// frame below resumes with the value once the one above is done, so the
+// stack is as deep as the expression and nothing is on the C stack.
+//
+// The stack keeps its capacity between expressions and can only grow as far
+// as --max-stack allows (see growStack).
+
+#define MIN_EVAL_FRAMES 256
+
+typedef enum {
+    OPER_FRAME,     // built-in operator: operands are combined as they arrive
+    COND_FRAME,     // (cond test then else)
+    SYM_FRAME,      // let-bound symbol: its value, cast to the binding type
+    CALL_FRAME,     // call to a lambda, and the tail calls that replace it
+    RANGE_FRAME     // fold or reduce over a range (see ciLispRange.h)
+} FRAME_KIND;
+
+// States of a frame; a new frame starts out ENTERING.
+typedef enum {
+    ENTERING,
+    OPERANDS,       // OPER: operand next - 1 has arrived
+    LEAF_TEST,      // COND: both branches are cheap leaves, the test has arrived
+    TEST,           // COND, CALL: the test of a cond has arrived
+    BRANCH,         // COND: the branch it selected has arrived
+    BOUND_VALUE,    // SYM: the bound value has arrived
+    ARGUMENTS,      // CALL: argument next - 1 of callee has arrived
+    RESULT,         // CALL: the value of a body that is not a tail call has arrived
+    BOUNDS,         // RANGE: bound next - 1 has arrived
+    ELEMENT         // RANGE: the element for value index has arrived
+} FRAME_STATE;
+
+typedef struct {
+    AST_NODE *node;
+    unsigned char kind;     // FRAME_KIND
+    unsigned char state;    // FRAME_STATE
+    int next;
+    RET_VAL acc;
+    union {
+        SYMBOL_TABLE_NODE *binding;     // SYM
+        RET_VAL leaves[2];              // COND over two cheap leaves
+        struct {
+            AST_NODE *expr;             // current body expression
+            FUNC_DEF *function;         // whose frame is current, NULL until the first one is entered
+            FUNC_DEF *callee;           // whose arguments are being evaluated
+            size_t argBase;             // where they go
+            FRAME_MARK saved;           // frame stack of the caller
+        } call;
+        struct {
+            RANGE_BOUNDS bounds;
+            double end;
+            uint64_t index;
+            double saved;               // the variable's value in an enclosing evaluation of the same range
+        } range;
+    } u;
+} EVAL_FRAME;
+
+static EVAL_FRAME *evalStack = NULL;
+static size_t evalCapacity = 0;
+static size_t evalTop = 0;
+
+// The new frame for node, or NULL once the stack limit is reached.
+static EVAL_FRAME *pushFrame(AST_NODE *node, FRAME_KIND kind)
+{
+    if (evalTop == evalCapacity)
+    {
+        size_t capacity = growStack(evalCapacity, evalCapacity == 0 ? MIN_EVAL_FRAMES : evalTop + 1,
+                                    sizeof(EVAL_FRAME));
+        if (capacity == 0)
+            return NULL;
+        evalStack = memRealloc(MEM_STACKS, evalStack, evalCapacity * sizeof(EVAL_FRAME),
+                               capacity * sizeof(EVAL_FRAME));
+        evalCapacity = capacity;
+    }
+
+    EVAL_FRAME *frame = &evalStack[evalTop++];
+    frame->node = node;
+    frame->kind = kind;
+    frame->state = ENTERING;
+    frame->next = 0;
+    return frame;
+}
+
+// Symbols bound by an enclosing let win; anything else is looked up in the
+// session definitions (see ciLispSession.h). Only a let-bound value needs a
+// frame, a definition's value is cached.
+static void enterSymbol(AST_NODE *node, RET_VAL *value)
+{
+    SYMBOL_TABLE_NODE *binding = findSymbol(node->data.symbol.ident, node);
+
+    if (binding == NULL)
+    {
+        SESSION_DEF *def = findSessionDef(node->data.symbol.ident);
+        if (def == NULL)
+        {
+            outPrintf("ERROR: In evalSymNode\n");
+            return;
+        }
+        binding = def->binding;
+        if (binding->function == NULL)
+        {
+            // may evaluate a stale definition, on top of this stack
+            *value = castToBinding(binding, sessionValue(def));
+            return;
+        }
+    }
+
+    if (binding->function != NULL)
+    {
+        outPrintf("ERROR: <%s> is a function, not a variable\n", symbolName(binding->ident));
+        return;
+    }
+
+    EVAL_FRAME *frame = pushFrame(node, SYM_FRAME);
+    if (frame != NULL)
+        frame->u.binding = binding;
+}
+
+// A NULL operand is what a syntax error leaves in its place.
+static void reportMissingOperand(void)
+{
+    outPrintf("ERROR: missing operand\n");
+}
+
+// True, after reporting it, if one of the operands an operator is about to
+// evaluate is missing, so none of them is.
+static bool missingOperand(FUNC_AST_NODE *funcNode, int used)
+{
+    for (int i = 0; i < used; i++)
+    {
+        if (funcNode->ops[i] == NULL)
+        {
+            reportMissingOperand();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Starts evaluating node. Either its value is known straight away and goes to
+// value, or a frame is pushed for the loop in eval to resume.
+// Every node entered is charged against the expression's budget (see
+// ciLispBudget.h); once it runs out the value is NAN and nothing is pushed.
+static void enter(AST_NODE *node, RET_VAL *value)
+{
+    *value = (RET_VAL){INT_TYPE, NAN};
+
+    if (node == NULL)
+    {
+        reportMissingOperand();
+        return;
+    }
+    if (!chargeStep())
+        return;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            *value = evalNumNode(&node->data.number);
+            break;
+        case ARG_NODE_TYPE:
+            *value = evalArgNode(&node->data.arg);
+            break;
+        case SYM_NODE_TYPE:
+            enterSymbol(node, value);
+            break;
+        case FUNC_NODE_TYPE:
+        {
+            OPER_TYPE oper = node->data.function.oper;
+            FRAME_KIND kind = oper == CUSTOM_OPER ? CALL_FRAME : oper == COND_OPER ? COND_FRAME :
+                              oper == RANGE_OPER ? RANGE_FRAME : OPER_FRAME;
+            // calls are timed per operator when profiling is on (see ciLispProfile.h)
+            if (pushFrame(node, kind) != NULL && profilingEnabled)
+                profileEnter();
+            break;
+        }
+        default:
+            yyerror("Invalid AST_NODE_TYPE, probably invalid writes somewhere!");
+    }
+}
+
+// Numbers and lambda parameters: reading them costs less than a mispredicted
+// branch and has no side effects, so both sides can be read unconditionally.
+// A NULL operand, left by a syntax error, goes through enter, which reports it.
+static bool isCheapLeaf(AST_NODE *node)
+{
+    return node != NULL && (node->type == NUM_NODE_TYPE || node->type == ARG_NODE_TYPE);
+}
+
+static RET_VAL readLeaf(AST_NODE *node)
+{
+    if(node->type == NUM_NODE_TYPE)
+        return node->data.number;
+    return evalArgNode(&node->data.arg);
+}
+
+// A leaf an operator or call reads without a trip through eval's loop. It is
+// charged like any node entered.
+static RET_VAL enterLeaf(AST_NODE *node)
+{
+    if (!chargeStep())
+        return (RET_VAL){INT_TYPE, NAN};
+    return readLeaf(node);
+}
+
+// Operands an operator evaluates; extra ones only get a warning.
+static int operandsUsed(const OPER_DESC *desc, FUNC_AST_NODE *funcNode)
+{
+    switch (desc->shape)
+    {
+        case UNARY_SHAPE:
+            return 1;
+        case BINARY_SHAPE:
+            return 2;
+        case SOURCE_SHAPE:
+            return 0;
+        default:
+            return funcNode->numOps;
+    }
+}
+
+// Folds operand i into acc. A typed call (see ciLispTypes.h) knows its
+// kernels up front: leading INT operands go through the int x int one, the
+// rest through the double one. Otherwise the kernel and the result type
+// follow the types of the values as they arrive.
+static void combine(EVAL_FRAME *frame, const OPER_DESC *desc, FUNC_AST_NODE *funcNode, int i, RET_VAL value)
+{
+    if (i == 0 && desc->shape != FOLD_SHAPE)
+    {
+        // starts from the first operand as it is
+        frame->acc.value = value.value;
+        if (!funcNode->typed)
+            frame->acc.type = value.type;
+    }
+    else if (!funcNode->typed)
+    {
+        frame->acc.value = desc->kernels[frame->acc.type][value.type](frame->acc.value, value.value);
+        frame->acc.type = promoteType(desc, frame->acc.type, value.type);
+    }
+    else if (desc->shape == BINARY_SHAPE)
+    {
+        frame->acc.value = funcNode->kernel(frame->acc.value, value.value);
+    }
+    else
+    {
+        NUM_TYPE kernelType = i < (int) funcNode->intOperands ? INT_TYPE : DOUBLE_TYPE;
+        frame->acc.value = desc->kernels[kernelType][kernelType](frame->acc.value, value.value);
+    }
+}
+
+static void printOperand(RET_VAL value)
+{
+    if (value.type == INT_TYPE)
+        outPrintf("%.0lf ", value.value);
+    else
+        outPrintf("%lf ", value.value);
+}
+
+// Takes the value of operand frame->next - 1.
+static void takeOperand(EVAL_FRAME *frame, const OPER_DESC *desc, FUNC_AST_NODE *funcNode, RET_VAL value)
+{
+    if (desc->shape == PRINT_SHAPE)
+        printOperand(value);
+    else
+        combine(frame, desc, funcNode, frame->next - 1, value);
+}
+
+// Each resume function takes the value that has arrived for the frame, if
+// any. It returns true with the frame's result in value once the frame is
+// done, or false with the next node to enter in child.
+
+static bool resumeOper(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    FUNC_AST_NODE *funcNode = &frame->node->data.function;
+    const OPER_DESC *desc = &operTable[funcNode->oper];
+
+    if (frame->state == ENTERING)
+    {
+        // typed calls have the right number of operands, none of them
+        // missing; the others check
+        if (!funcNode->typed &&
+            (!checkArity(funcNode) || missingOperand(funcNode, operandsUsed(desc, funcNode))))
+        {
+            *value = (RET_VAL){INT_TYPE, NAN};
+            return true;
+        }
+
+        switch (desc->shape)
+        {
+            case UNARY_SHAPE:
+            case BINARY_SHAPE:
+            case FOLD_SHAPE:
+            case REDUCE_SHAPE:
+                frame->acc.type = funcNode->typed ? funcNode->staticType : INT_TYPE;
+                frame->acc.value = desc->shape == FOLD_SHAPE ? desc->identity : NAN;
+                break;
+            case SOURCE_SHAPE:
+                frame->acc = desc->source();
+                break;
+            case PRINT_SHAPE:
+                outPuts("=>");
+                break;
+            default:
+                outPrintf("ERROR: the function <%s> is not implemented\n", desc->name);
+                *value = (RET_VAL){INT_TYPE, NAN};
+                return true;
+        }
+        frame->state = OPERANDS;
+    }
+    else
+    {
+        takeOperand(frame, desc, funcNode, *value);
+    }
+
+    for (int used = operandsUsed(desc, funcNode); frame->next < used;)
+    {
+        AST_NODE *operand = funcNode->ops[frame->next++];
+        if (!isCheapLeaf(operand))
+        {
+            *child = operand;
+            return false;
+        }
+        takeOperand(frame, desc, funcNode, enterLeaf(operand));
+    }
+
+    switch (desc->shape)
+    {
+        case UNARY_SHAPE:
+            frame->acc.value = desc->unary(frame->acc.value);
+            break;
+        case PRINT_SHAPE:
+            outPuts("\n");
+            frame->acc = (RET_VAL){INT_TYPE, 0};
+            break;
+        default:
+            break;
+    }
+
+    *value = frame->acc;
+    return true;
+}
+
+// Picks a or b with masks instead of a jump.
+static RET_VAL selectRetVal(bool takeA, RET_VAL a, RET_VAL b)
+{
+    uint64_t mask = -(uint64_t) takeA;
+    uint64_t aBits, bBits, bits;
+
+    memcpy(&aBits, &a.value, sizeof(aBits));
+    memcpy(&bBits, &b.value, sizeof(bBits));
+    bits = (aBits & mask) | (bBits & ~mask);
+
+    RET_VAL result;
+    result.type = (NUM_TYPE) (((uint64_t) a.type & mask) | ((uint64_t) b.type & ~mask));
+    memcpy(&result.value, &bits, sizeof(bits));
+    return result;
+}
+
+// The test holds when it is non-zero; nan does not hold.
+static bool testHolds(RET_VAL test)
+{
+    return test.value != 0 && !isnan(test.value);
+}
+
+// (cond test then else) evaluates test and then only the branch it selects,
+// unless both branches are cheap leaves, which are selected without branching.
+static bool resumeCond(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    FUNC_AST_NODE *funcNode = &frame->node->data.function;
+    AST_NODE **ops = funcNode->ops;
+
+    switch (frame->state)
+    {
+        case ENTERING:
+            if (funcNode->numOps == 3 && isCheapLeaf(ops[1]) && isCheapLeaf(ops[2]))
+            {
+                frame->u.leaves[0] = readLeaf(ops[1]);
+                frame->u.leaves[1] = readLeaf(ops[2]);
+                frame->state = LEAF_TEST;
+            }
+            else if (checkArity(funcNode))
+            {
+                frame->state = TEST;
+            }
+            else
+            {
+                *value = (RET_VAL){INT_TYPE, NAN};
+                return true;
+            }
+            *child = ops[0];
+            return false;
+        case LEAF_TEST:
+            // the selected leaf is charged like the branch it stands for
+            if (!chargeStep())
+            {
+                *value = (RET_VAL){INT_TYPE, NAN};
+                return true;
+            }
+            *value = selectRetVal((value->value != 0) & !isnan(value->value), frame->u.leaves[0], frame->u.leaves[1]);
+            return true;
+        case TEST:
+            frame->state = BRANCH;
+            *child = testHolds(*value) ? ops[1] : ops[2];
+            return false;
+        default:
+            // the branch's value is the cond's
+            return true;
+    }
+}
+
+static bool resumeSymbol(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    if (frame->state == ENTERING)
+    {
+        frame->state = BOUND_VALUE;
+        *child = frame->u.binding->val;
+        return false;
+    }
+
+    *value = castToBinding(frame->u.binding, *value);
+    return true;
+}
+
+// Leaves the call: its caller's frame is current again and result is cast
+// to the return type.
+static bool returnFromCall(EVAL_FRAME *frame, RET_VAL result, RET_VAL *value)
+{
+    restoreFrames(frame->u.call.saved);
+    *value = castToBinding(frame->u.call.function->binding, result);
+    return true;
+}
+
+// Starts on callee's arguments for callNode: the first call of the frame, or
+// a tail call when a function is already current. Returns false, with value
+// set, if there is no room for them.
+static bool beginArguments(EVAL_FRAME *frame, FUNC_DEF *callee, AST_NODE *callNode, RET_VAL *value)
+{
+    if (!claimArguments(callee, callNode, &frame->u.call.argBase))
+    {
+        if (frame->u.call.function != NULL)
+        {
+            returnFromCall(frame, (RET_VAL){INT_TYPE, NAN}, value);
+            return false;
+        }
+        // the first call never started, there is nothing to cast
+        restoreFrames(frame->u.call.saved);
+        *value = (RET_VAL){INT_TYPE, NAN};
+        return false;
+    }
+
+    frame->u.call.callee = callee;
+    frame->u.call.expr = callNode;
+    frame->state = ARGUMENTS;
+    frame->next = 0;
+    return true;
+}
+
+// Leaf arguments are stored on the spot. Returns false at the first that is
+// not a leaf, as child.
+static bool leafArguments(EVAL_FRAME *frame, AST_NODE **child)
+{
+    FUNC_DEF *callee = frame->u.call.callee;
+    AST_NODE **ops = frame->u.call.expr->data.function.ops;
+
+    while (frame->next < (int) callee->numParams)
+    {
+        AST_NODE *argument = ops[frame->next++];
+        if (!isCheapLeaf(argument))
+        {
+            *child = argument;
+            return false;
+        }
+        storeArgument(callee, frame->u.call.argBase, frame->next - 1, enterLeaf(argument));
+    }
+    return true;
+}
+
+// All of callee's arguments are in: its frame becomes the current one.
+// Returns false if the step limit ends the call instead.
+static bool enterCallee(EVAL_FRAME *frame)
+{
+    FUNC_DEF *callee = frame->u.call.callee;
+
+    if (frame->u.call.function == NULL)
+    {
+        enterFrame(frame->u.call.argBase);
+    }
+    else
+    {
+        if (!chargeStep())
+            return false;
+        replaceFrame(callee, frame->u.call.argBase);
+    }
+
+    frame->u.call.function = callee;
+    frame->u.call.expr = callee->body;
+    return true;
+}
+
+// Takes the current function's body from expr on. A cond's branch is in tail
+// position as well, and a tail call to a function with the same return type
+// replaces the frame instead of nesting a new one; the casts would be the same.
+// A tail call with only leaf arguments goes round the loop, so one that never
+// ends runs in constant space until a budget stops it.
+static bool evalBody(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    RET_VAL nan = {INT_TYPE, NAN};
+
+    for (;;)
+    {
+        AST_NODE *expr = frame->u.call.expr;
+
+        if (expr->type == FUNC_NODE_TYPE && expr->data.function.oper == COND_OPER)
+        {
+            if (!chargeStep() || !checkArity(&expr->data.function))
+                return returnFromCall(frame, nan, value);
+            frame->state = TEST;
+            *child = expr->data.function.ops[0];
+            return false;
+        }
+
+        if (expr->type == FUNC_NODE_TYPE && expr->data.function.oper == CUSTOM_OPER)
+        {
+            FUNC_DEF *callee = resolveFunction(expr);
+            if (callee == NULL)
+                return returnFromCall(frame, nan, value);
+            if (callee->binding->val_type == frame->u.call.function->binding->val_type)
+            {
+                if (!beginArguments(frame, callee, expr, value))
+                    return true;
+                if (!leafArguments(frame, child))
+                    return false;
+                if (!enterCallee(frame))
+                    return returnFromCall(frame, nan, value);
+                continue;
+            }
+        }
+
+        frame->state = RESULT;
+        *child = expr;
+        return false;
+    }
+}
+
+// The rest of callee's arguments, then its body.
+static bool nextArgument(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    if (!leafArguments(frame, child))
+        return false;
+    if (!enterCallee(frame))
+        return returnFromCall(frame, (RET_VAL){INT_TYPE, NAN}, value);
+    return evalBody(frame, value, child);
+}
+
+// Arguments are evaluated in the caller's frame, cast to the parameter types,
+// into slots claimed at the top of the frame stack before any of them is
+// evaluated, so calls the arguments make stack above them.
+static bool resumeCall(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    AST_NODE *expr = frame->u.call.expr;
+
+    switch (frame->state)
+    {
+        case ENTERING:
+        {
+            FUNC_DEF *function = resolveFunction(frame->node);
+            if (function == NULL)
+            {
+                *value = (RET_VAL){INT_TYPE, NAN};
+                return true;
+            }
+            frame->u.call.saved = markFrames();
+            frame->u.call.function = NULL;
+            if (!beginArguments(frame, function, frame->node, value))
+                return true;
+            return nextArgument(frame, value, child);
+        }
+        case ARGUMENTS:
+            storeArgument(frame->u.call.callee, frame->u.call.argBase, frame->next - 1, *value);
+            return nextArgument(frame, value, child);
+        case TEST:
+            frame->u.call.expr = expr->data.function.ops[testHolds(*value) ? 1 : 2];
+            return evalBody(frame, value, child);
+        default:
+            return returnFromCall(frame, *value, value);
+    }
+}
+
+// Leaves a range with result, giving the variable back the value it had.
+static bool finishRange(EVAL_FRAME *frame, RET_VAL result, RET_VAL *value)
+{
+    rangeVariable(&frame->node->data.function)->val->data.number.value = frame->u.range.saved;
+    *value = result;
+    return true;
+}
+
+// Start and step are assigned to the variable, so they get its type.
+static void storeBound(EVAL_FRAME *frame, SYMBOL_TABLE_NODE *variable, int bound, RET_VAL value)
+{
+    switch (bound)
+    {
+        case 0:
+            frame->u.range.bounds.start = castToBinding(variable, value).value;
+            break;
+        case 1:
+            frame->u.range.end = value.value;
+            break;
+        default:
+            frame->u.range.bounds.step = castToBinding(variable, value).value;
+            break;
+    }
+}
+
+// Enters the element for the next value, if any are left.
+static bool nextElement(EVAL_FRAME *frame, SYMBOL_TABLE_NODE *variable, RET_VAL *value, AST_NODE **child)
+{
+    if (frame->u.range.index == frame->u.range.bounds.count)
+        return finishRange(frame, frame->acc, value);
+
+    variable->val->data.number.value = rangeValue(&frame->u.range.bounds, frame->u.range.index);
+    *child = rangeElement(&frame->node->data.function);
+    return false;
+}
+
+// The bounds are evaluated once, then the element once for each value of the
+// variable, written to the value it is bound to. The range can be evaluated
+// again while its element is (a lambda recursing through it), so the
+// variable's value is put back when it is done.
+static bool resumeRange(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    FUNC_AST_NODE *funcNode = &frame->node->data.function;
+    SYMBOL_TABLE_NODE *variable = rangeVariable(funcNode);
+    int numBounds = funcNode->numOps - 1;
+    const OPER_DESC *desc;
+
+    switch (frame->state)
+    {
+        case ENTERING:
+            if (rangeReducer(funcNode) == NULL)
+            {
+                *value = (RET_VAL){INT_TYPE, NAN};
+                return true;
+            }
+            frame->u.range.saved = variable->val->data.number.value;
+            frame->u.range.bounds.step = 1;
+            frame->state = BOUNDS;
+            break;
+        case BOUNDS:
+            storeBound(frame, variable, frame->next - 1, *value);
+            break;
+        default:
+            desc = &operTable[resolveFunc(funcNode->ident)];
+            combineElement(desc, &frame->acc, frame->u.range.index++, *value);
+            return nextElement(frame, variable, value, child);
+    }
+
+    while (frame->next < numBounds)
+    {
+        AST_NODE *bound = funcNode->ops[frame->next++];
+        if (!isCheapLeaf(bound))
+        {
+            *child = bound;
+            return false;
+        }
+        storeBound(frame, variable, frame->next - 1, enterLeaf(bound));
+    }
+
+    if (!countRange(funcNode, frame->u.range.end, &frame->u.range.bounds))
+        return finishRange(frame, (RET_VAL){INT_TYPE, NAN}, value);
+
+    desc = &operTable[resolveFunc(funcNode->ident)];
+    frame->acc.type = funcNode->typed ? funcNode->staticType : INT_TYPE;
+    frame->acc.value = desc->shape == FOLD_SHAPE ? desc->identity : NAN;
+    if (reduceRangeBlocks(funcNode, desc, &frame->u.range.bounds, &frame->acc))
+        return finishRange(frame, frame->acc, value);
+
+    frame->state = ELEMENT;
+    frame->u.range.index = 0;
+    return nextElement(frame, variable, value, child);
+}
+
+// Charges the samples pending to the frames in flight, outermost first, each
+// under the name of what it evaluates (see ciLispSampler.h).
+static void sampleFrames(void)
+{
+    beginSample();
+    for (size_t i = 0; i < evalTop; i++)
+    {
+        EVAL_FRAME *frame = &evalStack[i];
+        AST_NODE *node = frame->node;
+        SYMBOL_ID name;
+
+        if (frame->kind == SYM_FRAME)
+            name = node->data.symbol.ident;
+        else if (frame->kind == CALL_FRAME && frame->state != ENTERING && frame->u.call.function != NULL)
+            name = frame->u.call.function->binding->ident;     // after tail calls, the one it is in
+        else
+            name = node->data.function.ident;
+        sampleFrame(name, node->span);
+    }
+    endSample();
+}
+
+static bool resume(EVAL_FRAME *frame, RET_VAL *value, AST_NODE **child)
+{
+    switch (frame->kind)
+    {
+        case OPER_FRAME:
+            return resumeOper(frame, value, child);
+        case COND_FRAME:
+            return resumeCond(frame, value, child);
+        case SYM_FRAME:
+            return resumeSymbol(frame, value, child);
+        case CALL_FRAME:
+            return resumeCall(frame, value, child);
+        default:
+            return resumeRange(frame, value, child);
+    }
+}
+
+// Evaluates an AST_NODE.
+// returns a RET_VAL storing the the resulting value and type.
+// Frames pushed by this call sit above any already on the stack, which is
+// how sessionValue can evaluate a definition in the middle of an expression.
+RET_VAL eval(AST_NODE *node)
+{
+    size_t base = evalTop;
+    RET_VAL value;
+    AST_NODE *child;
+
+    if (samplePending())
+        sampleFrames();
+    enter(node, &value);
+    while (evalTop > base)
+    {
+        if (samplePending())
+            sampleFrames();
+
+        // entering a node may move the stack, so the frame is looked up each time
+        EVAL_FRAME *frame = &evalStack[evalTop - 1];
+        if (!resume(frame, &value, &child))
+        {
+            enter(child, &value);
+            continue;
+        }
+
+        if (frame->kind != SYM_FRAME && profilingEnabled)
+            profileExit(frame->node->data.function.oper, frame->node->data.function.numOps, value.type);
+        evalTop--;
+    }
+
+    return value;
+}
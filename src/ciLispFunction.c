@@ -0,0 +1,440 @@
+//CiLisp user-defined functions
+//Frame stack, parameter resolution, tail calls and definition-time inlining.
+
+#include "ciLispFunction.h"
+#include "ciLispBudget.h"
+#include "ciLispOperators.h"
+#include "ciLispSession.h"
+#include "ciLispWalk.h"
+
+#define MIN_FRAME_CAPACITY 256
+
+// Arguments of every call in flight; a frame is frameStack[frameBase .. frameTop).
+static RET_VAL *frameStack = NULL;
+static size_t frameCapacity = 0;
+static size_t frameBase = 0;
+static size_t frameTop = 0;
+
+static bool reserveFrame(size_t size)
+{
+    if (size <= frameCapacity)
+        return true;
+
+    size_t capacity = growStack(frameCapacity, size < MIN_FRAME_CAPACITY ? MIN_FRAME_CAPACITY : size,
+                                sizeof(RET_VAL));
+    if (capacity == 0)
+        return false;
+
+    frameStack = memRealloc(MEM_FRAMES, frameStack, frameCapacity * sizeof(RET_VAL), capacity * sizeof(RET_VAL));
+    frameCapacity = capacity;
+    return true;
+}
+
+// Turns references to parameters in body into ARG nodes.
+// Lambdas nested in the body have frames of their own and are left alone.
+static void resolveParams(AST_NODE *body, FUNC_DEF *function)
+{
+    WALK_STACK stack;
+    WALK_ITEM item;
+
+    initWalk(&stack);
+    pushWalk(&stack, body, function, false);
+    while (popWalk(&stack, &item))
+    {
+        AST_NODE *node = item.node;
+        if (item.enclosing != function)
+            continue;
+
+        pushBindings(&stack, node, function);
+        pushOperands(&stack, node, function);
+
+        // a let inside the body shadows the parameter
+        if (node->type != SYM_NODE_TYPE || findSymbol(node->data.symbol.ident, node) != NULL)
+            continue;
+        for (size_t slot = 0; slot < function->numParams; slot++)
+        {
+            if (function->params[slot].ident == node->data.symbol.ident)
+            {
+                setNodeType(node, ARG_NODE_TYPE);
+                node->data.arg.ident = function->params[slot].ident;
+                node->data.arg.slot = slot;
+                break;
+            }
+        }
+    }
+    endWalk(&stack);
+}
+
+SYMBOL_TABLE_NODE *createResolvedFunctionBinding(SYMBOL_ID ident, SYMBOL_TABLE_NODE *params, AST_NODE *body,
+                                                 NUM_TYPE returnType)
+{
+    FUNC_DEF *function = memAlloc(MEM_FUNCTION, sizeof(FUNC_DEF));
+
+    for (SYMBOL_TABLE_NODE *iter = params; iter != NULL; iter = iter->next)
+        function->numParams++;
+
+    function->params = memAlloc(MEM_FUNCTION, function->numParams * sizeof(SYMBOL_TABLE_NODE));
+    chargeAllocation(sizeof(FUNC_DEF) + function->numParams * sizeof(SYMBOL_TABLE_NODE));
+
+    size_t slot = 0;
+    while (params != NULL)
+    {
+        SYMBOL_TABLE_NODE *next = params->next;
+        function->params[slot] = *params;
+        function->params[slot].next = NULL;
+        memFree(MEM_SYMBOL_TABLE, params, sizeof(SYMBOL_TABLE_NODE));
+        params = next;
+        slot++;
+    }
+
+    function->ident = ident;
+    function->body = body;
+
+    SYMBOL_TABLE_NODE *binding = createSymbolTableNode(ident, body, returnType);
+    binding->function = function;
+    function->binding = binding;
+
+    return binding;
+}
+
+SYMBOL_TABLE_NODE *createFunctionBinding(SYMBOL_ID ident, SYMBOL_TABLE_NODE *params, AST_NODE *body,
+                                         NUM_TYPE returnType)
+{
+    SYMBOL_TABLE_NODE *binding = createResolvedFunctionBinding(ident, params, body, returnType);
+    resolveParams(body, binding->function);
+    return binding;
+}
+
+void freeFunctionDef(FUNC_DEF *function)
+{
+    if (function == NULL)
+        return;
+    memFree(MEM_FUNCTION, function->params, function->numParams * sizeof(SYMBOL_TABLE_NODE));
+    memFree(MEM_FUNCTION, function, sizeof(FUNC_DEF));
+}
+
+bool argInFrame(ARG_AST_NODE *argNode)
+{
+    return frameBase + argNode->slot < frameTop;
+}
+
+RET_VAL evalArgNode(ARG_AST_NODE *argNode)
+{
+    if (!argInFrame(argNode))
+    {
+        outPrintf("ERROR: parameter <%s> used outside of its function\n", symbolName(argNode->ident));
+        return (RET_VAL){INT_TYPE, NAN};
+    }
+    return frameStack[frameBase + argNode->slot];
+}
+
+FUNC_DEF *resolveFunction(AST_NODE *callNode)
+{
+    SYMBOL_ID ident = callNode->data.function.ident;
+    SYMBOL_TABLE_NODE *binding = findSymbol(ident, callNode);
+
+    if (binding == NULL)
+    {
+        SESSION_DEF *def = findSessionDef(ident);
+        if (def != NULL)
+            binding = def->binding;
+    }
+
+    if (binding == NULL)
+    {
+        outPrintf("ERROR: undefined function <%s>\n", symbolName(ident));
+        return NULL;
+    }
+    if (binding->function == NULL)
+    {
+        outPrintf("ERROR: <%s> is not a function\n", symbolName(ident));
+        return NULL;
+    }
+
+    return binding->function;
+}
+
+FRAME_MARK markFrames(void)
+{
+    return (FRAME_MARK){frameBase, frameTop};
+}
+
+void restoreFrames(FRAME_MARK mark)
+{
+    frameBase = mark.base;
+    frameTop = mark.top;
+}
+
+bool claimArguments(FUNC_DEF *function, AST_NODE *callNode, size_t *base)
+{
+    int numOps = callNode->data.function.numOps;
+
+    if (numOps < (int) function->numParams)
+    {
+        outPrintf("ERROR: too few parameters for the function <%s>\n", symbolName(function->ident));
+        return false;
+    }
+    if (numOps > (int) function->numParams)
+        outPrintf("WARNING: too many parameters for the function <%s>\n", symbolName(function->ident));
+
+    if (!reserveFrame(frameTop + function->numParams))
+        return false;
+
+    *base = frameTop;
+    frameTop += function->numParams;
+    return true;
+}
+
+void storeArgument(FUNC_DEF *function, size_t base, size_t slot, RET_VAL value)
+{
+    frameStack[base + slot] = castToBinding(&function->params[slot], value);
+}
+
+void enterFrame(size_t base)
+{
+    frameBase = base;
+}
+
+void replaceFrame(FUNC_DEF *callee, size_t base)
+{
+    memmove(frameStack + frameBase, frameStack + base, callee->numParams * sizeof(RET_VAL));
+    frameTop = frameBase + callee->numParams;
+}
+
+/*
+ * Inlining. A call is replaced by a copy of the callee's body when
+ *  - the callee is let-bound, so the call always reaches the same lambda,
+ *  - the body is a small tree of numbers, parameters and arithmetic, so it
+ *    has no symbols that could resolve differently at the call site,
+ *  - the body's type is the return type, so the return cast is a no-op,
+ *  - every operand is a number, symbol or parameter of the parameter's type,
+ *    so substituting it needs no cast either,
+ *  - the body reads each symbol operand once, in parameter order, so their
+ *    let values are evaluated as often and in the order the call would.
+ */
+
+// Whether node fits in an inlined body; sets type to the type it evaluates to.
+static bool inlinableBody(AST_NODE *node, FUNC_DEF *function, NUM_TYPE *type, int *budget)
+{
+    if (node == NULL || node->symbolTable != NULL || (*budget)-- <= 0)
+        return false;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            *type = node->data.number.type;
+            return true;
+        case ARG_NODE_TYPE:
+            *type = function->params[node->data.arg.slot].val_type;
+            return true;
+        case FUNC_NODE_TYPE:
+            break;
+        default:
+            return false;
+    }
+
+    // arithmetic and comparisons, with an operand count that needs no message
+    FUNC_AST_NODE *funcNode = &node->data.function;
+    if (funcNode->oper == CUSTOM_OPER)
+        return false;
+    const OPER_DESC *desc = &operTable[funcNode->oper];
+    if (desc->shape != UNARY_SHAPE && desc->shape != BINARY_SHAPE && desc->shape != FOLD_SHAPE &&
+        desc->shape != REDUCE_SHAPE)
+        return false;
+    if (funcNode->numOps < desc->minOps || (desc->maxOps != ANY_OPS && funcNode->numOps > desc->maxOps))
+        return false;
+
+    *type = INT_TYPE;
+    for (int i = 0; i < funcNode->numOps; i++)
+    {
+        NUM_TYPE opType;
+        if (!inlinableBody(funcNode->ops[i], function, &opType, budget))
+            return false;
+        *type = promoteType(desc, *type, opType);
+    }
+    return true;
+}
+
+// Appends to reads, in evaluation order, the slot of each parameter node reads
+// whose operand is a symbol.
+static void collectSymbolReads(AST_NODE *node, AST_NODE **args, size_t *reads, size_t *numReads)
+{
+    if (node->type == ARG_NODE_TYPE)
+    {
+        if (args[node->data.arg.slot]->type == SYM_NODE_TYPE)
+            reads[(*numReads)++] = node->data.arg.slot;
+        return;
+    }
+    if (node->type != FUNC_NODE_TYPE)
+        return;
+
+    for (int i = 0; i < node->data.function.numOps; i++)
+        collectSymbolReads(node->data.function.ops[i], args, reads, numReads);
+}
+
+// A symbol evaluates its let value each time it is read, and a call
+// evaluates its operands once each, in order. The body must read the symbol
+// operands the same way, or inlining would drop, repeat or reorder what their
+// values print or draw.
+static bool readsSymbolsInOrder(FUNC_DEF *callee, AST_NODE **args)
+{
+    size_t reads[INLINE_MAX_NODES];
+    size_t numReads = 0;
+    size_t next = 0;
+
+    collectSymbolReads(callee->body, args, reads, &numReads);
+    for (size_t slot = 0; slot < callee->numParams; slot++)
+    {
+        if (args[slot]->type != SYM_NODE_TYPE)
+            continue;
+        if (next == numReads || reads[next] != slot)
+            return false;
+        next++;
+    }
+    return next == numReads;
+}
+
+static bool inlinableArg(AST_NODE *arg, FUNC_DEF *callee, size_t slot, FUNC_DEF *enclosing)
+{
+    NUM_TYPE paramType = callee->params[slot].val_type;
+
+    if (arg->symbolTable != NULL)
+        return false;
+
+    switch (arg->type)
+    {
+        case NUM_NODE_TYPE:
+            // an INT literal only needs retagging to become a DOUBLE parameter
+            return arg->data.number.type == paramType || paramType == DOUBLE_TYPE;
+        case ARG_NODE_TYPE:
+            return enclosing != NULL && enclosing->params[arg->data.arg.slot].val_type == paramType;
+        case SYM_NODE_TYPE:
+        {
+            SYMBOL_TABLE_NODE *binding = findSymbol(arg->data.symbol.ident, arg);
+            return binding != NULL && binding->function == NULL && binding->val_type == paramType;
+        }
+        default:
+            return false;
+    }
+}
+
+static AST_NODE *copyArg(AST_NODE *arg, NUM_TYPE paramType)
+{
+    AST_NODE *copy;
+
+    switch (arg->type)
+    {
+        case NUM_NODE_TYPE:
+            return createNumberNode(arg->data.number.value, paramType);
+        case ARG_NODE_TYPE:
+            copy = createSymbolNode(arg->data.arg.ident);
+            setNodeType(copy, ARG_NODE_TYPE);
+            copy->data.arg = arg->data.arg;
+            return copy;
+        default:
+            return createSymbolNode(arg->data.symbol.ident);
+    }
+}
+
+// Copies keep the spans of what they copy: the body's nodes, and the call's
+// operands in place of parameters.
+static AST_NODE *copyInlined(AST_NODE *node, AST_NODE **args, FUNC_DEF *callee)
+{
+    AST_NODE *arg;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            return setSpan(createNumberNode(node->data.number.value, node->data.number.type), node->span);
+        case ARG_NODE_TYPE:
+            arg = args[node->data.arg.slot];
+            return setSpan(copyArg(arg, callee->params[node->data.arg.slot].val_type), arg->span);
+        default:
+            break;
+    }
+
+    OP_VECTOR *ops = NULL;
+    for (int i = 0; i < node->data.function.numOps; i++)
+        ops = addOpToList(ops, copyInlined(node->data.function.ops[i], args, callee));
+    return setSpan(createFunctionNode(node->data.function.ident, ops), node->span);
+}
+
+static void tryInline(AST_NODE *call, FUNC_DEF *enclosing)
+{
+    SYMBOL_TABLE_NODE *binding = findSymbol(call->data.function.ident, call);
+    if (binding == NULL || binding->function == NULL)
+        return;
+
+    FUNC_DEF *callee = binding->function;
+    if (call->data.function.numOps != (int) callee->numParams)
+        return;
+
+    NUM_TYPE bodyType;
+    int budget = INLINE_MAX_NODES;
+    if (!inlinableBody(callee->body, callee, &bodyType, &budget) || bodyType != binding->val_type)
+        return;
+
+    AST_NODE *args[INLINE_MAX_NODES];
+    if (callee->numParams > INLINE_MAX_NODES)
+        return;
+
+    for (size_t slot = 0; slot < callee->numParams; slot++)
+    {
+        args[slot] = call->data.function.ops[slot];
+        if (!inlinableArg(args[slot], callee, slot, enclosing))
+            return;
+    }
+    if (!readsSymbolsInOrder(callee, args))
+        return;
+
+    AST_NODE *copy = copyInlined(callee->body, args, callee);
+
+    for (size_t slot = 0; slot < callee->numParams; slot++)
+        freeNode(args[slot]);
+    memFree(MEM_OPERANDS, call->data.function.ops, call->data.function.numOps * sizeof(AST_NODE *));
+
+    // the call node keeps its place in its parent's operand list, the let
+    // section attached to it and its span
+    AST_NODE *parent = call->parent;
+    SYMBOL_TABLE_NODE *symbolTable = call->symbolTable;
+    struct scope_index *scope = call->scope;
+    SOURCE_SPAN span = call->span;
+    setNodeType(call, copy->type);
+    *call = *copy;
+    call->parent = parent;
+    call->symbolTable = symbolTable;
+    call->scope = scope;
+    call->span = span;
+    if (call->type == FUNC_NODE_TYPE)
+    {
+        for (int i = 0; i < call->data.function.numOps; i++)
+            call->data.function.ops[i]->parent = call;
+    }
+    memFree(NODE_MEM_KIND(copy->type), copy, sizeof(AST_NODE));
+}
+
+// A call's operands are inlined before the call itself, so an inlined body
+// gets operands that are already as small as they will get.
+void inlineCalls(AST_NODE *node, FUNC_DEF *enclosing)
+{
+    WALK_STACK stack;
+    WALK_ITEM item;
+
+    initWalk(&stack);
+    pushWalk(&stack, node, enclosing, false);
+    while (popWalk(&stack, &item))
+    {
+        node = item.node;
+        if (item.expanded)
+        {
+            tryInline(node, item.enclosing);
+            continue;
+        }
+
+        if (node->type == FUNC_NODE_TYPE && node->data.function.oper == CUSTOM_OPER)
+            pushWalk(&stack, node, item.enclosing, true);
+        pushOperands(&stack, node, item.enclosing);
+        pushBindings(&stack, node, item.enclosing);
+    }
+    endWalk(&stack);
+}
@@ -0,0 +1,74 @@
+#ifndef __cilisp_function_h_
+#define __cilisp_function_h_
+
+#include "ciLisp.h"
+
+// User-defined functions (CUSTOM_OPER).
+//
+//   ((let (int sq lambda (int x) (mult x x))) (sq 7))
+//   (define double avg lambda (a b) (div (add a b) 2))
+//
+// Parameters are resolved to frame slots when the lambda is defined, so a
+// call evaluates its operands straight into a preallocated stack of RET_VALs
+// and the body reads them by index: no symbol table is built and nothing is
+// allocated per call. A call in tail position reuses the caller's frame, and
+// calls to small let-bound functions are inlined when the let is parsed.
+
+// Bodies with at most this many nodes are candidates for inlining.
+#define INLINE_MAX_NODES 8
+
+typedef struct function_def {
+    SYMBOL_ID ident;
+    SYMBOL_TABLE_NODE *binding;     // val_type is the return type
+    SYMBOL_TABLE_NODE *params;      // numParams entries, val_type is the parameter type
+    size_t numParams;
+    AST_NODE *body;
+} FUNC_DEF;
+
+// Builds the binding for a lambda; params is the arg_list, body its s_expr.
+SYMBOL_TABLE_NODE *createFunctionBinding(SYMBOL_ID ident, SYMBOL_TABLE_NODE *params, AST_NODE *body,
+                                         NUM_TYPE returnType);
+// The same for a body that already reads its parameters by slot, as one read
+// back from an image does (see ciLispImage.h).
+SYMBOL_TABLE_NODE *createResolvedFunctionBinding(SYMBOL_ID ident, SYMBOL_TABLE_NODE *params, AST_NODE *body,
+                                                 NUM_TYPE returnType);
+void freeFunctionDef(FUNC_DEF *function);
+
+// Where the frame stack stood before a call, restored when it returns.
+typedef struct {
+    size_t base;
+    size_t top;
+} FRAME_MARK;
+
+// Calls are driven by eval (see ciLispEval.c) through the functions below.
+
+// The lambda a call refers to: let-bound ones first, then session
+// definitions. Reports the error and returns NULL if there is none.
+FUNC_DEF *resolveFunction(AST_NODE *callNode);
+
+FRAME_MARK markFrames(void);
+void restoreFrames(FRAME_MARK mark);
+
+// Checks the number of operands and claims function's parameter slots at the
+// top of the frame stack, at *base. The operands are then evaluated in the
+// caller's frame, calls they make stacking above the claimed slots, and
+// stored with storeArgument.
+bool claimArguments(FUNC_DEF *function, AST_NODE *callNode, size_t *base);
+void storeArgument(FUNC_DEF *function, size_t base, size_t slot, RET_VAL value);
+
+// Makes the arguments at base the innermost frame.
+void enterFrame(size_t base);
+
+// For a tail call: moves callee's arguments at base over the innermost frame.
+void replaceFrame(FUNC_DEF *callee, size_t base);
+
+// Value of parameter slot in the innermost call frame.
+RET_VAL evalArgNode(ARG_AST_NODE *argNode);
+
+// Whether evalArgNode finds argNode's slot.
+bool argInFrame(ARG_AST_NODE *argNode);
+
+// Replaces calls to small let-bound functions under node with their bodies.
+void inlineCalls(AST_NODE *node, FUNC_DEF *enclosing);
+
+#endif
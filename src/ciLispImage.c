@@ -0,0 +1,1036 @@
+//CiLisp images
+//Writing parsed forms as records, and checking and rebuilding them from a mapped image.
+
+#include "ciLispImage.h"
+#include "ciLispBudget.h"
+#include "ciLispFunction.h"
+#include "ciLispProfile.h"
+#include "ciLispScope.h"
+#include "ciLispSession.h"
+#include "ciLispWalk.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+// every record and array starts on this boundary
+#define IMAGE_ALIGN 4
+
+bool imageCompiling = false;
+
+static uint64_t checksumBytes(uint64_t hash, const unsigned char *bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static size_t alignImage(size_t size)
+{
+    return (size + IMAGE_ALIGN - 1) & ~(size_t) (IMAGE_ALIGN - 1);
+}
+
+// Grows an array of itemSize items to hold at least needed of them. The new
+// items are zeroed.
+static void *reserveItems(void *items, size_t *capacity, size_t needed, size_t itemSize)
+{
+    if (needed <= *capacity)
+        return items;
+
+    size_t grown = *capacity == 0 ? 64 : *capacity;
+    while (grown < needed)
+        grown *= 2;
+    items = memRealloc(MEM_IMAGE, items, *capacity * itemSize, grown * itemSize);
+    memset((unsigned char *) items + *capacity * itemSize, 0, (grown - *capacity) * itemSize);
+    *capacity = grown;
+    return items;
+}
+
+/*
+ * Writing. Records go straight to the file as each form is read; the names
+ * and the header, which need all of them, are written at exit.
+ */
+
+static FILE *imageFile = NULL;
+static const char *imagePath = NULL;
+static uint64_t imageSize = 0;
+static uint64_t imageChecksum = FNV_OFFSET;
+static uint32_t imageForms = 0;
+static bool imageFailed = false;
+
+// index + 1 in the image of each interned id, 0 until it is used
+static uint32_t *symbolIndex = NULL;
+static size_t symbolIndexCapacity = 0;
+static SYMBOL_ID *imageSymbols = NULL;
+static size_t numImageSymbols = 0;
+static size_t imageSymbolsCapacity = 0;
+
+// the record being put together
+static unsigned char *recordBuffer = NULL;
+static size_t recordCapacity = 0;
+
+// offsets of the nodes written whose parent is not written yet
+static uint32_t *pendingNodes = NULL;
+static size_t numPendingNodes = 0;
+static size_t pendingCapacity = 0;
+
+static void writeBytes(const void *bytes, size_t size)
+{
+    if (fwrite(bytes, 1, size, imageFile) != size)
+        imageFailed = true;
+    imageChecksum = checksumBytes(imageChecksum, bytes, size);
+    imageSize += size;
+}
+
+static uint32_t imageSymbol(SYMBOL_ID id)
+{
+    symbolIndex = reserveItems(symbolIndex, &symbolIndexCapacity, internedCount(), sizeof(uint32_t));
+    if (symbolIndex[id] == 0)
+    {
+        imageSymbols = reserveItems(imageSymbols, &imageSymbolsCapacity, numImageSymbols + 1, sizeof(SYMBOL_ID));
+        imageSymbols[numImageSymbols++] = id;
+        symbolIndex[id] = numImageSymbols;
+    }
+    return symbolIndex[id] - 1;
+}
+
+// A zeroed record of size bytes, padded, to go at the end of the image.
+static unsigned char *beginRecord(IMAGE_RECORD_KIND kind, size_t size)
+{
+    size = alignImage(size);
+    recordBuffer = reserveItems(recordBuffer, &recordCapacity, size, 1);
+    memset(recordBuffer, 0, size);
+
+    IMAGE_RECORD *record = (IMAGE_RECORD *) recordBuffer;
+    record->kind = kind;
+    record->size = size;
+    if (imageSize + size > UINT32_MAX)
+        imageFailed = true;
+    return recordBuffer;
+}
+
+static uint32_t endRecord(void)
+{
+    uint32_t offset = imageSize;
+    writeBytes(recordBuffer, ((IMAGE_RECORD *) recordBuffer)->size);
+    return offset;
+}
+
+// Fills in binding, whose parameters, if it is a lambda, go at params in the
+// record being written.
+static void writeBinding(IMAGE_BINDING *out, SYMBOL_TABLE_NODE *binding, uint32_t val, size_t params)
+{
+    out->ident = imageSymbol(binding->ident);
+    out->type = binding->val_type;
+    out->val = val;
+    if (binding->function == NULL)
+        return;
+
+    FUNC_DEF *function = binding->function;
+    IMAGE_PARAM *param = (IMAGE_PARAM *) (recordBuffer + params);
+    out->function = 1;
+    out->numParams = function->numParams;
+    out->params = imageSize + params;
+    for (size_t slot = 0; slot < function->numParams; slot++)
+        param[slot] = (IMAGE_PARAM){imageSymbol(function->params[slot].ident), function->params[slot].val_type};
+}
+
+static size_t paramsSize(SYMBOL_TABLE_NODE *binding)
+{
+    return binding->function == NULL ? 0 : binding->function->numParams * sizeof(IMAGE_PARAM);
+}
+
+// Size of node's IMAGE_NUM, IMAGE_SYM, IMAGE_ARG or IMAGE_CALL.
+static size_t nodeSize(AST_NODE *node)
+{
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            return sizeof(IMAGE_NUM);
+        case SYM_NODE_TYPE:
+            return sizeof(IMAGE_SYM);
+        case ARG_NODE_TYPE:
+            return sizeof(IMAGE_ARG);
+        default:
+            return sizeof(IMAGE_CALL) + node->data.function.numOps * sizeof(uint32_t);
+    }
+}
+
+// Writes node, whose children are the last pending nodes, and makes it pending instead.
+static void writeNode(AST_NODE *node)
+{
+    size_t numBindings = 0;
+    size_t numVisible = 0;
+    size_t numChildren = 0;
+    size_t size = 0;
+    for (SYMBOL_TABLE_NODE *iter = node->symbolTable; iter != NULL; iter = iter->next)
+    {
+        numBindings++;
+        numVisible += scopeLookup(node->scope, iter->ident) == iter;
+        numChildren += iter->val != NULL;
+        size += paramsSize(iter);
+    }
+
+    int numOps = node->type == FUNC_NODE_TYPE ? node->data.function.numOps : 0;
+    for (int i = 0; i < numOps; i++)
+        numChildren += node->data.function.ops[i] != NULL;
+
+    size_t let = nodeSize(node);
+    size_t bindings = let + (numBindings > 0 ? sizeof(IMAGE_LET) : 0);
+    size_t visible = bindings + numBindings * sizeof(IMAGE_BINDING);
+    size_t params = visible + numVisible * sizeof(uint32_t);
+    size += params;
+
+    IMAGE_RECORD *record = (IMAGE_RECORD *) beginRecord(IMAGE_NODE_RECORD, size);
+    const uint32_t *children = &pendingNodes[numPendingNodes - numChildren];
+    record->type = node->type;
+
+    // binding values come before operands
+    if (numBindings > 0)
+    {
+        IMAGE_LET *out = (IMAGE_LET *) (recordBuffer + let);
+        IMAGE_BINDING *binding = (IMAGE_BINDING *) (recordBuffer + bindings);
+        uint32_t *visibleOut = (uint32_t *) (recordBuffer + visible);
+        uint32_t index = 0;
+
+        record->flags |= IMAGE_LET_FLAG;
+        *out = (IMAGE_LET){numBindings, imageSize + bindings, numVisible, imageSize + visible};
+        for (SYMBOL_TABLE_NODE *iter = node->symbolTable; iter != NULL; iter = iter->next, index++)
+        {
+            writeBinding(binding++, iter, iter->val != NULL ? *children++ : IMAGE_NONE, params);
+            params += paramsSize(iter);
+            if (scopeLookup(node->scope, iter->ident) == iter)
+                *visibleOut++ = index;
+        }
+    }
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            if (node->data.number.type == INT_TYPE)
+                record->flags |= IMAGE_INT_FLAG;
+            memcpy(((IMAGE_NUM *) record)->value, &node->data.number.value, sizeof(double));
+            break;
+        case SYM_NODE_TYPE:
+            ((IMAGE_SYM *) record)->ident = imageSymbol(node->data.symbol.ident);
+            break;
+        case ARG_NODE_TYPE:
+            ((IMAGE_ARG *) record)->ident = imageSymbol(node->data.arg.ident);
+            ((IMAGE_ARG *) record)->slot = node->data.arg.slot;
+            break;
+        case FUNC_NODE_TYPE:
+        {
+            IMAGE_CALL *call = (IMAGE_CALL *) record;
+            // operators are kept by name, as their ids are the ids of their names
+            call->oper = node->data.function.oper == CUSTOM_OPER ? IMAGE_CUSTOM :
+                         imageSymbol((SYMBOL_ID) node->data.function.oper);
+            call->ident = imageSymbol(node->data.function.ident);
+            call->numOps = numOps;
+            for (int i = 0; i < numOps; i++)
+                call->ops[i] = node->data.function.ops[i] != NULL ? *children++ : IMAGE_NONE;
+            break;
+        }
+    }
+
+    numPendingNodes -= numChildren;
+    pendingNodes[numPendingNodes++] = endRecord();
+}
+
+// Writes the tree under root in postorder; returns the offset of root.
+static uint32_t writeTree(AST_NODE *root)
+{
+    WALK_STACK stack;
+    WALK_ITEM item;
+
+    initWalk(&stack);
+    pushWalk(&stack, root, NULL, false);
+    while (popWalk(&stack, &item))
+    {
+        if (item.expanded)
+        {
+            pendingNodes = reserveItems(pendingNodes, &pendingCapacity, numPendingNodes + 1, sizeof(uint32_t));
+            writeNode(item.node);
+            continue;
+        }
+
+        // so that bindings are written first, and each list in order
+        pushWalk(&stack, item.node, NULL, true);
+        pushOperands(&stack, item.node, NULL);
+        pushBindings(&stack, item.node, NULL);
+    }
+    endWalk(&stack);
+
+    return pendingNodes[--numPendingNodes];
+}
+
+void writeImageExpression(AST_NODE *node)
+{
+    uint32_t root = writeTree(node);
+
+    IMAGE_EXPRESSION *out = (IMAGE_EXPRESSION *) beginRecord(IMAGE_EXPRESSION_RECORD, sizeof(IMAGE_EXPRESSION));
+    out->root = root;
+    endRecord();
+    imageForms++;
+}
+
+void writeImageDefinition(SYMBOL_TABLE_NODE *binding)
+{
+    uint32_t val = binding->val != NULL ? writeTree(binding->val) : IMAGE_NONE;
+
+    IMAGE_DEFINITION *out = (IMAGE_DEFINITION *) beginRecord(IMAGE_DEFINITION_RECORD,
+                                                             sizeof(IMAGE_DEFINITION) + paramsSize(binding));
+    writeBinding(&out->binding, binding, val, sizeof(IMAGE_DEFINITION));
+    endRecord();
+    imageForms++;
+}
+
+// Starts an image at path, its names numbered afresh.
+static bool openImage(const char *path)
+{
+    imageFile = fopen(path, "wb");
+    if (imageFile == NULL)
+        return false;
+
+    for (size_t i = 0; i < numImageSymbols; i++)
+        symbolIndex[imageSymbols[i]] = 0;
+    numImageSymbols = 0;
+
+    // the header is written last, once everything it describes is known
+    static const IMAGE_HEADER blank;
+    imageFailed = fwrite(&blank, sizeof(blank), 1, imageFile) != 1;
+    imageSize = sizeof(blank);
+    imageChecksum = FNV_OFFSET;
+    imageForms = 0;
+    imagePath = path;
+    return true;
+}
+
+// Appends the names, then goes back for the header. Returns false, having
+// removed the image rather than leave a truncated one behind, if any of it
+// could not be written.
+static bool closeImage(void)
+{
+    IMAGE_HEADER header = {.version = IMAGE_VERSION, .byteOrder = IMAGE_BYTE_ORDER,
+                           .numForms = imageForms, .records = sizeof(IMAGE_HEADER),
+                           .numNames = numImageSymbols, .names = imageSize};
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+
+    uint32_t offset = imageSize + numImageSymbols * sizeof(IMAGE_NAME);
+    for (size_t i = 0; i < numImageSymbols; i++)
+    {
+        IMAGE_NAME name = {offset, symbolLength(imageSymbols[i])};
+        writeBytes(&name, sizeof(name));
+        offset += name.length + 1;
+    }
+    for (size_t i = 0; i < numImageSymbols; i++)
+        writeBytes(symbolName(imageSymbols[i]), symbolLength(imageSymbols[i]) + 1);
+
+    static const unsigned char padding[IMAGE_ALIGN];
+    writeBytes(padding, alignImage(imageSize) - imageSize);
+    if (imageSize > UINT32_MAX)
+        imageFailed = true;
+
+    header.size = imageSize;
+    header.checksum = imageChecksum;
+    if (fseek(imageFile, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, imageFile) != 1)
+        imageFailed = true;
+    if (fclose(imageFile) != 0)
+        imageFailed = true;
+    imageFile = NULL;
+
+    if (imageFailed)
+        remove(imagePath);
+    return !imageFailed;
+}
+
+static void endImage(void)
+{
+    if (closeImage())
+        outPrintf("INFO: compiled %u forms into <%s>\n", imageForms, imagePath);
+    else
+        outPrintf("ERROR: could not write the image <%s>\n", imagePath);
+}
+
+void beginImage(const char *path)
+{
+    if (!openImage(path))
+    {
+        outPrintf("ERROR: cannot create the image <%s>\n", path);
+        exit(EXIT_FAILURE);
+    }
+    imageCompiling = true;
+    atexit(endImage);
+}
+
+/*
+ * Snapshots. The same writer, over the session instead of the input.
+ */
+
+static const char *snapshotPath = NULL;
+static size_t savedDefinitions = 0;
+
+void enableSnapshots(const char *path)
+{
+    snapshotPath = path;
+}
+
+static void writeSessionDef(SESSION_DEF *def)
+{
+    SYMBOL_TABLE_NODE *binding = def->binding;
+    uint32_t val = binding != NULL ? writeTree(binding->val) : IMAGE_NONE;
+    size_t params = binding != NULL ? paramsSize(binding) : 0;
+    size_t dependents = sizeof(IMAGE_SESSION) + params;
+
+    IMAGE_SESSION *out = (IMAGE_SESSION *) beginRecord(IMAGE_SESSION_RECORD,
+                                                       dependents + def->numDependents * sizeof(uint32_t));
+    if (binding != NULL)
+    {
+        savedDefinitions++;
+        out->valueType = def->value.type;
+        out->valid = def->valid;
+        memcpy(out->value, &def->value.value, sizeof(double));
+        writeBinding(&out->binding, binding, val, sizeof(IMAGE_SESSION));
+    }
+    else
+        out->binding.ident = imageSymbol(def->ident);
+
+    uint32_t *dependent = (uint32_t *) (recordBuffer + dependents);
+    out->numDependents = def->numDependents;
+    out->dependents = imageSize + dependents;
+    for (size_t i = 0; i < def->numDependents; i++)
+        dependent[i] = imageSymbol(def->dependents[i]);
+    endRecord();
+    imageForms++;
+}
+
+void writeSnapshot(void)
+{
+    if (snapshotPath == NULL)
+    {
+        outPrintf("ERROR: snapshot needs a file, see --snapshot=FILE");
+        return;
+    }
+    // the image being compiled is still open
+    if (imageCompiling)
+    {
+        outPrintf("ERROR: cannot snapshot while compiling an image");
+        return;
+    }
+    if (!openImage(snapshotPath))
+    {
+        outPrintf("ERROR: cannot create the snapshot <%s>", snapshotPath);
+        return;
+    }
+
+    // every name, in the order of its id, so a fresh process interns them to the same ids
+    for (SYMBOL_ID id = 0; id < internedCount(); id++)
+        imageSymbol(id);
+    savedDefinitions = 0;
+    visitSessionDefs(writeSessionDef);
+
+    if (!closeImage())
+    {
+        outPrintf("ERROR: could not write the snapshot <%s>", snapshotPath);
+        return;
+    }
+    outPrintf("INFO: saved %zu definitions and %zu names to <%s>", savedDefinitions, numImageSymbols, snapshotPath);
+}
+
+/*
+ * Loading. checkImage goes over every record once, without building
+ * anything, with a stack of the nodes it has seen whose parent it has not;
+ * runImage then goes over them again, building each node from its record on
+ * a stack of the nodes it has built.
+ */
+
+typedef struct {
+    const unsigned char *base;
+    uint64_t size;
+    const IMAGE_HEADER *header;
+    SYMBOL_ID *symbols;             // interned id of each name, once checked
+} IMAGE;
+
+// A node checkImage has seen: where its record is and the number of
+// parameters the lambda it is in must have.
+typedef struct {
+    uint32_t offset;
+    uint32_t params;
+} CHECKED_NODE;
+
+static CHECKED_NODE *checkedNodes = NULL;
+static size_t checkedCapacity = 0;
+static AST_NODE **builtNodes = NULL;
+static size_t builtCapacity = 0;
+static SYMBOL_TABLE_NODE **builtBindings = NULL;
+static size_t bindingsCapacity = 0;
+
+static const void *imageAt(const IMAGE *image, uint32_t offset)
+{
+    return image->base + offset;
+}
+
+// Size of the IMAGE_NUM, IMAGE_SYM, IMAGE_ARG or IMAGE_CALL at the start of a
+// node's record, or 0 if the record is too small for it.
+static uint64_t recordedNodeSize(const IMAGE_RECORD *record)
+{
+    uint64_t size;
+    switch (record->type)
+    {
+        case NUM_NODE_TYPE:
+            size = sizeof(IMAGE_NUM);
+            break;
+        case SYM_NODE_TYPE:
+            size = sizeof(IMAGE_SYM);
+            break;
+        case ARG_NODE_TYPE:
+            size = sizeof(IMAGE_ARG);
+            break;
+        default:
+            if (record->size < sizeof(IMAGE_CALL))
+                return 0;
+            size = sizeof(IMAGE_CALL) + (uint64_t) ((const IMAGE_CALL *) record)->numOps * sizeof(uint32_t);
+            break;
+    }
+    return size <= record->size ? size : 0;
+}
+
+// The let section of a checked node, NULL if it has none.
+static const IMAGE_LET *recordedLet(const IMAGE_RECORD *record)
+{
+    if (!(record->flags & IMAGE_LET_FLAG))
+        return NULL;
+    return (const IMAGE_LET *) ((const unsigned char *) record + recordedNodeSize(record));
+}
+
+// Whether count items of itemSize bytes at offset lie in the record at record.
+static bool inRecord(uint32_t record, uint32_t recordSize, uint32_t offset, uint64_t count, size_t itemSize)
+{
+    if (count == 0)
+        return true;
+    return offset % IMAGE_ALIGN == 0 && offset >= record &&
+           (uint64_t) offset + count * itemSize <= (uint64_t) record + recordSize;
+}
+
+static const char *checkNames(const IMAGE *image)
+{
+    const IMAGE_HEADER *header = image->header;
+    uint64_t text = header->names + (uint64_t) header->numNames * sizeof(IMAGE_NAME);
+    if (header->names % IMAGE_ALIGN != 0 || header->names < header->records || text > image->size)
+        return "the names are out of bounds";
+
+    const IMAGE_NAME *name = imageAt(image, header->names);
+    for (uint32_t i = 0; i < header->numNames; i++)
+    {
+        if (name[i].offset < text || (uint64_t) name[i].offset + name[i].length >= image->size ||
+            memchr(image->base + name[i].offset, '\0', name[i].length + 1) !=
+            image->base + name[i].offset + name[i].length)
+            return "a name is out of bounds";
+    }
+    return NULL;
+}
+
+// The operator named by the index-th name, CUSTOM_OPER if it is none.
+static OPER_TYPE namedOper(const IMAGE *image, uint32_t index)
+{
+    const IMAGE_NAME *name = (const IMAGE_NAME *) imageAt(image, image->header->names) + index;
+    SYMBOL_ID id = findInterned((const char *) image->base + name->offset, name->length);
+    return id == NO_SYMBOL ? CUSTOM_OPER : resolveFunc(id);
+}
+
+// Checks the binding, the parameters of which must lie in its record, and the
+// value it was given. params is what the value needs, and what a value that
+// is not a lambda body passes on to the lambda the binding is in.
+static const char *checkBinding(const IMAGE *image, const IMAGE_BINDING *binding, uint32_t record,
+                                uint32_t recordSize, CHECKED_NODE *val, uint32_t *params)
+{
+    uint32_t numNames = image->header->numNames;
+    if (binding->ident >= numNames || binding->type > DOUBLE_TYPE)
+        return "a binding is malformed";
+    if ((binding->val == IMAGE_NONE) != (val == NULL) || (val != NULL && val->offset != binding->val))
+        return "a binding's value is out of place";
+
+    if (!binding->function)
+    {
+        if (val != NULL && val->params > *params)
+            *params = val->params;
+        return NULL;
+    }
+
+    if (!inRecord(record, recordSize, binding->params, binding->numParams, sizeof(IMAGE_PARAM)))
+        return "a lambda's parameters are out of bounds";
+    const IMAGE_PARAM *param = imageAt(image, binding->params);
+    for (uint32_t slot = 0; slot < binding->numParams; slot++)
+    {
+        if (param[slot].ident >= numNames || param[slot].type > DOUBLE_TYPE)
+            return "a parameter is malformed";
+    }
+    if (val != NULL && val->params > binding->numParams)
+        return "a parameter is read outside of its lambda";
+    return NULL;
+}
+
+// A range's element binds the range variable first, to the number it writes
+// each value to (see ciLispRange.h).
+static bool checkRange(const IMAGE *image, const IMAGE_CALL *call)
+{
+    if (call->numOps < 3 || call->numOps > 4 || namedOper(image, call->ident) == CUSTOM_OPER ||
+        call->ops[call->numOps - 1] == IMAGE_NONE)
+        return false;
+
+    const IMAGE_LET *let = recordedLet(imageAt(image, call->ops[call->numOps - 1]));
+    if (let == NULL || let->numBindings == 0)
+        return false;
+    const IMAGE_BINDING *variable = imageAt(image, let->bindings);
+    return variable->val != IMAGE_NONE && !variable->function &&
+           ((const IMAGE_RECORD *) imageAt(image, variable->val))->type == NUM_NODE_TYPE;
+}
+
+static const char *checkCall(const IMAGE *image, const IMAGE_CALL *call)
+{
+    uint32_t numNames = image->header->numNames;
+
+    if (call->ident >= numNames)
+        return "a call is malformed";
+    if (call->oper == IMAGE_CUSTOM)
+        return namedOper(image, call->ident) == CUSTOM_OPER ? NULL : "a call is malformed";
+    if (call->oper >= numNames || namedOper(image, call->oper) == CUSTOM_OPER)
+        return "a call names no operator";
+    if (namedOper(image, call->oper) == RANGE_OPER)
+        return NULL;
+    return call->ident == call->oper ? NULL : "a call is malformed";
+}
+
+// Checks the node at offset, whose children are the last numChecked checked
+// nodes, and replaces them with it.
+static const char *checkNode(const IMAGE *image, uint32_t offset, size_t *numChecked)
+{
+    const IMAGE_RECORD *record = imageAt(image, offset);
+    uint32_t size = record->size;
+    uint64_t nodeSize = record->type <= ARG_NODE_TYPE ? recordedNodeSize(record) : 0;
+    uint32_t params = 0;
+
+    if (nodeSize == 0 || (record->flags & ~(IMAGE_INT_FLAG | IMAGE_LET_FLAG)) != 0 ||
+        ((record->flags & IMAGE_INT_FLAG) && record->type != NUM_NODE_TYPE))
+        return "a node is malformed";
+
+    const IMAGE_LET *let = NULL;
+    const IMAGE_BINDING *binding = NULL;
+    if (record->flags & IMAGE_LET_FLAG)
+    {
+        if (nodeSize + sizeof(IMAGE_LET) > size)
+            return "a let section is out of bounds";
+        let = recordedLet(record);
+        if (!inRecord(offset, size, let->bindings, let->numBindings, sizeof(IMAGE_BINDING)) ||
+            !inRecord(offset, size, let->visible, let->numVisible, sizeof(uint32_t)))
+            return "a let section is out of bounds";
+
+        const uint32_t *visible = imageAt(image, let->visible);
+        for (uint32_t i = 0; i < let->numVisible; i++)
+        {
+            if (visible[i] >= let->numBindings || (i > 0 && visible[i] <= visible[i - 1]))
+                return "a let section's index is malformed";
+        }
+        binding = imageAt(image, let->bindings);
+    }
+    uint32_t numBindings = let != NULL ? let->numBindings : 0;
+
+    const char *error = NULL;
+    const IMAGE_CALL *call = NULL;
+    switch (record->type)
+    {
+        case SYM_NODE_TYPE:
+            if (((const IMAGE_SYM *) record)->ident >= image->header->numNames)
+                error = "a symbol is malformed";
+            break;
+        case ARG_NODE_TYPE:
+        {
+            const IMAGE_ARG *arg = (const IMAGE_ARG *) record;
+            if (arg->ident >= image->header->numNames || arg->slot == UINT32_MAX)
+                error = "a parameter is malformed";
+            params = arg->slot + 1;
+            break;
+        }
+        case FUNC_NODE_TYPE:
+            call = (const IMAGE_CALL *) record;
+            error = checkCall(image, call);
+            break;
+    }
+    if (error != NULL)
+        return error;
+
+    // the children are binding values then operands, each as it was pushed
+    uint32_t numOps = call != NULL ? call->numOps : 0;
+    size_t numChildren = 0;
+    for (uint32_t i = 0; i < numBindings; i++)
+        numChildren += binding[i].val != IMAGE_NONE;
+    for (uint32_t i = 0; i < numOps; i++)
+        numChildren += call->ops[i] != IMAGE_NONE;
+    if (numChildren > *numChecked)
+        return "a node's children are missing";
+
+    CHECKED_NODE *child = &checkedNodes[*numChecked - numChildren];
+    for (uint32_t i = 0; i < numBindings; i++)
+    {
+        CHECKED_NODE *val = binding[i].val != IMAGE_NONE ? child++ : NULL;
+        if ((error = checkBinding(image, &binding[i], offset, size, val, &params)) != NULL)
+            return error;
+    }
+    for (uint32_t i = 0; i < numOps; i++)
+    {
+        if (call->ops[i] == IMAGE_NONE)
+            continue;
+        if (child->offset != call->ops[i])
+            return "an operand is out of place";
+        if (child->params > params)
+            params = child->params;
+        child++;
+    }
+
+    // once its element is known to be a node
+    if (call != NULL && call->oper != IMAGE_CUSTOM && namedOper(image, call->oper) == RANGE_OPER &&
+        !checkRange(image, call))
+        return "a range is malformed";
+
+    *numChecked -= numChildren;
+    checkedNodes[(*numChecked)++] = (CHECKED_NODE){offset, params};
+    return NULL;
+}
+
+static const char *checkRecords(const IMAGE *image)
+{
+    const IMAGE_HEADER *header = image->header;
+    size_t numChecked = 0;
+    uint32_t numForms = 0;
+    const char *error = NULL;
+    uint32_t offset = header->records;
+
+    while (error == NULL && offset < header->names)
+    {
+        const IMAGE_RECORD *record = imageAt(image, offset);
+        if ((uint64_t) offset + sizeof(IMAGE_RECORD) > header->names || record->size % IMAGE_ALIGN != 0 ||
+            record->size < sizeof(IMAGE_RECORD) || (uint64_t) offset + record->size > header->names)
+        {
+            error = "a record is out of bounds";
+            break;
+        }
+
+        switch (record->kind)
+        {
+            case IMAGE_NODE_RECORD:
+                checkedNodes = reserveItems(checkedNodes, &checkedCapacity, numChecked + 1, sizeof(CHECKED_NODE));
+                error = checkNode(image, offset, &numChecked);
+                break;
+            case IMAGE_EXPRESSION_RECORD:
+            {
+                const IMAGE_EXPRESSION *expression = (const IMAGE_EXPRESSION *) record;
+                if (record->size < sizeof(IMAGE_EXPRESSION) || numChecked != 1 ||
+                    checkedNodes[0].offset != expression->root || checkedNodes[0].params != 0)
+                    error = "an expression is malformed";
+                numChecked = 0;
+                numForms++;
+                break;
+            }
+            case IMAGE_DEFINITION_RECORD:
+            {
+                const IMAGE_DEFINITION *definition = (const IMAGE_DEFINITION *) record;
+                uint32_t params = 0;
+                if (record->size < sizeof(IMAGE_DEFINITION) || numChecked > 1)
+                    error = "a definition is malformed";
+                else
+                    error = checkBinding(image, &definition->binding, offset, record->size,
+                                         numChecked == 1 ? &checkedNodes[0] : NULL, &params);
+                if (error == NULL && params != 0)
+                    error = "a parameter is read outside of its lambda";
+                numChecked = 0;
+                numForms++;
+                break;
+            }
+            case IMAGE_SESSION_RECORD:
+            {
+                const IMAGE_SESSION *session = (const IMAGE_SESSION *) record;
+                uint32_t params = 0;
+                if (record->size < sizeof(IMAGE_SESSION) || numChecked > 1 || session->valueType > DOUBLE_TYPE ||
+                    session->valid > 1)
+                    error = "a session entry is malformed";
+                else
+                    error = checkBinding(image, &session->binding, offset, record->size,
+                                         numChecked == 1 ? &checkedNodes[0] : NULL, &params);
+                if (error == NULL && params != 0)
+                    error = "a parameter is read outside of its lambda";
+                if (error == NULL && !inRecord(offset, record->size, session->dependents, session->numDependents,
+                                               sizeof(uint32_t)))
+                    error = "a session entry's dependents are out of bounds";
+
+                const uint32_t *dependent = imageAt(image, session->dependents);
+                for (uint32_t i = 0; error == NULL && i < session->numDependents; i++)
+                {
+                    if (dependent[i] >= image->header->numNames)
+                        error = "a session entry's dependents are malformed";
+                }
+                numChecked = 0;
+                numForms++;
+                break;
+            }
+            default:
+                error = "a record is of no known kind";
+                break;
+        }
+        offset += record->size;
+    }
+
+    if (error == NULL && (offset != header->names || numChecked != 0 || numForms != header->numForms))
+        error = "its forms are incomplete";
+    return error;
+}
+
+// Why image is not a valid image, or NULL if it is.
+static const char *checkImage(const IMAGE *image)
+{
+    const IMAGE_HEADER *header = image->header;
+
+    if (image->size < sizeof(IMAGE_HEADER) || memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0)
+        return "it is not an image";
+    if (header->byteOrder != IMAGE_BYTE_ORDER)
+        return "it was written with another byte order";
+    if (header->version != IMAGE_VERSION)
+        return "it is of another version";
+    if (header->size != image->size)
+        return "it is truncated";
+    if (checksumBytes(FNV_OFFSET, image->base + sizeof(IMAGE_HEADER), image->size - sizeof(IMAGE_HEADER)) !=
+        header->checksum)
+        return "its checksum does not match";
+    if (header->records != sizeof(IMAGE_HEADER))
+        return "a record is out of bounds";
+
+    const char *error = checkNames(image);
+    return error != NULL ? error : checkRecords(image);
+}
+
+// A binding from its record, bound to val.
+static SYMBOL_TABLE_NODE *loadBinding(const IMAGE *image, const IMAGE_BINDING *binding, AST_NODE *val)
+{
+    SYMBOL_ID ident = image->symbols[binding->ident];
+    if (!binding->function)
+        return createSymbolTableNode(ident, val, binding->type);
+
+    const IMAGE_PARAM *param = imageAt(image, binding->params);
+    SYMBOL_TABLE_NODE *params = NULL;
+    for (uint32_t slot = binding->numParams; slot-- > 0;)
+    {
+        SYMBOL_TABLE_NODE *next = createSymbolTableNode(image->symbols[param[slot].ident], NULL, param[slot].type);
+        next->next = params;
+        params = next;
+    }
+    return createResolvedFunctionBinding(ident, params, val, binding->type);
+}
+
+// Builds the node at offset from the last numBuilt built nodes, its children,
+// and replaces them with it.
+static void loadNode(const IMAGE *image, uint32_t offset, size_t *numBuilt)
+{
+    const IMAGE_RECORD *record = imageAt(image, offset);
+    const IMAGE_LET *let = recordedLet(record);
+    const IMAGE_BINDING *binding = let != NULL ? imageAt(image, let->bindings) : NULL;
+    uint32_t numBindings = let != NULL ? let->numBindings : 0;
+    const IMAGE_CALL *call = NULL;
+    size_t numChildren = 0;
+
+    AST_NODE *node = memAlloc(NODE_MEM_KIND(record->type), sizeof(AST_NODE));
+    chargeAllocation(sizeof(AST_NODE));
+    node->type = record->type;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            node->data.number.type = record->flags & IMAGE_INT_FLAG ? INT_TYPE : DOUBLE_TYPE;
+            memcpy(&node->data.number.value, ((const IMAGE_NUM *) record)->value, sizeof(double));
+            break;
+        case SYM_NODE_TYPE:
+            node->data.symbol.ident = image->symbols[((const IMAGE_SYM *) record)->ident];
+            break;
+        case ARG_NODE_TYPE:
+            node->data.arg.ident = image->symbols[((const IMAGE_ARG *) record)->ident];
+            node->data.arg.slot = ((const IMAGE_ARG *) record)->slot;
+            break;
+        case FUNC_NODE_TYPE:
+            call = (const IMAGE_CALL *) record;
+            node->data.function.oper = call->oper == IMAGE_CUSTOM ? CUSTOM_OPER : resolveFunc(image->symbols[call->oper]);
+            node->data.function.ident = image->symbols[call->ident];
+            node->data.function.numOps = call->numOps;
+            if (call->numOps > 0)
+            {
+                node->data.function.ops = memAlloc(MEM_OPERANDS, call->numOps * sizeof(AST_NODE *));
+                chargeAllocation(call->numOps * sizeof(AST_NODE *));
+            }
+            for (uint32_t i = 0; i < call->numOps; i++)
+                numChildren += call->ops[i] != IMAGE_NONE;
+            break;
+    }
+    for (uint32_t i = 0; i < numBindings; i++)
+        numChildren += binding[i].val != IMAGE_NONE;
+
+    AST_NODE **child = &builtNodes[*numBuilt - numChildren];
+    builtBindings = reserveItems(builtBindings, &bindingsCapacity, numBindings, sizeof(SYMBOL_TABLE_NODE *));
+    SYMBOL_TABLE_NODE **tail = &node->symbolTable;
+    for (uint32_t i = 0; i < numBindings; i++)
+    {
+        AST_NODE *val = binding[i].val != IMAGE_NONE ? *child++ : NULL;
+        if (val != NULL)
+            val->parent = node;
+        *tail = builtBindings[i] = loadBinding(image, &binding[i], val);
+        tail = &(*tail)->next;
+    }
+    for (uint32_t i = 0; call != NULL && i < call->numOps; i++)
+    {
+        AST_NODE *op = call->ops[i] != IMAGE_NONE ? *child++ : NULL;
+        if (op != NULL)
+            op->parent = node;
+        node->data.function.ops[i] = op;
+    }
+
+    // visible is ascending, so the bindings it picks can be moved down in place
+    if (let != NULL)
+    {
+        const uint32_t *visible = imageAt(image, let->visible);
+        for (uint32_t i = 0; i < let->numVisible; i++)
+            builtBindings[i] = builtBindings[visible[i]];
+        node->scope = indexBindings(builtBindings, let->numVisible);
+    }
+
+    *numBuilt -= numChildren;
+    builtNodes[(*numBuilt)++] = node;
+}
+
+static void restoreSession(const IMAGE *image, const IMAGE_SESSION *session, AST_NODE *val)
+{
+    const uint32_t *dependent = imageAt(image, session->dependents);
+    SYMBOL_ID *dependents = memAlloc(MEM_IMAGE, session->numDependents * sizeof(SYMBOL_ID));
+    for (uint32_t i = 0; i < session->numDependents; i++)
+        dependents[i] = image->symbols[dependent[i]];
+
+    RET_VAL value = {session->valueType, 0};
+    memcpy(&value.value, session->value, sizeof(double));
+    restoreSessionDef(image->symbols[session->binding.ident],
+                      val != NULL ? loadBinding(image, &session->binding, val) : NULL,
+                      value, session->valid, dependents, session->numDependents);
+    memFree(MEM_IMAGE, dependents, session->numDependents * sizeof(SYMBOL_ID));
+}
+
+// Evaluates the forms of a checked image, each as if it had been typed on a
+// line of its own, and restores its session definitions. Returns how many it
+// restored.
+static size_t runImage(const IMAGE *image)
+{
+    size_t numBuilt = 0;
+    size_t numRestored = 0;
+    uint32_t offset = image->header->records;
+
+    while (offset < image->header->names)
+    {
+        const IMAGE_RECORD *record = imageAt(image, offset);
+        if (numBuilt == 0)
+            beginBudget();
+
+        switch (record->kind)
+        {
+            case IMAGE_NODE_RECORD:
+                builtNodes = reserveItems(builtNodes, &builtCapacity, numBuilt + 1, sizeof(AST_NODE *));
+                loadNode(image, offset, &numBuilt);
+                break;
+            case IMAGE_EXPRESSION_RECORD:
+                startBudgetClock();
+                numBuilt = 0;
+                runExpression(builtNodes[0]);
+                break;
+            case IMAGE_DEFINITION_RECORD:
+            {
+                const IMAGE_DEFINITION *definition = (const IMAGE_DEFINITION *) record;
+                startBudgetClock();
+                SYMBOL_TABLE_NODE *binding = loadBinding(image, &definition->binding,
+                                                         numBuilt == 1 ? builtNodes[0] : NULL);
+                numBuilt = 0;
+                runDefinition(binding);
+                break;
+            }
+            case IMAGE_SESSION_RECORD:
+                restoreSession(image, (const IMAGE_SESSION *) record, numBuilt == 1 ? builtNodes[0] : NULL);
+                numRestored += numBuilt == 1;
+                numBuilt = 0;
+                endFormMemory(true);
+                break;
+        }
+
+        // restored entries print nothing
+        if (record->kind == IMAGE_EXPRESSION_RECORD || record->kind == IMAGE_DEFINITION_RECORD)
+        {
+            serviceProfileDump();
+            serviceMemoryStatsDump();
+            outPuts("\n> ");
+        }
+        offset += record->size;
+    }
+    return numRestored;
+}
+
+bool loadImage(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        outPrintf("ERROR: cannot read the image <%s>\n", path);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        outPrintf("ERROR: cannot read the image <%s>\n", path);
+        return false;
+    }
+
+    IMAGE image = {base, info.st_size, base, NULL};
+    const char *error = checkImage(&image);
+    memFree(MEM_IMAGE, checkedNodes, checkedCapacity * sizeof(CHECKED_NODE));
+    checkedNodes = NULL;
+    checkedCapacity = 0;
+    if (error != NULL)
+    {
+        outPrintf("ERROR: <%s> is not a valid image: %s\n", path, error);
+        munmap(base, info.st_size);
+        return false;
+    }
+
+    size_t numNames = image.header->numNames;
+    const IMAGE_NAME *name = imageAt(&image, image.header->names);
+    image.symbols = memAlloc(MEM_IMAGE, numNames * sizeof(SYMBOL_ID));
+    for (size_t i = 0; i < numNames; i++)
+        image.symbols[i] = internString((const char *) image.base + name[i].offset, name[i].length);
+
+    size_t numRestored = runImage(&image);
+    if (numRestored > 0)
+    {
+        outPrintf("INFO: restored %zu definitions from <%s>", numRestored, path);
+        outPuts("\n> ");
+    }
+
+    // an image is loaded once, so its stacks are not kept for another
+    memFree(MEM_IMAGE, builtNodes, builtCapacity * sizeof(AST_NODE *));
+    memFree(MEM_IMAGE, builtBindings, bindingsCapacity * sizeof(SYMBOL_TABLE_NODE *));
+    builtNodes = NULL;
+    builtBindings = NULL;
+    builtCapacity = bindingsCapacity = 0;
+    memFree(MEM_IMAGE, image.symbols, numNames * sizeof(SYMBOL_ID));
+    munmap(base, info.st_size);
+    return true;
+}
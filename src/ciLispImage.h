@@ -0,0 +1,184 @@
+#ifndef __cilisp_image_h_
+#define __cilisp_image_h_
+
+#include "ciLisp.h"
+
+// Images: parsed top-level forms saved in binary, so a large program is
+// read back without scanning or parsing it again.
+//
+//   cilisp --compile-to=rules.img < rules.txt
+//   cilisp --load=rules.img
+//
+// --compile-to writes every form it reads to the image instead of evaluating
+// it. --load maps an image with mmap, checks all of it, then evaluates its
+// forms in order as if they had been typed one per line, before reading input.
+//
+// An image holds the trees the parser hands to eval: lambda parameters
+// already resolved to slots, small calls already inlined and ranges already
+// bound. Every reference in it is an offset from the start of the image, so
+// it is read in place wherever it is mapped. Nodes are rebuilt straight from
+// their records; only the names, kept once each in a table at the end, are
+// interned, and only once per image.
+//
+// A snapshot is an image of the session rather than of a program:
+//
+//   cilisp --snapshot=warm.img         ... then, once warmed up: snapshot
+//   cilisp --load=warm.img
+//
+// The snapshot command writes every session definition with the value it has
+// cached and the definitions that read it, and every interned name in the
+// order of its id, so loading it into a fresh process brings back the same
+// ids and the same session without evaluating any of it.
+//
+// Layout, all of it in the writer's byte order and 4 byte aligned:
+//
+//   IMAGE_HEADER
+//   records         one form after another, each its nodes in postorder and
+//                   then an IMAGE_EXPRESSION, IMAGE_DEFINITION or IMAGE_SESSION
+//                   record
+//   IMAGE_NAME[]    and the NUL terminated names they point to
+//
+// A node's record is its IMAGE_NUM, IMAGE_SYM, IMAGE_ARG or IMAGE_CALL, with
+// the operands of a call inline, then if it has a let section an IMAGE_LET
+// and the arrays that points to. The children of a node are the records
+// right before it, binding values in order and then operands in order, so
+// reading the records in order with a stack rebuilds each tree from the
+// bottom up. --load checks every record against that before evaluating
+// anything, so a damaged or hand made image is rejected instead of crashing.
+
+#define IMAGE_MAGIC "CILISPIM"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+// offset of no record: a NULL operand, a binding without a value
+#define IMAGE_NONE 0u
+
+// oper of a call to a lambda
+#define IMAGE_CUSTOM UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t size;              // of the whole image
+    uint64_t checksum;          // FNV-1a of everything after the header
+    uint32_t numForms;
+    uint32_t records;           // first record; they run up to names
+    uint32_t numNames;
+    uint32_t names;             // IMAGE_NAME[numNames]
+} IMAGE_HEADER;
+
+typedef enum {
+    IMAGE_NODE_RECORD = 1,
+    IMAGE_EXPRESSION_RECORD,
+    IMAGE_DEFINITION_RECORD,
+    IMAGE_SESSION_RECORD
+} IMAGE_RECORD_KIND;
+
+// flags of a node
+#define IMAGE_INT_FLAG 1u       // a number that is an INT
+#define IMAGE_LET_FLAG 2u       // an IMAGE_LET follows the node
+
+typedef struct {
+    uint8_t kind;
+    uint8_t type;               // AST_NODE_TYPE of a node
+    uint16_t flags;
+    uint32_t size;              // including whatever follows
+} IMAGE_RECORD;
+
+// Identifiers are indexes into the names, types NUM_TYPEs.
+typedef struct {
+    uint32_t offset;            // of the NUL terminated name
+    uint32_t length;
+} IMAGE_NAME;
+
+typedef struct {
+    IMAGE_RECORD record;
+    uint32_t value[2];          // the double, copied in and out as it is only 4 byte aligned
+} IMAGE_NUM;
+
+typedef struct {
+    IMAGE_RECORD record;
+    uint32_t ident;
+} IMAGE_SYM;
+
+typedef struct {
+    IMAGE_RECORD record;
+    uint32_t ident;
+    uint32_t slot;
+} IMAGE_ARG;
+
+typedef struct {
+    IMAGE_RECORD record;
+    uint32_t oper;              // name of the operator, or IMAGE_CUSTOM
+    uint32_t ident;
+    uint32_t numOps;
+    uint32_t ops[];             // nodes, or IMAGE_NONE
+} IMAGE_CALL;
+
+typedef struct {
+    uint32_t ident;
+    uint32_t type;
+} IMAGE_PARAM;
+
+typedef struct {
+    uint32_t ident;
+    uint32_t type;
+    uint32_t val;               // node, or IMAGE_NONE
+    uint32_t function;          // whether val is a lambda body
+    uint32_t numParams;
+    uint32_t params;            // IMAGE_PARAM[numParams]
+} IMAGE_BINDING;
+
+typedef struct {
+    uint32_t numBindings;
+    uint32_t bindings;          // IMAGE_BINDING[numBindings], the let section in order
+    uint32_t numVisible;
+    uint32_t visible;           // uint32_t[numVisible], ascending: the bindings the index finds
+} IMAGE_LET;
+
+typedef struct {
+    IMAGE_RECORD record;
+    uint32_t root;
+} IMAGE_EXPRESSION;
+
+typedef struct {
+    IMAGE_RECORD record;
+    IMAGE_BINDING binding;      // its params follow the record
+} IMAGE_DEFINITION;
+
+// An entry of the session: a definition and its cached value, or a name that
+// is read but not defined (binding.val IMAGE_NONE), and the definitions that
+// read it.
+typedef struct {
+    IMAGE_RECORD record;
+    uint32_t valueType;
+    uint32_t valid;             // whether value is current
+    uint32_t value[2];
+    uint32_t numDependents;
+    uint32_t dependents;        // uint32_t[numDependents], names
+    IMAGE_BINDING binding;      // its params, then dependents, follow the record
+} IMAGE_SESSION;
+
+// Set by --compile-to: runExpression and runDefinition write forms to the
+// image instead of evaluating them.
+extern bool imageCompiling;
+
+// Creates the image at path, written out at exit. Exits if it can't be created.
+void beginImage(const char *path);
+
+void writeImageExpression(AST_NODE *node);
+void writeImageDefinition(SYMBOL_TABLE_NODE *binding);
+
+// Makes the snapshot command write to path.
+void enableSnapshots(const char *path);
+
+// Writes the session to the snapshot path, reporting how much it wrote.
+void writeSnapshot(void);
+
+// Evaluates the forms of the image at path, or restores those of a snapshot.
+// Reports and returns false, having evaluated nothing, if it can't be read or
+// is not a valid image.
+bool loadImage(const char *path);
+
+#endif
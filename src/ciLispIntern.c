@@ -0,0 +1,148 @@
+//CiLisp identifier interning
+//Open addressing hash table over a growable array of entries.
+//The strings themselves are packed into large arena blocks.
+
+#include "ciLispIntern.h"
+#include "ciLispMemory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_ARENA_BLOCK_SIZE (64 * 1024)
+#define INTERN_MIN_SLOTS 256
+
+typedef struct {
+    const char *name;
+    uint32_t len;
+    uint32_t hash;
+} INTERN_ENTRY;
+
+// entries[id] describes interned id
+static INTERN_ENTRY *entries = NULL;
+static size_t entryCount = 0;
+static size_t entryCapacity = 0;
+
+// slots hold id + 1, 0 marks an empty slot; kept at most half full
+static uint32_t *slots = NULL;
+static size_t slotMask = 0;
+
+static char *arena = NULL;
+static size_t arenaUsed = 0;
+static size_t arenaSize = 0;
+
+// FNV-1a
+static uint32_t hashString(const char *text, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char) text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char *arenaCopy(const char *text, size_t len)
+{
+    if (arenaUsed + len + 1 > arenaSize)
+    {
+        arenaSize = len + 1 > INTERN_ARENA_BLOCK_SIZE ? len + 1 : INTERN_ARENA_BLOCK_SIZE;
+        arena = memAlloc(MEM_STRING, arenaSize);
+        arenaUsed = 0;
+    }
+
+    char *copy = arena + arenaUsed;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    arenaUsed += len + 1;
+    return copy;
+}
+
+static void growSlots(void)
+{
+    size_t newSize = slots == NULL ? INTERN_MIN_SLOTS : (slotMask + 1) * 2;
+    uint32_t *newSlots = memAlloc(MEM_STRING, newSize * sizeof(uint32_t));
+
+    for (size_t id = 0; id < entryCount; id++)
+    {
+        size_t i = entries[id].hash & (newSize - 1);
+        while (newSlots[i] != 0)
+            i = (i + 1) & (newSize - 1);
+        newSlots[i] = (uint32_t) id + 1;
+    }
+
+    if (slots != NULL)
+        memFree(MEM_STRING, slots, (slotMask + 1) * sizeof(uint32_t));
+    slots = newSlots;
+    slotMask = newSize - 1;
+}
+
+// Slot holding text, or the empty slot where it belongs.
+static size_t findSlot(const char *text, size_t len, uint32_t hash)
+{
+    size_t i = hash & slotMask;
+    while (slots[i] != 0)
+    {
+        INTERN_ENTRY *entry = &entries[slots[i] - 1];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->name, text, len) == 0)
+            break;
+        i = (i + 1) & slotMask;
+    }
+    return i;
+}
+
+SYMBOL_ID findInterned(const char *text, size_t len)
+{
+    if (slots == NULL)
+        return NO_SYMBOL;
+
+    size_t slot = findSlot(text, len, hashString(text, len));
+    return slots[slot] == 0 ? NO_SYMBOL : slots[slot] - 1;
+}
+
+SYMBOL_ID internString(const char *text, size_t len)
+{
+    if (slots == NULL || (entryCount + 1) * 2 > slotMask + 1)
+        growSlots();
+
+    uint32_t hash = hashString(text, len);
+    size_t slot = findSlot(text, len, hash);
+    if (slots[slot] != 0)
+        return slots[slot] - 1;
+
+    if (entryCount == entryCapacity)
+    {
+        size_t capacity = entryCapacity == 0 ? INTERN_MIN_SLOTS : entryCapacity * 2;
+        entries = memRealloc(MEM_STRING, entries, entryCapacity * sizeof(INTERN_ENTRY),
+                             capacity * sizeof(INTERN_ENTRY));
+        entryCapacity = capacity;
+    }
+
+    SYMBOL_ID id = (SYMBOL_ID) entryCount++;
+    entries[id].name = arenaCopy(text, len);
+    entries[id].len = (uint32_t) len;
+    entries[id].hash = hash;
+    slots[slot] = id + 1;
+
+    return id;
+}
+
+const char *symbolName(SYMBOL_ID id)
+{
+    if (id >= entryCount)
+        return "";
+    return entries[id].name;
+}
+
+size_t symbolLength(SYMBOL_ID id)
+{
+    if (id >= entryCount)
+        return 0;
+    return entries[id].len;
+}
+
+size_t internedCount(void)
+{
+    return entryCount;
+}
@@ -0,0 +1,30 @@
+#ifndef __cilisp_intern_h_
+#define __cilisp_intern_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Global table of identifier strings.
+// Every distinct identifier is stored once and named by a small dense id, so
+// symbols compare by id instead of strcmp and repeated names share one copy.
+// Interned strings live until the process exits.
+
+typedef uint32_t SYMBOL_ID;
+
+#define NO_SYMBOL ((SYMBOL_ID) UINT32_MAX)
+
+// Returns the id of text[0..len), adding it to the table on first sight.
+SYMBOL_ID internString(const char *text, size_t len);
+
+// Returns the id of text[0..len) or NO_SYMBOL without adding it.
+SYMBOL_ID findInterned(const char *text, size_t len);
+
+// NUL terminated name of an interned id.
+const char *symbolName(SYMBOL_ID id);
+
+size_t symbolLength(SYMBOL_ID id);
+
+// Number of ids handed out so far; ids are 0 .. internedCount() - 1.
+size_t internedCount(void);
+
+#endif
@@ -0,0 +1,209 @@
+//CiLisp allocation accounting
+//Per-kind counters updated on every allocation, plus the expression baseline
+//the leak check compares against.
+
+#include "ciLispMemory.h"
+#include "ciLispOutput.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+bool memoryStatsEnabled = false;
+
+static MEM_COUNTER counters[MEM_KINDS];
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+// expression memory live now, when the last form ended, and the most any form used
+static size_t expressionBytes = 0;
+static uint64_t expressionBlocks = 0;
+static size_t baselineBytes = 0;
+static uint64_t baselineBlocks = 0;
+static size_t formPeakBytes = 0;
+static size_t largestFormBytes = 0;
+static uint64_t leakedForms = 0;
+
+static const char *memoryStatsPath = NULL;
+static volatile sig_atomic_t memoryStatsRequested = 0;
+
+static const char *kindNames[MEM_KINDS] = {
+        [MEM_NUM_NODE] = "num node",
+        [MEM_FUNC_NODE] = "func node",
+        [MEM_SYM_NODE] = "sym node",
+        [MEM_ARG_NODE] = "arg node",
+        [MEM_OPERANDS] = "operands",
+        [MEM_SYMBOL_TABLE] = "symbol table",
+        [MEM_SCOPE] = "scope",
+        [MEM_FUNCTION] = "function",
+        [MEM_STRING] = "string",
+        [MEM_SESSION] = "session",
+        [MEM_FRAMES] = "frames",
+        [MEM_STACKS] = "stacks",
+        [MEM_IMAGE] = "image",
+        [MEM_SAMPLES] = "samples",
+        [MEM_SCANNER] = "scanner",
+        [MEM_DATA] = "data",
+};
+
+static void memoryOutOfMemory(void)
+{
+    fprintf(stderr, "\nERROR: Memory allocation failed!\n");
+    exit(EXIT_FAILURE);
+}
+
+static void countBytes(MEM_KIND kind, size_t added, size_t removed)
+{
+    MEM_COUNTER *counter = &counters[kind];
+
+    counter->liveBytes += added - removed;
+    if (counter->liveBytes > counter->peakBytes)
+        counter->peakBytes = counter->liveBytes;
+
+    liveBytes += added - removed;
+    if (liveBytes > peakBytes)
+        peakBytes = liveBytes;
+
+    if (kind < MEM_EXPRESSION_KINDS)
+    {
+        expressionBytes += added - removed;
+        if (expressionBytes > formPeakBytes)
+            formPeakBytes = expressionBytes;
+    }
+}
+
+static void countBlocks(MEM_KIND kind, uint64_t allocs, uint64_t frees)
+{
+    counters[kind].allocs += allocs;
+    counters[kind].frees += frees;
+    if (kind < MEM_EXPRESSION_KINDS)
+        expressionBlocks += allocs - frees;
+}
+
+void *memAlloc(MEM_KIND kind, size_t size)
+{
+    void *ptr = calloc(1, size == 0 ? 1 : size);
+    if (ptr == NULL)
+        memoryOutOfMemory();
+
+    countBlocks(kind, 1, 0);
+    countBytes(kind, size, 0);
+    return ptr;
+}
+
+void *memRealloc(MEM_KIND kind, void *ptr, size_t oldSize, size_t newSize)
+{
+    void *grown = realloc(ptr, newSize == 0 ? 1 : newSize);
+    if (grown == NULL)
+        memoryOutOfMemory();
+
+    if (ptr == NULL)
+        countBlocks(kind, 1, 0);
+    countBytes(kind, newSize, oldSize);
+    return grown;
+}
+
+void memFree(MEM_KIND kind, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+
+    free(ptr);
+    countBlocks(kind, 0, 1);
+    countBytes(kind, 0, size);
+}
+
+void memRetag(MEM_KIND from, MEM_KIND to, size_t size)
+{
+    if (from == to)
+        return;
+
+    countBlocks(from, 0, 1);
+    countBytes(from, 0, size);
+    countBlocks(to, 1, 0);
+    countBytes(to, size, 0);
+}
+
+const MEM_COUNTER *memCounter(MEM_KIND kind)
+{
+    return &counters[kind];
+}
+
+size_t memLiveBytes(void)
+{
+    return liveBytes;
+}
+
+size_t memPeakBytes(void)
+{
+    return peakBytes;
+}
+
+void endFormMemory(bool keeps)
+{
+    if (formPeakBytes - baselineBytes > largestFormBytes)
+        largestFormBytes = formPeakBytes - baselineBytes;
+
+    if (memoryStatsEnabled && !keeps && expressionBytes > baselineBytes)
+    {
+        // the result is already printed, the prompt ends the line
+        outPrintf("\nWARNING: %zu bytes in %llu blocks were not freed after this expression",
+                  expressionBytes - baselineBytes, (unsigned long long) (expressionBlocks - baselineBlocks));
+        leakedForms++;
+    }
+
+    baselineBytes = expressionBytes;
+    baselineBlocks = expressionBlocks;
+    formPeakBytes = expressionBytes;
+}
+
+void enableMemoryStats(const char *path)
+{
+    if (!memoryStatsEnabled)
+        atexit(writeMemoryStats);
+
+    memoryStatsEnabled = true;
+    memoryStatsPath = path;
+}
+
+void dumpMemoryStats(FILE *out)
+{
+    fprintf(out, "%-14s %12s %12s %12s %14s %14s\n", "kind", "allocs", "frees", "live", "live bytes", "peak bytes");
+    for (int kind = 0; kind < MEM_KINDS; kind++)
+    {
+        MEM_COUNTER *counter = &counters[kind];
+        fprintf(out, "%-14s %12llu %12llu %12llu %14zu %14zu\n", kindNames[kind],
+                (unsigned long long) counter->allocs, (unsigned long long) counter->frees,
+                (unsigned long long) (counter->allocs - counter->frees), counter->liveBytes, counter->peakBytes);
+    }
+    fprintf(out, "%-14s %12s %12s %12s %14zu %14zu\n", "total", "", "", "", liveBytes, peakBytes);
+    fprintf(out, "largest expression: %zu bytes\n", largestFormBytes);
+    fprintf(out, "expressions that leaked: %llu\n", (unsigned long long) leakedForms);
+}
+
+void writeMemoryStats(void)
+{
+    if (!memoryStatsEnabled || memoryStatsPath == NULL)
+        return;
+
+    FILE *out = fopen(memoryStatsPath, "w");
+    if (out == NULL)
+        return;
+    dumpMemoryStats(out);
+    fclose(out);
+}
+
+// Safe to call from a signal handler; the dump itself happens in serviceMemoryStatsDump.
+void requestMemoryStatsDump(void)
+{
+    memoryStatsRequested = 1;
+}
+
+// Called by the driver between top-level expressions.
+void serviceMemoryStatsDump(void)
+{
+    if (memoryStatsRequested)
+    {
+        memoryStatsRequested = 0;
+        writeMemoryStats();
+    }
+}
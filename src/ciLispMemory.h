@@ -0,0 +1,81 @@
+#ifndef __cilisp_memory_h_
+#define __cilisp_memory_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Allocation accounting.
+// The interpreter's own data structures are allocated through memAlloc,
+// memRealloc and memFree, tagged with what they hold. That keeps live and
+// peak bytes per kind up to date at all times. Frees are sized (every caller
+// knows what it allocated), so there is no header in front of each block.
+//
+// Nodes, operand arrays, symbol tables, scopes and functions make up the
+// memory of an expression. Once an expression that keeps nothing has been
+// evaluated and freed they must be back where they were before it; with
+// --memory-stats anything left over is reported as a leak.
+
+typedef enum {
+    MEM_NUM_NODE,       // AST_NODEs, in AST_NODE_TYPE order (see NODE_MEM_KIND)
+    MEM_FUNC_NODE,
+    MEM_SYM_NODE,
+    MEM_ARG_NODE,
+    MEM_OPERANDS,       // operand arrays and OP_VECTORs
+    MEM_SYMBOL_TABLE,   // SYMBOL_TABLE_NODEs
+    MEM_SCOPE,          // let section indexes
+    MEM_FUNCTION,       // FUNC_DEFs and their parameters
+    MEM_STRING,         // interned identifiers and the intern table
+    MEM_SESSION,        // session definitions
+    MEM_FRAMES,         // the call frame stack
+    MEM_STACKS,         // work stacks of the evaluator, the profiler and tree walks
+    MEM_IMAGE,          // buffers of the image writer and loader
+    MEM_SAMPLES,        // the input kept for the sampling profiler, and its stacks
+    MEM_SCANNER,        // input and tokens of the bulk scanner
+    MEM_DATA,           // the buffer of data read from a pipe
+    MEM_KINDS
+} MEM_KIND;
+
+// Kinds below this one belong to expressions.
+#define MEM_EXPRESSION_KINDS MEM_STRING
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    size_t liveBytes;
+    size_t peakBytes;
+} MEM_COUNTER;
+
+extern bool memoryStatsEnabled;
+
+// Zeroed block of size bytes; exits if memory runs out.
+void *memAlloc(MEM_KIND kind, size_t size);
+
+// Resizes a block from memAlloc or memRealloc (ptr may be NULL).
+void *memRealloc(MEM_KIND kind, void *ptr, size_t oldSize, size_t newSize);
+
+void memFree(MEM_KIND kind, void *ptr, size_t size);
+
+// Moves a live block to another kind, e.g. a symbol node that became an argument.
+void memRetag(MEM_KIND from, MEM_KIND to, size_t size);
+
+const MEM_COUNTER *memCounter(MEM_KIND kind);
+size_t memLiveBytes(void);
+size_t memPeakBytes(void);
+
+// Called after each top-level form. keeps says whether the form was a
+// definition, which holds on to its expression. Otherwise, with memory
+// stats on, reports any expression memory the form did not give back.
+void endFormMemory(bool keeps);
+
+// Turns the stats on; they are written to path at exit and on SIGUSR2.
+void enableMemoryStats(const char *path);
+
+void dumpMemoryStats(FILE *out);
+void writeMemoryStats(void);
+
+void requestMemoryStatsDump(void);
+void serviceMemoryStatsDump(void);
+
+#endif
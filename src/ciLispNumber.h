@@ -0,0 +1,16 @@
+#ifndef __cilisp_number_h_
+#define __cilisp_number_h_
+
+#include <stddef.h>
+
+// Literal parsing for the lexer's {int_literal} and {double_literal} rules.
+// Both work straight on the token text and give exactly what strtod would,
+// without strtod's locale handling on the common paths.
+
+// text matches [+-]?[0-9]+
+double parseIntLiteral(const char *text, size_t len);
+
+// text matches [+-]?[0-9]+\.[0-9]*
+double parseDoubleLiteral(const char *text, size_t len);
+
+#endif
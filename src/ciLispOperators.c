@@ -0,0 +1,135 @@
+//CiLisp operator table
+//Kernels and descriptors; eval (see ciLispEval.c) dispatches through them.
+
+#include "ciLispOperators.h"
+#include "ciLispData.h"
+#include "ciLispRandom.h"
+
+// Truncates like a cast to long, but leaves nan, infinities and anything out
+// of long's range, which are already whole, to pass through uncast.
+#define AS_LONG(x) (fabs(x) < 9223372036854775808.0 ? (double) (long) (x) : (x))
+#define AS_IS(x) (x)
+
+// Generates the int x int, int x double and double x double kernels of an
+// operator from one combine expression. IntOperand is applied to both sides
+// of int x int: AS_LONG for the folds, which have always truncated INT
+// operands, AS_IS for everything that only retags its result.
+// Each kernel also gets a block version, a plain loop over it that the
+// compiler can inline and vectorize.
+#define DEFINE_KERNELS(name, combine, IntOperand)                                               \
+static double name##IntInt(double a, double b) { return combine(IntOperand(a), IntOperand(b)); } \
+static double name##IntDouble(double a, double b) { return combine(a, b); }                      \
+static double name##DoubleDouble(double a, double b) { return combine(a, b); }                   \
+DEFINE_BLOCK(name##IntInt)                                                                       \
+DEFINE_BLOCK(name##IntDouble)                                                                    \
+DEFINE_BLOCK(name##DoubleDouble)
+
+#define DEFINE_BLOCK(kernel)                                                    \
+static void kernel##Block(double *restrict acc, const double *restrict x)       \
+{                                                                               \
+    for (size_t i = 0; i < KERNEL_BLOCK; i++)                                   \
+        acc[i] = kernel(acc[i], x[i]);                                          \
+}
+
+#define DEFINE_UNARY_BLOCK(fn)                                                  \
+static void fn##Block(double *x)                                                \
+{                                                                               \
+    for (size_t i = 0; i < KERNEL_BLOCK; i++)                                   \
+        x[i] = fn(x[i]);                                                        \
+}
+
+// double x int uses the int x double kernel, which does not truncate either side.
+#define KERNELS(name)                                                                           \
+    .kernels = {{name##IntInt, name##IntDouble}, {name##IntDouble, name##DoubleDouble}},        \
+    .blockKernels = {{name##IntIntBlock, name##IntDoubleBlock}, {name##IntDoubleBlock, name##DoubleDoubleBlock}}
+
+#define UNARY(fn) .unary = fn, .unaryBlock = fn##Block
+
+#define ADD(a, b) ((a) + (b))
+#define SUB(a, b) ((a) - (b))
+#define MULT(a, b) ((a) * (b))
+#define DIV(a, b) ((a) / (b))
+#define EQUAL(a, b) ((a) == (b))
+#define LESS(a, b) ((a) < (b))
+#define GREATER(a, b) ((a) > (b))
+
+DEFINE_KERNELS(add, ADD, AS_LONG)
+DEFINE_KERNELS(mult, MULT, AS_LONG)
+DEFINE_KERNELS(max, fmax, AS_LONG)
+DEFINE_KERNELS(min, fmin, AS_LONG)
+DEFINE_KERNELS(hypot, hypot, AS_LONG)
+DEFINE_KERNELS(sub, SUB, AS_IS)
+DEFINE_KERNELS(div, DIV, AS_IS)
+DEFINE_KERNELS(remainder, fmod, AS_IS)
+DEFINE_KERNELS(pow, pow, AS_IS)
+DEFINE_KERNELS(equal, EQUAL, AS_IS)
+DEFINE_KERNELS(less, LESS, AS_IS)
+DEFINE_KERNELS(greater, GREATER, AS_IS)
+
+static double negKernel(double a)
+{
+    return -a;
+}
+
+DEFINE_UNARY_BLOCK(negKernel)
+DEFINE_UNARY_BLOCK(fabs)
+DEFINE_UNARY_BLOCK(exp)
+DEFINE_UNARY_BLOCK(sqrt)
+DEFINE_UNARY_BLOCK(log)
+DEFINE_UNARY_BLOCK(exp2)
+DEFINE_UNARY_BLOCK(cbrt)
+
+static RET_VAL randValue(void)
+{
+    return (RET_VAL){DOUBLE_TYPE, randDouble()};
+}
+
+const OPER_DESC operTable[] = {
+        [NEG_OPER] = {"neg", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(negKernel)},
+        [ABS_OPER] = {"abs", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(fabs)},
+        [EXP_OPER] = {"exp", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(exp)},
+        [SQRT_OPER] = {"sqrt", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(sqrt)},
+        [ADD_OPER] = {"add", 2, ANY_OPS, FOLD_SHAPE, INT_IF_ALL_INT, 0, KERNELS(add)},
+        [SUB_OPER] = {"sub", 2, 2, BINARY_SHAPE, INT_IF_ALL_INT, KERNELS(sub)},
+        [MULT_OPER] = {"mult", 2, ANY_OPS, FOLD_SHAPE, INT_IF_ALL_INT, 1, KERNELS(mult)},
+        [DIV_OPER] = {"div", 2, 2, BINARY_SHAPE, INT_IF_ALL_INT, KERNELS(div)},
+        [REMAINDER_OPER] = {"remainder", 2, 2, BINARY_SHAPE, INT_IF_ALL_INT, KERNELS(remainder)},
+        [LOG_OPER] = {"log", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(log)},
+        [POW_OPER] = {"pow", 2, 2, BINARY_SHAPE, INT_IF_ALL_INT, KERNELS(pow)},
+        [MAX_OPER] = {"max", 2, ANY_OPS, REDUCE_SHAPE, INT_IF_ALL_INT, KERNELS(max)},
+        [MIN_OPER] = {"min", 2, ANY_OPS, REDUCE_SHAPE, INT_IF_ALL_INT, KERNELS(min)},
+        [EXP2_OPER] = {"exp2", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(exp2)},
+        [CBRT_OPER] = {"cbrt", 1, 1, UNARY_SHAPE, KEEP_TYPE, UNARY(cbrt)},
+        [HYPOT_OPER] = {"hypot", 2, ANY_OPS, REDUCE_SHAPE, INT_IF_ALL_INT, KERNELS(hypot)},
+        [READ_OPER] = {"read", 0, 0, SOURCE_SHAPE, VALUE_TYPE, .source = readData},
+        [RAND_OPER] = {"rand", 0, 0, SOURCE_SHAPE, ALWAYS_DOUBLE, .source = randValue, .sourceBlock = randBlock},
+        [PRINT_OPER] = {"print", 1, ANY_OPS, PRINT_SHAPE, ALWAYS_INT},
+        [EQUAL_OPER] = {"equal", 2, 2, BINARY_SHAPE, ALWAYS_INT, KERNELS(equal)},
+        [LESS_OPER] = {"less", 2, 2, BINARY_SHAPE, ALWAYS_INT, KERNELS(less)},
+        [GREATER_OPER] = {"greater", 2, 2, BINARY_SHAPE, ALWAYS_INT, KERNELS(greater)},
+        [COND_OPER] = {"cond", 3, 3, COND_SHAPE, BRANCH_TYPE},
+        [RANGE_OPER] = {"range", 3, 4, RANGE_SHAPE, ELEMENT_TYPE},
+};
+
+const int numOpers = sizeof(operTable) / sizeof(operTable[0]);
+
+const char *operName(OPER_TYPE oper)
+{
+    if (oper == CUSTOM_OPER)
+        return "custom";
+    return operTable[oper].name;
+}
+
+bool checkArity(FUNC_AST_NODE *funcNode)
+{
+    const OPER_DESC *desc = &operTable[funcNode->oper];
+
+    if (funcNode->numOps < desc->minOps)
+    {
+        outPrintf("ERROR: too few parameters for the function <%s>\n", desc->name);
+        return false;
+    }
+    if (desc->maxOps != ANY_OPS && funcNode->numOps > desc->maxOps)
+        outPrintf("WARNING: too many parameters for the function <%s>\n", desc->name);
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef __cilisp_operators_h_
+#define __cilisp_operators_h_
+
+#include "ciLisp.h"
+
+// Built-in operators are described by one table indexed by OPER_TYPE.
+// Each entry gives the name, how many operands the operator takes, how its
+// result type follows from the operand types and the kernels that compute
+// it. Evaluation and type inference (see ciLispTypes.h) both work from the
+// table, so adding an operator means adding its OPER_TYPE, its entry and
+// its name to the func pattern in ciLisp.l and to the names in ciLispBulk.c.
+
+// maxOps of operators that take any number of operands
+#define ANY_OPS (-1)
+
+// How an operator combines its operands.
+typedef enum {
+    UNARY_SHAPE,    // unary(first operand)
+    BINARY_SHAPE,   // kernels[a.type][b.type](a, b)
+    FOLD_SHAPE,     // folds every operand into identity, left to right
+    REDUCE_SHAPE,   // folds the remaining operands into the first one
+    COND_SHAPE,     // test, then only the branch it selects
+    RANGE_SHAPE,    // a fold or reduce over the values of a range (see ciLispRange.h)
+    SOURCE_SHAPE,   // no operands, the next value of a stream
+    PRINT_SHAPE,
+    MISSING_SHAPE   // declared but not implemented
+} OPER_SHAPE;
+
+// Result type in terms of the operand types.
+typedef enum {
+    KEEP_TYPE,          // the operand's type
+    INT_IF_ALL_INT,     // DOUBLE as soon as one operand is DOUBLE
+    ALWAYS_INT,
+    ALWAYS_DOUBLE,
+    VALUE_TYPE,         // the type of each value a source gives, not known before
+    BRANCH_TYPE,        // the type of the branch taken
+    ELEMENT_TYPE        // the type of a range's element
+} PROMOTION;
+
+// Combines two values; indexed by the NUM_TYPE of each side.
+typedef double (*BINARY_KERNEL)(double, double);
+
+// The same over blocks of KERNEL_BLOCK values: acc[i] = kernel(acc[i], x[i])
+// and x[i] = unary(x[i]). Fused ranges (see ciLispRange.h) compute their
+// element a block at a time through these. The fixed length and the arrays
+// being distinct let the compiler vectorize the loops.
+#define KERNEL_BLOCK 256
+
+typedef void (*BLOCK_KERNEL)(double *restrict acc, const double *restrict x);
+typedef void (*UNARY_BLOCK)(double *x);
+
+typedef struct {
+    const char *name;
+    int minOps;
+    int maxOps;
+    OPER_SHAPE shape;
+    PROMOTION promotion;
+    double identity;                // FOLD_SHAPE only
+    double (*unary)(double);        // UNARY_SHAPE only
+    UNARY_BLOCK unaryBlock;
+    BINARY_KERNEL kernels[2][2];    // BINARY, FOLD and REDUCE shapes
+    BLOCK_KERNEL blockKernels[2][2];
+    RET_VAL (*source)(void);        // SOURCE_SHAPE only
+    void (*sourceBlock)(double *values, size_t count);     // the next count values, if they are DOUBLEs
+} OPER_DESC;
+
+extern const OPER_DESC operTable[];
+extern const int numOpers;
+
+// Name of a built-in operator, or "custom".
+const char *operName(OPER_TYPE oper);
+
+// Type of a BINARY, FOLD or REDUCE result given the operand types seen so far.
+static inline NUM_TYPE promoteType(const OPER_DESC *desc, NUM_TYPE a, NUM_TYPE b)
+{
+    if (desc->promotion == ALWAYS_INT)
+        return INT_TYPE;
+    return (a == DOUBLE_TYPE || b == DOUBLE_TYPE) ? DOUBLE_TYPE : INT_TYPE;
+}
+
+// Reports a call with too few operands (returns false) or too many (warns).
+bool checkArity(FUNC_AST_NODE *funcNode);
+
+#endif
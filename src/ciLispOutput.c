@@ -0,0 +1,468 @@
+//CiLisp output layer
+//Buffered writer and shortest round-trip double formatting (Grisu2).
+
+#include "ciLispOutput.h"
+#include "ciLispStats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+
+static char outBuffer[OUTPUT_BUFFER_SIZE];
+static size_t outLength = 0;
+static OUTPUT_FORMAT outFormat = LEGACY_FORMAT;
+
+void setOutputFormat(OUTPUT_FORMAT format)
+{
+    outFormat = format;
+}
+
+OUTPUT_FORMAT getOutputFormat(void)
+{
+    return outFormat;
+}
+
+// Hands the whole buffer to the kernel, retrying on short writes.
+void outFlush(void)
+{
+    size_t written = 0;
+    while (written < outLength)
+    {
+        ssize_t n = write(STDOUT_FILENO, outBuffer + written, outLength - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        written += n;
+    }
+    outLength = 0;
+}
+
+void outWrite(const char *text, size_t len)
+{
+    if (outLength + len > OUTPUT_BUFFER_SIZE)
+    {
+        outFlush();
+        // too big to ever fit, write straight from the caller's memory
+        if (len > OUTPUT_BUFFER_SIZE)
+        {
+            while (len > 0)
+            {
+                ssize_t n = write(STDOUT_FILENO, text, len);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    break;
+                }
+                text += n;
+                len -= n;
+            }
+            return;
+        }
+    }
+    memcpy(outBuffer + outLength, text, len);
+    outLength += len;
+}
+
+void outPuts(const char *text)
+{
+    outWrite(text, strlen(text));
+}
+
+void outVprintf(const char *format, va_list args)
+{
+    va_list retry;
+    va_copy(retry, args);
+
+    size_t space = OUTPUT_BUFFER_SIZE - outLength;
+    int len = vsnprintf(outBuffer + outLength, space, format, args);
+    if (len < 0)
+    {
+        va_end(retry);
+        return;
+    }
+
+    if ((size_t) len < space)
+    {
+        outLength += len;
+    }
+    else if ((size_t) len < OUTPUT_BUFFER_SIZE)
+    {
+        outFlush();
+        vsnprintf(outBuffer, OUTPUT_BUFFER_SIZE, format, retry);
+        outLength = len;
+    }
+    else
+    {
+        char *text = malloc(len + 1);
+        if (text != NULL)
+        {
+            vsnprintf(text, len + 1, format, retry);
+            outWrite(text, len);
+            free(text);
+        }
+    }
+    va_end(retry);
+}
+
+void outPrintf(const char *format, ...)
+{
+    statsCountMessage(format);
+
+    va_list args;
+    va_start(args, format);
+    outVprintf(format, args);
+    va_end(args);
+}
+
+// Writes the decimal digits of an unsigned integer.
+static void outUnsigned(uint64_t value)
+{
+    char digits[20];
+    int pos = sizeof(digits);
+    do
+    {
+        digits[--pos] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    outWrite(digits + pos, sizeof(digits) - pos);
+}
+
+// Mirrors glibc's spelling of NaN and infinity.
+static void outNonFinite(double value)
+{
+    if (isnan(value))
+        outPuts(signbit(value) ? "-nan" : "nan");
+    else
+        outPuts(signbit(value) ? "-inf" : "inf");
+}
+
+void outIntValue(double value)
+{
+    if (isfinite(value) && fabs(value) < 9223372036854775808.0)
+    {
+        if (signbit(value))
+        {
+            outWrite("-", 1);
+            value = -value;
+        }
+        outUnsigned((uint64_t) value);
+    }
+    else if (!isfinite(value))
+    {
+        outNonFinite(value);
+    }
+    else
+    {
+        outPrintf("%.0lf", value);
+    }
+}
+
+void outFixedValue(double value)
+{
+    char digits[24];
+    int decimalExponent;
+
+    // Below 2^32 an ulp is smaller than 1e-6, so when the shortest digits need
+    // at most six decimals they are exactly what "%lf" rounds the value to.
+    if (isfinite(value) && value != 0 && fabs(value) < 4294967296.0)
+    {
+        int len = shortestDigits(fabs(value), digits, &decimalExponent);
+        if (decimalExponent >= -6)
+        {
+            char text[48];
+            int pos = 0;
+            int point = len + decimalExponent; // digits before the decimal point
+
+            if (value < 0)
+                text[pos++] = '-';
+            if (point <= 0)
+            {
+                text[pos++] = '0';
+            }
+            else
+            {
+                for (int i = 0; i < point; i++)
+                    text[pos++] = i < len ? digits[i] : '0';
+            }
+            text[pos++] = '.';
+            for (int i = point; i < point + 6; i++)
+                text[pos++] = (i >= 0 && i < len) ? digits[i] : '0';
+
+            outWrite(text, pos);
+            return;
+        }
+    }
+
+    if (value == 0)
+        outPuts(signbit(value) ? "-0.000000" : "0.000000");
+    else
+        outPrintf("%lf", value);
+}
+
+void outShortestValue(double value, bool forceDecimalPoint)
+{
+    if (!isfinite(value))
+    {
+        outNonFinite(value);
+        return;
+    }
+
+    if (signbit(value))
+    {
+        outWrite("-", 1);
+        value = -value;
+    }
+
+    if (value == 0)
+    {
+        outPuts(forceDecimalPoint ? "0.0" : "0");
+        return;
+    }
+
+    char digits[24];
+    int decimalExponent;
+    int len = shortestDigits(value, digits, &decimalExponent);
+    int point = len + decimalExponent;
+
+    if (point <= 0)
+    {
+        outWrite("0.", 2);
+        for (int i = point; i < 0; i++)
+            outWrite("0", 1);
+        outWrite(digits, len);
+    }
+    else if (point < len)
+    {
+        outWrite(digits, point);
+        outWrite(".", 1);
+        outWrite(digits + point, len - point);
+    }
+    else
+    {
+        outWrite(digits, len);
+        for (int i = len; i < point; i++)
+            outWrite("0", 1);
+        if (forceDecimalPoint)
+            outWrite(".0", 2);
+    }
+}
+
+/*
+ * Grisu2, after Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers" (PLDI 2010). The digits always read back to the
+ * same double and are the shortest such string in all but rare cases.
+ */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DIY_FP;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK 0x7FF0000000000000ULL
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_HIDDEN_BIT 0x0010000000000000ULL
+
+// Normalized 64-bit approximations of 10^k for k = -348, -340, ..., 340.
+static const uint64_t cachedPowersF[] = {
+        0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76, 0xcf42894a5dce35ea,
+        0x9a6bb0aa55653b2d, 0xe61acf033d1a45df, 0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f,
+        0xbe5691ef416bd60c, 0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+        0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57, 0xc21094364dfb5637,
+        0x9096ea6f3848984f, 0xd77485cb25823ac7, 0xa086cfcd97bf97f4, 0xef340a98172aace5,
+        0xb23867fb2a35b28e, 0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+        0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126, 0xb5b5ada8aaff80b8,
+        0x87625f056c7c4a8b, 0xc9bcff6034c13053, 0x964e858c91ba2655, 0xdff9772470297ebd,
+        0xa6dfbd9fb8e5b88f, 0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+        0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06, 0xaa242499697392d3,
+        0xfd87b5f28300ca0e, 0xbce5086492111aeb, 0x8cbccc096f5088cc, 0xd1b71758e219652c,
+        0x9c40000000000000, 0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+        0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068, 0x9f4f2726179a2245,
+        0xed63a231d4c4fb27, 0xb0de65388cc8ada8, 0x83c7088e1aab65db, 0xc45d1df942711d9a,
+        0x924d692ca61be758, 0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+        0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d, 0x952ab45cfa97a0b3,
+        0xde469fbd99a05fe3, 0xa59bc234db398c25, 0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece,
+        0x88fcf317f22241e2, 0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+        0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410, 0x8bab8eefb6409c1a,
+        0xd01fef10a657842c, 0x9b10a4e5e9913129, 0xe7109bfba19c0c9d, 0xac2820d9623bf429,
+        0x80444b5e7aa7cf85, 0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+        0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b
+};
+
+// Binary exponents matching cachedPowersF.
+static const int16_t cachedPowersE[] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+        -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+        -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+        -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+        -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+        109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+        641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+        907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t pow10Table[] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+        100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+        10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+        10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+        10000000000000000000ULL
+};
+
+static DIY_FP diyFromDouble(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    int biasedExponent = (int) ((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+
+    if (biasedExponent != 0)
+        return (DIY_FP) {significand + DP_HIDDEN_BIT, biasedExponent - DP_EXPONENT_BIAS};
+    return (DIY_FP) {significand, DP_MIN_EXPONENT + 1};
+}
+
+static DIY_FP diyNormalize(DIY_FP x)
+{
+    int shift = __builtin_clzll(x.f);
+    return (DIY_FP) {x.f << shift, x.e - shift};
+}
+
+static DIY_FP diyNormalizeBoundary(DIY_FP x)
+{
+    while (!(x.f & (DP_HIDDEN_BIT << 1)))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    x.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+    x.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+    return x;
+}
+
+static DIY_FP diyMultiply(DIY_FP a, DIY_FP b)
+{
+    unsigned __int128 product = (unsigned __int128) a.f * b.f;
+    uint64_t high = (uint64_t) (product >> 64);
+    uint64_t low = (uint64_t) product;
+    if (low & (1ULL << 63))
+        high++; // round
+    return (DIY_FP) {high, a.e + b.e + 64};
+}
+
+// The neighbouring boundaries m- and m+ of the value, sharing m+'s exponent.
+static void diyNormalizedBoundaries(DIY_FP v, DIY_FP *minus, DIY_FP *plus)
+{
+    DIY_FP pl = diyNormalizeBoundary((DIY_FP) {(v.f << 1) + 1, v.e - 1});
+    DIY_FP mi = (v.f == DP_HIDDEN_BIT) ? (DIY_FP) {(v.f << 2) - 1, v.e - 2}
+                                       : (DIY_FP) {(v.f << 1) - 1, v.e - 1};
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+static DIY_FP cachedPower(int e, int *k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int) dk;
+    if (dk - ik > 0.0)
+        ik++;
+
+    unsigned index = (unsigned) ((ik >> 3) + 1);
+    *k = -(-348 + (int) (index << 3));
+    return (DIY_FP) {cachedPowersF[index], cachedPowersE[index]};
+}
+
+static void grisuRound(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa,
+                       uint64_t wpW)
+{
+    while (rest < wpW && delta - rest >= tenKappa &&
+           (rest + tenKappa < wpW || wpW - rest > rest + tenKappa - wpW))
+    {
+        buffer[len - 1]--;
+        rest += tenKappa;
+    }
+}
+
+static int countDecimalDigits(uint32_t n)
+{
+    int count = 1;
+    while (count < 10 && n >= pow10Table[count])
+        count++;
+    return count;
+}
+
+static int digitGen(DIY_FP w, DIY_FP mp, uint64_t delta, char *buffer, int *k)
+{
+    const DIY_FP one = {1ULL << -mp.e, mp.e};
+    const uint64_t wpW = mp.f - w.f;
+    uint32_t p1 = (uint32_t) (mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = countDecimalDigits(p1);
+    int len = 0;
+
+    while (kappa > 0)
+    {
+        uint32_t d = (uint32_t) (p1 / pow10Table[kappa - 1]);
+        p1 = (uint32_t) (p1 % pow10Table[kappa - 1]);
+        if (d || len)
+            buffer[len++] = (char) ('0' + d);
+        kappa--;
+
+        uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            grisuRound(buffer, len, delta, rest, pow10Table[kappa] << -one.e, wpW);
+            return len;
+        }
+    }
+
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char) (p2 >> -one.e);
+        if (d || len)
+            buffer[len++] = (char) ('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            int index = -kappa;
+            grisuRound(buffer, len, delta, p2, one.f, wpW * (index < 20 ? pow10Table[index] : 0));
+            return len;
+        }
+    }
+}
+
+int shortestDigits(double value, char *buffer, int *decimalExponent)
+{
+    DIY_FP v = diyFromDouble(value);
+    DIY_FP minus, plus;
+    diyNormalizedBoundaries(v, &minus, &plus);
+
+    int k;
+    DIY_FP cached = cachedPower(plus.e, &k);
+    DIY_FP w = diyMultiply(diyNormalize(v), cached);
+    DIY_FP wPlus = diyMultiply(plus, cached);
+    DIY_FP wMinus = diyMultiply(minus, cached);
+    wMinus.f++;
+    wPlus.f--;
+
+    *decimalExponent = k;
+    return digitGen(w, wPlus, wPlus.f - wMinus.f, buffer, decimalExponent);
+}
@@ -0,0 +1,43 @@
+#ifndef __cilisp_output_h_
+#define __cilisp_output_h_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Output layer for everything ciLisp writes to stdout.
+// Text is collected in a large user-space buffer and handed to write(2)
+// in big chunks, instead of going through stdio for every result.
+
+// Size of the user-space output buffer.
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Formats used by printRetVal.
+typedef enum {
+    LEGACY_FORMAT,  // "<INT>: %.0lf" / "<DOUBLE>: %lf", as always
+    LOSSLESS_FORMAT // shortest digits that read back to the exact same double
+} OUTPUT_FORMAT;
+
+void setOutputFormat(OUTPUT_FORMAT format);
+OUTPUT_FORMAT getOutputFormat(void);
+
+void outWrite(const char *text, size_t len);
+void outPuts(const char *text);
+void outPrintf(const char *format, ...);
+void outVprintf(const char *format, va_list args);
+
+// Writes an integer-valued double the way printf("%.0lf") would.
+void outIntValue(double value);
+// Writes a double the way printf("%lf") would.
+void outFixedValue(double value);
+// Writes the shortest decimal string that round-trips to value.
+// The result is always plain positional notation so the lexer can read it back.
+void outShortestValue(double value, bool forceDecimalPoint);
+
+void outFlush(void);
+
+// Fills buffer with the shortest round-trip digits of a positive, finite value.
+// Returns the digit count; the value is digits * 10^(*decimalExponent).
+int shortestDigits(double value, char *buffer, int *decimalExponent);
+
+#endif
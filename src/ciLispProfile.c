@@ -0,0 +1,156 @@
+//CiLisp operator profile
+//rdtsc timestamps around every call eval makes, accumulated per OPER_TYPE.
+
+#include "ciLispProfile.h"
+#include "ciLispOperators.h"
+
+#include <signal.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+bool profilingEnabled = false;
+
+// One per call in flight. They are kept apart from eval's frames, which
+// move when that stack grows.
+typedef struct {
+    uint64_t start;
+    uint64_t childCycles;
+} PROFILE_FRAME;
+
+#define MIN_PROFILE_DEPTH 64
+
+static OPER_PROFILE operProfiles[CUSTOM_OPER + 1];
+static PROFILE_FRAME *profileStack = NULL;
+static size_t profileDepth = 0;
+static size_t profileCapacity = 0;
+static const char *profilePath = NULL;
+static PROFILE_FORMAT profileFormat = PROFILE_TABLE;
+static volatile sig_atomic_t profileDumpRequested = 0;
+
+
+static inline uint64_t readCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+#endif
+}
+
+void enableProfiling(const char *path, PROFILE_FORMAT format)
+{
+    if (!profilingEnabled)
+        atexit(writeProfile);
+
+    profilingEnabled = true;
+    profilePath = path;
+    profileFormat = format;
+}
+
+void profileEnter(void)
+{
+    if (profileDepth == profileCapacity)
+    {
+        size_t capacity = profileCapacity == 0 ? MIN_PROFILE_DEPTH : 2 * profileCapacity;
+        profileStack = memRealloc(MEM_STACKS, profileStack, profileCapacity * sizeof(PROFILE_FRAME),
+                                  capacity * sizeof(PROFILE_FRAME));
+        profileCapacity = capacity;
+    }
+
+    PROFILE_FRAME *frame = &profileStack[profileDepth++];
+    frame->childCycles = 0;
+    frame->start = readCycles();
+}
+
+void profileExit(OPER_TYPE oper, int numOps, NUM_TYPE resultType)
+{
+    PROFILE_FRAME *frame = &profileStack[--profileDepth];
+    uint64_t inclusive = readCycles() - frame->start;
+    OPER_PROFILE *profile = &operProfiles[oper];
+
+    profile->calls++;
+    profile->operands += numOps;
+    profile->inclusiveCycles += inclusive;
+    profile->exclusiveCycles += inclusive - frame->childCycles;
+    if (resultType == INT_TYPE)
+        profile->intResults++;
+    else
+        profile->doubleResults++;
+
+    if (profileDepth > 0)
+        profileStack[profileDepth - 1].childCycles += inclusive;
+}
+
+void dumpProfile(FILE *out, PROFILE_FORMAT format)
+{
+    bool first = true;
+
+    if (format == PROFILE_JSON)
+        fprintf(out, "{\"unit\": \"cycles\", \"operators\": [");
+    else
+        fprintf(out, "%-10s %12s %12s %18s %18s %12s %12s\n",
+                "oper", "calls", "operands", "inclusive", "exclusive", "int", "double");
+
+    for (int oper = 0; oper <= CUSTOM_OPER; oper++)
+    {
+        OPER_PROFILE *profile = &operProfiles[oper];
+        if (profile->calls == 0)
+            continue;
+
+        if (format == PROFILE_JSON)
+        {
+            fprintf(out, "%s\n  {\"oper\": \"%s\", \"calls\": %llu, \"operands\": %llu, "
+                         "\"inclusive\": %llu, \"exclusive\": %llu, \"int\": %llu, \"double\": %llu}",
+                    first ? "" : ",", operName(oper),
+                    (unsigned long long) profile->calls, (unsigned long long) profile->operands,
+                    (unsigned long long) profile->inclusiveCycles,
+                    (unsigned long long) profile->exclusiveCycles,
+                    (unsigned long long) profile->intResults, (unsigned long long) profile->doubleResults);
+        }
+        else
+        {
+            fprintf(out, "%-10s %12llu %12llu %18llu %18llu %12llu %12llu\n", operName(oper),
+                    (unsigned long long) profile->calls, (unsigned long long) profile->operands,
+                    (unsigned long long) profile->inclusiveCycles,
+                    (unsigned long long) profile->exclusiveCycles,
+                    (unsigned long long) profile->intResults, (unsigned long long) profile->doubleResults);
+        }
+        first = false;
+    }
+
+    if (format == PROFILE_JSON)
+        fprintf(out, "\n]}\n");
+}
+
+void writeProfile(void)
+{
+    if (!profilingEnabled || profilePath == NULL)
+        return;
+
+    FILE *out = fopen(profilePath, "w");
+    if (out == NULL)
+        return;
+    dumpProfile(out, profileFormat);
+    fclose(out);
+}
+
+// Safe to call from a signal handler; the dump itself happens in serviceProfileDump.
+void requestProfileDump(void)
+{
+    profileDumpRequested = 1;
+}
+
+// Called by the driver between top-level expressions.
+void serviceProfileDump(void)
+{
+    if (profileDumpRequested)
+    {
+        profileDumpRequested = 0;
+        writeProfile();
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __cilisp_profile_h_
+#define __cilisp_profile_h_
+
+#include "ciLisp.h"
+
+#include <stdint.h>
+
+// Optional per-operator profile of the calls eval makes.
+// Counts calls, operands and INT vs DOUBLE results for every OPER_TYPE and
+// splits time into inclusive and exclusive (minus nested calls) cycles.
+
+typedef enum {
+    PROFILE_TABLE,
+    PROFILE_JSON
+} PROFILE_FORMAT;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t operands;
+    uint64_t inclusiveCycles;
+    uint64_t exclusiveCycles;
+    uint64_t intResults;
+    uint64_t doubleResults;
+} OPER_PROFILE;
+
+extern bool profilingEnabled;
+
+// Turns profiling on; the profile is written to path at exit,
+// and whenever profileDumpRequested is set (see SIGUSR2 in main).
+void enableProfiling(const char *path, PROFILE_FORMAT format);
+
+// Bracket one call; calls entered in between are nested in it.
+void profileEnter(void);
+void profileExit(OPER_TYPE oper, int numOps, NUM_TYPE resultType);
+
+void dumpProfile(FILE *out, PROFILE_FORMAT format);
+// Writes the profile to the file given to enableProfiling.
+void writeProfile(void);
+
+void requestProfileDump(void);
+void serviceProfileDump(void);
+
+#endif
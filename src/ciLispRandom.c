@@ -0,0 +1,234 @@
+//CiLisp random numbers
+//xoshiro256+ in RAND_LANES interleaved lanes, a block of values at a time.
+
+#include "ciLispRandom.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// 2^128 values ahead, from the xoshiro256 reference code
+static const uint64_t JUMP[4] = {
+        0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+};
+
+// LONG_JUMPS[k] is 2^k long jumps of 2^192 values ahead. The first is the
+// reference code's long jump, and each one after it the square of the one
+// before, modulo the generator's characteristic polynomial, so a stream is
+// reached with at most one jump per bit of its number.
+static const uint64_t LONG_JUMPS[64][4] = {
+        {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL},
+        {0x85d1837e6f0cd3feULL, 0xa4b0488571edcb9dULL, 0xe9edb73cb3e9fb7cULL, 0xba70f1bd97fc40b0ULL},
+        {0xac54fa504c60e306ULL, 0x0b893c16e4a7f3b3ULL, 0xaff90eda09ea8b4cULL, 0x3727c275522644a7ULL},
+        {0x302eda308643ab47ULL, 0xc9a202b2322bb7f6ULL, 0xd4483ff9a9ac5a23ULL, 0x574e4d0093e3a2e4ULL},
+        {0x261882d92ec8429fULL, 0xabfffe7ac9ea1612ULL, 0x236417db3b031424ULL, 0xec6aa16a8ffc76faULL},
+        {0x52f6a62700009087ULL, 0xf7c39d8fc76906a3ULL, 0x285943d7fb75d765ULL, 0x88e5349d50f3ddefULL},
+        {0x3facc68ed0053ac4ULL, 0xfc0c646fb82afcebULL, 0xf055378c576c5c9aULL, 0x21588c86cc534c29ULL},
+        {0xfe596054913ed407ULL, 0x3d38ff4fc965c1faULL, 0x776751b126655d13ULL, 0x443c1363fd5c7d43ULL},
+        {0x1a672a03c71adc2eULL, 0x6217b3306e3e9557ULL, 0x163160efcad9c046ULL, 0x5243e79672334390ULL},
+        {0x58ce1e7d6ea9281fULL, 0x5348b64c107873b6ULL, 0xdabe97e1dd9a59c1ULL, 0x2dcec71c419baa62ULL},
+        {0x955659c7b8793ecfULL, 0x37fae57370f8bc19ULL, 0xfba1683b54b1e0f6ULL, 0xe91553475948d23eULL},
+        {0xbb5b5c8aa1ad89e1ULL, 0x9d7c00c8471ddc07ULL, 0xa910bdeff21ce218ULL, 0x540fca0570720eb7ULL},
+        {0x0612914f1b46c912ULL, 0x6d8abce0cf641cfcULL, 0x32f22fb19ac4550bULL, 0xc4b65c3551c83c69ULL},
+        {0x536e6114e4189cfcULL, 0xbe100596c8da9541ULL, 0xee7eb44f2fdbd1b8ULL, 0xb1170d0754beeaa4ULL},
+        {0xbeb789dbbc4ea209ULL, 0x267d7103ef9f83a3ULL, 0x93f548c2cab0a32cULL, 0x45cac579389af5caULL},
+        {0x65ceb6cde220e757ULL, 0xd6f9074a4c2732f7ULL, 0xa8e0425b0d01cd1eULL, 0x2b75c5d185461341ULL},
+        {0xafbacb099d1967bdULL, 0x1af87374102c1031ULL, 0x470868184fcc3f5fULL, 0x114dcbb43b155057ULL},
+        {0x5f98e9b5ad62427dULL, 0xf27e722d27743cd9ULL, 0x7ebe95d47cd1daf2ULL, 0x1b98494373c20b8aULL},
+        {0x8f1d0f5ec26521a6ULL, 0x036e9886f63c9933ULL, 0x4ac6fab0688e4ccdULL, 0x93d03eea25d1d816ULL},
+        {0xdd4e745e4412a26aULL, 0xbb62b24404a1be96ULL, 0x9c227b5ba376faeeULL, 0x08615908bcc4c8f2ULL},
+        {0xebe0d315a9cb279bULL, 0xc7a967d45d82bbcaULL, 0x64d85cc844957794ULL, 0xf6a1ef6a7d3b2545ULL},
+        {0x29bfb1bdc678fcbeULL, 0x611e5aedd44a4fd4ULL, 0xd188547deb3f0136ULL, 0x2b8dd348e0f767aeULL},
+        {0xfad25fa87d091580ULL, 0x5154a018eba8e309ULL, 0xbd9b522fb9f15d0bULL, 0xfcd653bc999d276bULL},
+        {0x29c79a4cedb3baf2ULL, 0x946592914b67e34fULL, 0x04921932aaf82150ULL, 0xb36394657868f06eULL},
+        {0x6cbfcd64bf69402cULL, 0xca9a2b49a6e6b16dULL, 0xba835279ffb6a358ULL, 0xfbdf21da0bb9add0ULL},
+        {0x23436782d086ca23ULL, 0x0cf66f05d413a46dULL, 0xbb90914a9c9871a3ULL, 0xedcce16aeb59e5adULL},
+        {0x130e23fa572004a9ULL, 0xf9ce20dec18c4b44ULL, 0x5cea7b8a1ac11de9ULL, 0x6608d757c7d36be3ULL},
+        {0x70c7a48f09b95bb9ULL, 0xd03a1ed309668f2fULL, 0xa955e448a10873d4ULL, 0xd5d4c6699513858fULL},
+        {0x72015cf80ce336f4ULL, 0x619c9d98f6f33bcbULL, 0x59f1b7e5d5fbfdc3ULL, 0x16cac53fc2905146ULL},
+        {0x5f340fcb5be19401ULL, 0xce2129cd34ae493aULL, 0x14690cfa36c329edULL, 0xc6e96787aedc5c40ULL},
+        {0x7ad9f632881e960fULL, 0xb8052dcca0e13395ULL, 0xd457241f6a9863acULL, 0xf8d2e75e66d53d83ULL},
+        {0x23336699f63c8e45ULL, 0x33b2e33e1d4e5bdbULL, 0x37fdeee585fdcd8eULL, 0x9a5144da7f765fd8ULL},
+        {0x0c7840cbc3b121adULL, 0xd317530723ab526aULL, 0xf31d2e03157bc387ULL, 0xa2b5d83a373c7ac2ULL},
+        {0x47b3063d7d254e4cULL, 0xea7c37e6ee511ddfULL, 0x0b50e1ab78926eefULL, 0x3ff3ff3e9168fd71ULL},
+        {0x2c56cd0f48e4587dULL, 0x4c77464d80c69c23ULL, 0xcbbf60dca92d32deULL, 0x6021ef776e85bae8ULL},
+        {0xe3521a7cbf37c2a1ULL, 0xa5130e508b35bcf2ULL, 0xf308dc3d84a999f1ULL, 0x601a299a0bbe06e1ULL},
+        {0xde3439ebd3e4fcefULL, 0x5b1dcb68d8e77159ULL, 0xb00b42e8b528bff6ULL, 0x9b121812c345eb87ULL},
+        {0x07eb2f053805555cULL, 0xa7f205f341a367e5ULL, 0x5d5d85d95fc59359ULL, 0x057f094f242a8701ULL},
+        {0x2e990fa0b86f494dULL, 0x5d3d62bea3d0c982ULL, 0x2be3af695f4ca02dULL, 0xcc92a4a3521dba28ULL},
+        {0xdd8082fb069d5ee7ULL, 0x7dc029224f1676fbULL, 0x65e7ab91abe659d0ULL, 0x04fb453c7ad02c02ULL},
+        {0x90b632d403b4513cULL, 0x0f186a740aaa16b5ULL, 0xb93a0637f3af87f7ULL, 0x3910377fe08e48a3ULL},
+        {0xcafe235cd7fe7ef0ULL, 0x5f1e003e1d3a7dafULL, 0x7f5505759890b722ULL, 0xf2f7c89f1379cf05ULL},
+        {0x5a252ed34d09cd4fULL, 0xe8f150b98011d5feULL, 0x131bf6c475e29db1ULL, 0x07818fb0f5b0ff11ULL},
+        {0x0441124ba35b2f58ULL, 0x9d4b489eae71f97dULL, 0x50fa45528d32be3aULL, 0xce8349b10acdabcaULL},
+        {0xade4816bccf327acULL, 0xc14a5bff8ad78a52ULL, 0x4cc84cfe14a77c57ULL, 0x183c124cf3d64e0bULL},
+        {0x4dbeffc02ebf0904ULL, 0xc3b545955dbab803ULL, 0xb7fa51c1fe79c53bULL, 0x688b6947de87d7e9ULL},
+        {0x2f5b386d0a416de5ULL, 0xdd87232f5cca256aULL, 0x7ba82a958b9e6a9aULL, 0x2c55c09810b2f548ULL},
+        {0xf75f6b5cec404580ULL, 0x8f0aa8baea9011fdULL, 0x1221c7c14b1db112ULL, 0x1d8ee30bc2f88017ULL},
+        {0xd18562b8cfa0694fULL, 0xba5487bfcecce199ULL, 0xde5eb81978735ad0ULL, 0x33a1c005e4ccc286ULL},
+        {0xdca75eca4474cbe5ULL, 0x0388cd9f71f314e3ULL, 0xd4699ceb082644c3ULL, 0x1271254993f074aaULL},
+        {0x1c493fa07fa74dcdULL, 0xb59cd5fcb429c2a9ULL, 0x3e550b09e8493d84ULL, 0x516fabbf03d78293ULL},
+        {0xe6d4233d77a1930dULL, 0x00424fa384fbe6eeULL, 0x4c636e19b68da5afULL, 0x140c9813f8542a71ULL},
+        {0xbea7da1e4eabfb2cULL, 0x271441e275aceb6bULL, 0x00ef11ecb78fd7ddULL, 0x3564fd80ea4578c1ULL},
+        {0xaf64e36a267033fdULL, 0xb86eb7a249850b0fULL, 0x9a888e9f318a8efeULL, 0x734c58deea6bd24bULL},
+        {0x30765a1ca7975996ULL, 0xeb222e5b91776decULL, 0x27e74ceb6b5c8a44ULL, 0xaea3b00f90869cf7ULL},
+        {0xc41171736f6127bdULL, 0xbbe041e1a6089bafULL, 0x623b0619adb26e6bULL, 0xc119ec86604ac1deULL},
+        {0xcc48029f3903aa23ULL, 0xddf1854fc56579d8ULL, 0xaa69f6bbf9bfebccULL, 0xfc1385169b03eb72ULL},
+        {0x409b2e169eb1bbfaULL, 0x771b06055d169793ULL, 0x47bf1babcb2b82f5ULL, 0xace055588e22fd26ULL},
+        {0x01731918ee54abd6ULL, 0x759a7ec7f27f3792ULL, 0xb4d6164f3e9d573eULL, 0xb604b97729a3c214ULL},
+        {0x1a22142b7cc54bcfULL, 0x43461d4569c23fa4ULL, 0x8d7ff0d4f4fb9470ULL, 0x1a825a9fac612b54ULL},
+        {0x39da610606e0e771ULL, 0x4566a69758dd856dULL, 0x1c60396a2c51aa0bULL, 0xf418b6ce5a857da3ULL},
+        {0xdfca68648b28c5afULL, 0xb56437fb2b753802ULL, 0xebb82aacdf6ca80dULL, 0xa170e108788db093ULL},
+        {0xde5b821c4a3d86e8ULL, 0x861fffe004c85acaULL, 0x3413838181a6096fULL, 0x460de3bdbe1cb3acULL},
+        {0x5b7b491f49ccffccULL, 0xae7f8689b0bbd6a0ULL, 0x13865b737d9739bcULL, 0x6c132e0c5374c916ULL},
+};
+
+// word w of lane l's state is state[w][l], so a loop over the lanes is a loop over vectors
+static uint64_t state[4][RAND_LANES];
+static bool seeded = false;
+
+static double buffer[RAND_BLOCK];
+static size_t bufferNext = RAND_BLOCK;
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// Advances one lane's state, as a scalar.
+static void nextState(uint64_t s[4])
+{
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+}
+
+static void jumpState(uint64_t s[4], const uint64_t jump[4])
+{
+    uint64_t jumped[4] = {0, 0, 0, 0};
+
+    for (int i = 0; i < 4; i++)
+    {
+        for (int bit = 0; bit < 64; bit++)
+        {
+            if (jump[i] >> bit & 1)
+            {
+                for (int w = 0; w < 4; w++)
+                    jumped[w] ^= s[w];
+            }
+            nextState(s);
+        }
+    }
+    memcpy(s, jumped, sizeof(jumped));
+}
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void seedRandom(uint64_t seed, uint64_t stream)
+{
+    uint64_t s[4];
+
+    for (int w = 0; w < 4; w++)
+        s[w] = splitmix64(&seed);
+    for (int k = 0; k < 64; k++)
+    {
+        if (stream >> k & 1)
+            jumpState(s, LONG_JUMPS[k]);
+    }
+
+    for (int lane = 0; lane < RAND_LANES; lane++)
+    {
+        for (int w = 0; w < 4; w++)
+            state[w][lane] = s[w];
+        jumpState(s, JUMP);
+    }
+
+    seeded = true;
+    bufferNext = RAND_BLOCK;
+}
+
+// Fills values with the next RAND_BLOCK values. The exponent of 1.0 over the
+// top 52 bits gives a double in [1, 2) without an integer conversion, which
+// vector units lack for 64-bit integers.
+static void generate(double *values)
+{
+    if (!seeded)
+        seedRandom(0, 0);
+
+    uint64_t s0[RAND_LANES], s1[RAND_LANES], s2[RAND_LANES], s3[RAND_LANES];
+    memcpy(s0, state[0], sizeof(s0));
+    memcpy(s1, state[1], sizeof(s1));
+    memcpy(s2, state[2], sizeof(s2));
+    memcpy(s3, state[3], sizeof(s3));
+
+    for (size_t i = 0; i < RAND_BLOCK; i += RAND_LANES)
+    {
+        for (size_t lane = 0; lane < RAND_LANES; lane++)
+        {
+            uint64_t bits = (s0[lane] + s3[lane]) >> 12 | 0x3ff0000000000000ULL;
+            uint64_t t = s1[lane] << 17;
+
+            s2[lane] ^= s0[lane];
+            s3[lane] ^= s1[lane];
+            s1[lane] ^= s2[lane];
+            s0[lane] ^= s3[lane];
+            s2[lane] ^= t;
+            s3[lane] = rotl(s3[lane], 45);
+
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            values[i + lane] = value - 1.0;
+        }
+    }
+
+    memcpy(state[0], s0, sizeof(s0));
+    memcpy(state[1], s1, sizeof(s1));
+    memcpy(state[2], s2, sizeof(s2));
+    memcpy(state[3], s3, sizeof(s3));
+}
+
+double randDouble(void)
+{
+    if (bufferNext == RAND_BLOCK)
+    {
+        generate(buffer);
+        bufferNext = 0;
+    }
+    return buffer[bufferNext++];
+}
+
+void randBlock(double *values, size_t count)
+{
+    while (count > 0)
+    {
+        // whole blocks go straight to values once the buffer is used up
+        if (bufferNext == RAND_BLOCK && count >= RAND_BLOCK)
+        {
+            generate(values);
+            values += RAND_BLOCK;
+            count -= RAND_BLOCK;
+            continue;
+        }
+        if (bufferNext == RAND_BLOCK)
+        {
+            generate(buffer);
+            bufferNext = 0;
+        }
+
+        size_t taken = RAND_BLOCK - bufferNext < count ? RAND_BLOCK - bufferNext : count;
+        memcpy(values, buffer + bufferNext, taken * sizeof(double));
+        bufferNext += taken;
+        values += taken;
+        count -= taken;
+    }
+}
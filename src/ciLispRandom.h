@@ -0,0 +1,34 @@
+#ifndef __cilisp_random_h_
+#define __cilisp_random_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Random numbers for rand: DOUBLEs uniform in [0, 1), 52 random bits each.
+//
+// They come from RAND_LANES xoshiro256+ generators taking turns: the
+// sequence is the first value of lane 0, of lane 1, ... of the last lane,
+// then the second value of lane 0 and so on. Each lane starts 2^128 values
+// after the one before it (xoshiro's jump), so no two ever overlap. Values
+// are made RAND_BLOCK at a time, all lanes in one loop the compiler turns
+// into vector instructions, and handed out one by one or a block at a time
+// (fused ranges, see ciLispRange.h); either way they come in the same order.
+//
+// The sequence depends only on the seed and the stream. The seed is
+// stretched into the first lane's state with splitmix64; stream k moves
+// every lane k * 2^192 values further on (xoshiro's long jump), so workers
+// given the same seed and different streams draw from disjoint sequences.
+
+#define RAND_LANES 8
+#define RAND_BLOCK 256
+
+// Seeds the generators; the default is seed 0, stream 0.
+void seedRandom(uint64_t seed, uint64_t stream);
+
+// The next value.
+double randDouble(void);
+
+// The next count values, in order, to values.
+void randBlock(double *values, size_t count);
+
+#endif
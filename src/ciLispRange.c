@@ -0,0 +1,314 @@
+//CiLisp fused ranges
+//Counting a range, and computing an arithmetic element a block of values at a time.
+
+#include "ciLispRange.h"
+#include "ciLispBudget.h"
+#include "ciLispFunction.h"
+#include "ciLispProfile.h"
+
+// Past 2^53 values, start + index * step stops telling them apart.
+#define RANGE_MAX_COUNT 9007199254740992.0
+
+AST_NODE *createRangeNode(SYMBOL_ID reducer, SYMBOL_TABLE_NODE *variable, OP_VECTOR *bounds, AST_NODE *element)
+{
+    bool complete = element != NULL;
+    for (int i = 0; i < bounds->numOps; i++)
+        complete &= bounds->ops[i] != NULL;
+
+    // one of them was a syntax error
+    if (!complete)
+    {
+        freeOpList(bounds);
+        freeNode(element);
+        freeSymbolTable(variable);
+        return NULL;
+    }
+
+    // the value the variable is bound to is the one each value is written to
+    variable->val = createNumberNode(0, variable->val_type);
+    element = setSymbolTable(variable, element);
+
+    AST_NODE *node = createFunctionNode((SYMBOL_ID) RANGE_OPER, addOpToList(bounds, element));
+    node->data.function.ident = reducer;
+    return node;
+}
+
+const OPER_DESC *rangeReducer(FUNC_AST_NODE *range)
+{
+    const OPER_DESC *desc = &operTable[resolveFunc(range->ident)];
+
+    if (desc->shape != FOLD_SHAPE && desc->shape != REDUCE_SHAPE)
+    {
+        outPrintf("ERROR: the function <%s> cannot reduce a range\n", desc->name);
+        return NULL;
+    }
+    return desc;
+}
+
+static bool beforeEnd(const RANGE_BOUNDS *bounds, uint64_t index, double end)
+{
+    double value = rangeValue(bounds, index);
+    return bounds->step > 0 ? value < end : value > end;
+}
+
+bool countRange(FUNC_AST_NODE *range, double end, RANGE_BOUNDS *bounds)
+{
+    double span = (end - bounds->start) / bounds->step;
+
+    // a step of 0 (also one an int range truncated to 0) or nan, or a bound
+    // that is infinite or nan; a 0 step past the end makes span -inf
+    if (bounds->step == 0 || isnan(span) || span >= RANGE_MAX_COUNT)
+    {
+        outPrintf("ERROR: the range of <%s> does not end\n", symbolName(rangeVariable(range)->ident));
+        return false;
+    }
+
+    // span is rounded, the values themselves decide
+    bounds->count = span > 0 ? (uint64_t) ceil(span) : 0;
+    while (bounds->count > 0 && !beforeEnd(bounds, bounds->count - 1, end))
+        bounds->count--;
+    while (beforeEnd(bounds, bounds->count, end))
+        bounds->count++;
+    return true;
+}
+
+/*
+ * Blocks. The element is compiled into its nodes in evaluation order, each
+ * with a register of KERNEL_BLOCK values. Register 0 holds the variable;
+ * numbers and parameters are filled in once, and every call is computed from
+ * its operands' registers by the block kernels. A call's operands are
+ * combined in the order and with the kernels eval would use.
+ */
+
+typedef struct {
+    AST_NODE *node;
+    int operands;                   // first of its operands' registers in operandRegs
+    BLOCK_KERNEL kernel;            // BINARY_SHAPE only
+} BLOCK_STEP;
+
+typedef struct {
+    BLOCK_STEP steps[RANGE_MAX_NODES];      // register of steps[i] is i + 1
+    NUM_TYPE types[RANGE_MAX_NODES + 1];    // by register
+    int operandRegs[RANGE_MAX_NODES];
+    int numSteps;
+    int numOperands;
+    int visited;                            // nodes looked at, so a deep element is given up early
+    uint64_t cost;                          // steps eval would charge for one element
+    const OPER_DESC *source;                // of every SOURCE_SHAPE call, NULL if there are none
+    int sourceRegs[RANGE_MAX_NODES];        // in evaluation order
+    int numSources;
+} BLOCK_PROGRAM;
+
+static double registers[RANGE_MAX_NODES + 1][KERNEL_BLOCK];
+
+// values drawn for a block when the element has more than one source
+static double drawn[RANGE_MAX_NODES * KERNEL_BLOCK];
+
+static bool blockableCall(FUNC_AST_NODE *funcNode)
+{
+    if (funcNode->oper == CUSTOM_OPER || !funcNode->typed)
+        return false;
+
+    const OPER_DESC *desc = &operTable[funcNode->oper];
+    if (desc->shape == SOURCE_SHAPE)
+        return desc->sourceBlock != NULL;
+    return desc->shape == UNARY_SHAPE || desc->shape == BINARY_SHAPE || desc->shape == FOLD_SHAPE ||
+           desc->shape == REDUCE_SHAPE;
+}
+
+static void fillRegister(int reg, double value)
+{
+    for (size_t i = 0; i < KERNEL_BLOCK; i++)
+        registers[reg][i] = value;
+}
+
+// Adds node, after its operands, to program. Returns its register, or -1 if
+// it cannot be computed in blocks.
+static int compileNode(BLOCK_PROGRAM *program, AST_NODE *node, SYMBOL_TABLE_NODE *variable)
+{
+    if (node == NULL || (node->symbolTable != NULL && node->symbolTable != variable) ||
+        ++program->visited > RANGE_MAX_NODES)
+        return -1;
+
+    switch (node->type)
+    {
+        case SYM_NODE_TYPE:
+            if (findSymbol(node->data.symbol.ident, node) != variable)
+                return -1;
+            // the symbol, then the value bound to it
+            program->cost += 2;
+            return 0;
+        case ARG_NODE_TYPE:
+            if (!argInFrame(&node->data.arg))
+                return -1;
+            break;
+        case FUNC_NODE_TYPE:
+            if (!blockableCall(&node->data.function))
+                return -1;
+            break;
+        default:
+            break;
+    }
+
+    BLOCK_STEP step = {node, program->numOperands, NULL};
+    NUM_TYPE type = INT_TYPE;
+
+    if (node->type == FUNC_NODE_TYPE)
+    {
+        FUNC_AST_NODE *funcNode = &node->data.function;
+        if (program->numOperands + funcNode->numOps > RANGE_MAX_NODES)
+            return -1;
+        program->numOperands += funcNode->numOps;
+
+        for (int i = 0; i < funcNode->numOps; i++)
+        {
+            int reg = compileNode(program, funcNode->ops[i], variable);
+            if (reg < 0)
+                return -1;
+            program->operandRegs[step.operands + i] = reg;
+        }
+
+        const OPER_DESC *desc = &operTable[funcNode->oper];
+        if (desc->shape == BINARY_SHAPE)
+        {
+            const int *ops = &program->operandRegs[step.operands];
+            step.kernel = desc->blockKernels[program->types[ops[0]]][program->types[ops[1]]];
+        }
+        else if (desc->shape == SOURCE_SHAPE)
+        {
+            // one stream, so the values can be handed out in eval's order
+            if (program->source != NULL && program->source != desc)
+                return -1;
+            program->source = desc;
+            program->sourceRegs[program->numSources++] = program->numSteps + 1;
+        }
+        type = funcNode->staticType;
+    }
+
+    int reg = ++program->numSteps;
+
+    // numbers and parameters keep their value for the whole range
+    if (node->type == NUM_NODE_TYPE)
+    {
+        type = node->data.number.type;
+        fillRegister(reg, node->data.number.value);
+    }
+    else if (node->type == ARG_NODE_TYPE)
+    {
+        RET_VAL value = evalArgNode(&node->data.arg);
+        type = value.type;
+        fillRegister(reg, value.value);
+    }
+
+    program->steps[reg - 1] = step;
+    program->types[reg] = type;
+    program->cost++;
+    return reg;
+}
+
+// Fills the registers of the sources with the next count values of their
+// stream, in the order eval would take them: every source for the first
+// element, left to right, then every source for the second one and so on.
+static void drawSources(const BLOCK_PROGRAM *program, size_t count)
+{
+    if (program->numSources == 1)
+    {
+        program->source->sourceBlock(registers[program->sourceRegs[0]], count);
+        return;
+    }
+
+    program->source->sourceBlock(drawn, count * program->numSources);
+    for (int j = 0; j < program->numSources; j++)
+    {
+        double *values = registers[program->sourceRegs[j]];
+        for (size_t i = 0; i < count; i++)
+            values[i] = drawn[i * program->numSources + j];
+    }
+}
+
+// Computes every call in program over the values in register 0 and the
+// sources'.
+static void runBlock(const BLOCK_PROGRAM *program)
+{
+    for (int reg = 1; reg <= program->numSteps; reg++)
+    {
+        const BLOCK_STEP *step = &program->steps[reg - 1];
+        if (step->node->type != FUNC_NODE_TYPE)
+            continue;
+
+        FUNC_AST_NODE *funcNode = &step->node->data.function;
+        const OPER_DESC *desc = &operTable[funcNode->oper];
+        const int *ops = &program->operandRegs[step->operands];
+        double *acc = registers[reg];
+        int i = 0;
+
+        switch (desc->shape)
+        {
+            case UNARY_SHAPE:
+                memcpy(acc, registers[ops[0]], sizeof(registers[0]));
+                desc->unaryBlock(acc);
+                break;
+            case BINARY_SHAPE:
+                memcpy(acc, registers[ops[0]], sizeof(registers[0]));
+                step->kernel(acc, registers[ops[1]]);
+                break;
+            case FOLD_SHAPE:
+            case REDUCE_SHAPE:
+                if (desc->shape == FOLD_SHAPE)
+                    fillRegister(reg, desc->identity);
+                else
+                    memcpy(acc, registers[ops[i++]], sizeof(registers[0]));
+                for (; i < funcNode->numOps; i++)
+                {
+                    NUM_TYPE kernelType = i < (int) funcNode->intOperands ? INT_TYPE : DOUBLE_TYPE;
+                    desc->blockKernels[kernelType][kernelType](acc, registers[ops[i]]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+bool reduceRangeBlocks(FUNC_AST_NODE *range, const OPER_DESC *desc, const RANGE_BOUNDS *bounds, RET_VAL *acc)
+{
+    SYMBOL_TABLE_NODE *variable = rangeVariable(range);
+    BLOCK_PROGRAM program;
+
+    // the profile counts every call eval makes
+    if (profilingEnabled || variable->next != NULL)
+        return false;
+
+    program.numSteps = 0;
+    program.numOperands = 0;
+    program.visited = 0;
+    program.cost = 0;
+    program.source = NULL;
+    program.numSources = 0;
+    program.types[0] = variable->val_type;
+    int result = compileNode(&program, rangeElement(range), variable);
+    if (result < 0)
+        return false;
+
+    NUM_TYPE type = program.types[result];
+    for (uint64_t first = 0; first < bounds->count; first += KERNEL_BLOCK)
+    {
+        uint64_t count = bounds->count - first < KERNEL_BLOCK ? bounds->count - first : KERNEL_BLOCK;
+        if (!chargeSteps(count * program.cost))
+        {
+            *acc = (RET_VAL){INT_TYPE, NAN};
+            return true;
+        }
+
+        // the whole block is computed, only count values are used
+        for (size_t i = 0; i < KERNEL_BLOCK; i++)
+            registers[0][i] = rangeValue(bounds, first + i);
+        // only as many values as elements are used, as eval would take
+        if (program.numSources > 0)
+            drawSources(&program, count);
+        runBlock(&program);
+        for (size_t i = 0; i < count; i++)
+            combineElement(desc, acc, first + i, (RET_VAL){type, registers[result][i]});
+    }
+    return true;
+}
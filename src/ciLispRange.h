@@ -0,0 +1,88 @@
+#ifndef __cilisp_range_h_
+#define __cilisp_range_h_
+
+#include "ciLisp.h"
+#include "ciLispOperators.h"
+
+// Fused ranges.
+//
+//   (add (range x 0 1 0.001) (mult (exp x) 0.001))
+//   (max (range int i 1 100) (remainder (mult i 37) 101))
+//
+// An add, mult, max, min or hypot over a range evaluates its element once for
+// each value of the range variable and combines the values as they come,
+// exactly as it would combine them as operands. Nothing is built per value:
+// the variable is bound on the element like a let binding, whose value is
+// rewritten in place before each evaluation.
+//
+// (range [int|double] name start end [step]) takes start, start + step,
+// start + 2 step, ... up to but not including end. step defaults to 1 and may
+// be negative. Like a let binding the variable is a double unless declared
+// int; start and step are cast to its type, end is compared as it is.
+//
+// An element made only of typed arithmetic (see ciLispTypes.h) on the
+// variable, numbers, lambda parameters and rand is not evaluated value by
+// value but KERNEL_BLOCK values at a time, through the block kernels of
+// operTable. The values are still combined in order, so the result is the
+// same to the bit, and the steps charged are the ones eval would have
+// charged. rand's values are drawn a block at a time too, as many as eval
+// would draw and handed out in the order it would use them.
+//
+// The node is a RANGE_OPER call whose operands are start, end, the step if
+// given and the element, and whose ident is the operator that reduces them.
+
+// Largest element, in nodes, that is computed in blocks.
+#define RANGE_MAX_NODES 32
+
+typedef struct {
+    double start;
+    double step;
+    uint64_t count;
+} RANGE_BOUNDS;
+
+// bounds holds start, end and maybe step; reducer is the FUNC it was written in.
+AST_NODE *createRangeNode(SYMBOL_ID reducer, SYMBOL_TABLE_NODE *variable, OP_VECTOR *bounds, AST_NODE *element);
+
+static inline AST_NODE *rangeElement(FUNC_AST_NODE *range)
+{
+    return range->ops[range->numOps - 1];
+}
+
+// The binding of the variable, in front of the element's let section.
+static inline SYMBOL_TABLE_NODE *rangeVariable(FUNC_AST_NODE *range)
+{
+    return rangeElement(range)->symbolTable;
+}
+
+// The operator that combines the values, or NULL, reported, if it is not a
+// fold or a reduce.
+const OPER_DESC *rangeReducer(FUNC_AST_NODE *range);
+
+// Counts the values from bounds->start in steps of bounds->step before end.
+// Reports and returns false if there is no end to them.
+bool countRange(FUNC_AST_NODE *range, double end, RANGE_BOUNDS *bounds);
+
+static inline double rangeValue(const RANGE_BOUNDS *bounds, uint64_t index)
+{
+    return bounds->start + (double) index * bounds->step;
+}
+
+// Folds value, the element for the index-th value, into acc the way desc
+// folds its operands.
+static inline void combineElement(const OPER_DESC *desc, RET_VAL *acc, uint64_t index, RET_VAL value)
+{
+    if (index == 0 && desc->shape == REDUCE_SHAPE)
+    {
+        // starts from the first element as it is
+        *acc = value;
+        return;
+    }
+    acc->value = desc->kernels[acc->type][value.type](acc->value, value.value);
+    acc->type = promoteType(desc, acc->type, value.type);
+}
+
+// Reduces every element of range into acc a block at a time, if its element
+// allows it. Returns false, having done nothing, if it does not.
+bool reduceRangeBlocks(FUNC_AST_NODE *range, const OPER_DESC *desc, const RANGE_BOUNDS *bounds, RET_VAL *acc);
+
+#endif
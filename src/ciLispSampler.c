@@ -0,0 +1,287 @@
+//CiLisp sampling profiler
+//Samples counted by a CPU timer, charged to the stack of nodes in flight and
+//folded into distinct stacks of labels.
+
+#include "ciLispSampler.h"
+#include "ciLispSource.h"
+
+#include <signal.h>
+#include <sys/time.h>
+
+// longest text of a node in a label
+#define SAMPLE_SNIPPET 40
+
+#define MIN_SAMPLE_ITEMS 256
+
+// A frame of a stack: which node, under which name.
+typedef struct {
+    SYMBOL_ID name;
+    SOURCE_SPAN span;
+    uint32_t hash;
+} SAMPLE_LABEL;
+
+typedef struct {
+    size_t labels;      // the first of its labels in stackLabels
+    size_t depth;
+    uint32_t hash;
+    uint64_t count;
+} SAMPLE_STACK;
+
+// Open addressing index over labels or stacks: slots hold index + 1, 0 marks
+// an empty one, and it is kept at most half full.
+typedef struct {
+    uint32_t *slots;
+    size_t mask;
+} SAMPLE_INDEX;
+
+bool samplingEnabled = false;
+atomic_uint samplesPending = 0;
+
+static const char *samplePath = NULL;
+static volatile sig_atomic_t sampleDumpRequested = 0;
+
+static SAMPLE_LABEL *labels = NULL;
+static size_t numLabels = 0;
+static size_t labelCapacity = 0;
+static SAMPLE_INDEX labelIndex;
+
+// Every distinct stack, its labels one after another in stackLabels. A
+// stack being sampled is appended there, and dropped if it is not new.
+static SAMPLE_STACK *stacks = NULL;
+static size_t numStacks = 0;
+static size_t stackCapacity = 0;
+static SAMPLE_INDEX stackIndex;
+static uint32_t *stackLabels = NULL;
+static size_t numStackLabels = 0;
+static size_t stackLabelCapacity = 0;
+static size_t sampleBase;
+
+static void onSampleSignal(int sig)
+{
+    atomic_fetch_add_explicit(&samplesPending, 1, memory_order_relaxed);
+}
+
+void enableSampling(const char *path)
+{
+    if (!samplingEnabled)
+    {
+        atexit(writeSamples);
+        keepSource();
+        signal(SIGPROF, onSampleSignal);
+        struct itimerval timer = {{0, SAMPLE_INTERVAL_US}, {0, SAMPLE_INTERVAL_US}};
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+
+    samplingEnabled = true;
+    samplePath = path;
+}
+
+// FNV-1a over a value, continuing from hash.
+static uint32_t hashValue(uint32_t hash, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        hash ^= (value >> (8 * i)) & 0xff;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void *growItems(void *items, size_t *capacity, size_t needed, size_t itemSize)
+{
+    if (needed <= *capacity)
+        return items;
+
+    size_t grown = *capacity == 0 ? MIN_SAMPLE_ITEMS : 2 * *capacity;
+    while (grown < needed)
+        grown *= 2;
+    items = memRealloc(MEM_SAMPLES, items, *capacity * itemSize, grown * itemSize);
+    *capacity = grown;
+    return items;
+}
+
+// Rebuilt twice as large whenever it would get more than half full, from the
+// hashes of the count items it indexes.
+static void growIndex(SAMPLE_INDEX *index, size_t count, uint32_t (*hashOf)(size_t))
+{
+    if (index->slots != NULL && 2 * (count + 1) <= index->mask + 1)
+        return;
+
+    size_t size = index->slots == NULL ? MIN_SAMPLE_ITEMS : 2 * (index->mask + 1);
+    uint32_t *slots = memAlloc(MEM_SAMPLES, size * sizeof(uint32_t));
+    for (size_t item = 0; item < count; item++)
+    {
+        size_t i = hashOf(item) & (size - 1);
+        while (slots[i] != 0)
+            i = (i + 1) & (size - 1);
+        slots[i] = (uint32_t) item + 1;
+    }
+
+    if (index->slots != NULL)
+        memFree(MEM_SAMPLES, index->slots, (index->mask + 1) * sizeof(uint32_t));
+    index->slots = slots;
+    index->mask = size - 1;
+}
+
+static uint32_t labelHash(size_t label)
+{
+    return labels[label].hash;
+}
+
+static uint32_t stackHash(size_t stack)
+{
+    return stacks[stack].hash;
+}
+
+static uint32_t findLabel(SYMBOL_ID name, SOURCE_SPAN span)
+{
+    uint32_t hash = hashValue(hashValue(hashValue(2166136261u, name), span.first), span.last);
+
+    growIndex(&labelIndex, numLabels, labelHash);
+    size_t i = hash & labelIndex.mask;
+    for (; labelIndex.slots[i] != 0; i = (i + 1) & labelIndex.mask)
+    {
+        SAMPLE_LABEL *label = &labels[labelIndex.slots[i] - 1];
+        if (label->hash == hash && label->name == name && label->span.first == span.first &&
+            label->span.last == span.last)
+            return labelIndex.slots[i] - 1;
+    }
+
+    labels = growItems(labels, &labelCapacity, numLabels + 1, sizeof(SAMPLE_LABEL));
+    labels[numLabels] = (SAMPLE_LABEL) {name, span, hash};
+    labelIndex.slots[i] = (uint32_t) ++numLabels;
+    return (uint32_t) numLabels - 1;
+}
+
+void beginSample(void)
+{
+    sampleBase = numStackLabels;
+}
+
+void sampleFrame(SYMBOL_ID name, SOURCE_SPAN span)
+{
+    uint32_t label = findLabel(name, span);
+    stackLabels = growItems(stackLabels, &stackLabelCapacity, numStackLabels + 1, sizeof(uint32_t));
+    stackLabels[numStackLabels++] = label;
+}
+
+void endSample(void)
+{
+    unsigned count = atomic_exchange_explicit(&samplesPending, 0, memory_order_relaxed);
+    size_t depth = numStackLabels - sampleBase;
+    uint32_t *frames = stackLabels + sampleBase;
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < depth; i++)
+        hash = hashValue(hash, frames[i]);
+
+    growIndex(&stackIndex, numStacks, stackHash);
+    size_t i = hash & stackIndex.mask;
+    for (; stackIndex.slots[i] != 0; i = (i + 1) & stackIndex.mask)
+    {
+        SAMPLE_STACK *stack = &stacks[stackIndex.slots[i] - 1];
+        if (stack->hash == hash && stack->depth == depth &&
+            memcmp(stackLabels + stack->labels, frames, depth * sizeof(uint32_t)) == 0)
+        {
+            stack->count += count;
+            numStackLabels = sampleBase;
+            return;
+        }
+    }
+
+    stacks = growItems(stacks, &stackCapacity, numStacks + 1, sizeof(SAMPLE_STACK));
+    stacks[numStacks] = (SAMPLE_STACK) {sampleBase, depth, hash, count};
+    stackIndex.slots[i] = (uint32_t) ++numStacks;
+}
+
+void sampleOutsideEval(void)
+{
+    beginSample();
+    endSample();
+}
+
+// name @line:column text, where the text may not have the ; that separates
+// frames and has no line breaks.
+static void dumpLabel(FILE *out, const SAMPLE_LABEL *label)
+{
+    const char *text;
+    size_t length;
+
+    fputs(symbolName(label->name), out);
+    if (!sourceText(label->span, &text, &length))
+        return;
+
+    size_t line, column;
+    sourcePosition(label->span.first, &line, &column);
+    fprintf(out, " @%zu:%zu ", line, column);
+
+    size_t written = 0;
+    bool space = false;
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = text[i];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            space = true;
+            continue;
+        }
+        if (written + space >= SAMPLE_SNIPPET)
+        {
+            fputs("...", out);
+            return;
+        }
+        if (space)
+            fputc(' ', out);
+        fputc(c == ';' || c < ' ' || c > '~' ? '?' : c, out);
+        written += space + 1;
+        space = false;
+    }
+}
+
+void dumpSamples(FILE *out)
+{
+    for (size_t i = 0; i < numStacks; i++)
+    {
+        SAMPLE_STACK *stack = &stacks[i];
+        if (stack->count == 0)
+            continue;
+
+        if (stack->depth == 0)
+            fputs("[outside eval]", out);
+        for (size_t frame = 0; frame < stack->depth; frame++)
+        {
+            if (frame > 0)
+                fputc(';', out);
+            dumpLabel(out, &labels[stackLabels[stack->labels + frame]]);
+        }
+        fprintf(out, " %llu\n", (unsigned long long) stack->count);
+    }
+}
+
+void writeSamples(void)
+{
+    if (!samplingEnabled || samplePath == NULL)
+        return;
+
+    FILE *out = fopen(samplePath, "w");
+    if (out == NULL)
+        return;
+    dumpSamples(out);
+    fclose(out);
+}
+
+// Safe to call from a signal handler; the dump itself happens in serviceSampleDump.
+void requestSampleDump(void)
+{
+    sampleDumpRequested = 1;
+}
+
+// Called by the driver between top-level expressions.
+void serviceSampleDump(void)
+{
+    if (sampleDumpRequested)
+    {
+        sampleDumpRequested = 0;
+        writeSamples();
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef __cilisp_sampler_h_
+#define __cilisp_sampler_h_
+
+#include "ciLisp.h"
+
+#include <stdatomic.h>
+
+// Optional sampling profiler of the expressions being evaluated, for finding
+// which subexpression of a large script the time goes to.
+//
+// A timer fires every SAMPLE_INTERVAL_US of CPU time, or every tick of the
+// kernel's clock where that is coarser, and its signal handler does nothing
+// but count a sample. eval notices pending samples before it resumes a frame
+// and charges them to the frames on its stack, outermost first; samples
+// noticed while no expression is being evaluated, by eval or by the main loop
+// before each token goes to the parser, are charged to [outside eval]. A
+// sample is therefore charged to whatever runs next, at most one frame later.
+//
+// Each frame is labelled with its operator or function name, then the line,
+// column and text of its node as read by the scanner (see ciLispSource.h),
+// whitespace squeezed and cut short. Nodes without a span, such as the ones
+// loaded from an image, are labelled by name only. The stacks are written as
+// folded stacks, one per line with its count, as flamegraph tools read them:
+//
+//   add @6:1 (add (range int i 0 3000000) (mult i (sq...;mult @6:30 (mult i (sq i));sq @7:5 (sq i) 31
+
+#define SAMPLE_INTERVAL_US 1000
+
+extern bool samplingEnabled;
+extern atomic_uint samplesPending;
+
+// Turns sampling on; the stacks are written to path at exit, and whenever
+// sampleDumpRequested is set (see SIGUSR2 in main). Must be called before
+// any input is read.
+void enableSampling(const char *path);
+
+static inline bool samplePending(void)
+{
+    return atomic_load_explicit(&samplesPending, memory_order_relaxed) != 0;
+}
+
+// Charge the samples pending to a stack, given outermost frame first.
+void beginSample(void);
+void sampleFrame(SYMBOL_ID name, SOURCE_SPAN span);
+void endSample(void);
+
+// Charges the samples pending to [outside eval].
+void sampleOutsideEval(void);
+
+void dumpSamples(FILE *out);
+// Writes the stacks to the file given to enableSampling.
+void writeSamples(void);
+
+void requestSampleDump(void);
+void serviceSampleDump(void);
+
+#endif
@@ -0,0 +1,171 @@
+//CiLisp let section index
+//Small sections are a flat array, large ones an open addressing table.
+
+#include "ciLispScope.h"
+#include "ciLispBudget.h"
+
+#include <string.h>
+
+// Ids are handed out densely, so a multiply and a fold of the high half
+// spread them well enough for linear probing.
+static size_t hashIdent(SYMBOL_ID ident)
+{
+    uint32_t hash = ident * 2654435769u;
+    return hash ^ (hash >> 16);
+}
+
+static SCOPE_INDEX *allocScope(size_t numEntries)
+{
+    size_t size = sizeof(SCOPE_INDEX) + numEntries * sizeof(SCOPE_ENTRY);
+    SCOPE_INDEX *scope = memAlloc(MEM_SCOPE, size);
+    chargeAllocation(size);
+    return scope;
+}
+
+static size_t scopeEntries(const SCOPE_INDEX *scope)
+{
+    return scope->mask != 0 ? scope->mask + 1 : scope->count;
+}
+
+static void insertHashed(SCOPE_INDEX *scope, SYMBOL_ID ident, SYMBOL_TABLE_NODE *binding)
+{
+    size_t i = hashIdent(ident) & scope->mask;
+    while (scope->entries[i].ident != NO_SYMBOL && scope->entries[i].ident != ident)
+        i = (i + 1) & scope->mask;
+    // a later binding of the same name stays shadowed
+    if (scope->entries[i].ident == NO_SYMBOL)
+    {
+        scope->entries[i] = (SCOPE_ENTRY){ident, binding};
+        scope->count++;
+    }
+}
+
+// Moves the entries of scope into a table with room for count names.
+static SCOPE_INDEX *rehashScope(SCOPE_INDEX *scope, size_t count)
+{
+    size_t slots = 2 * SCOPE_INLINE_MAX;
+    while (slots < 2 * count)
+        slots *= 2;
+
+    SCOPE_INDEX *table = allocScope(slots);
+    table->mask = slots - 1;
+    table->count = 0;
+    for (size_t i = 0; i < slots; i++)
+        table->entries[i] = (SCOPE_ENTRY){NO_SYMBOL, NULL};
+
+    if (scope != NULL)
+    {
+        for (size_t i = 0; i < scopeEntries(scope); i++)
+        {
+            if (scope->entries[i].ident != NO_SYMBOL)
+                insertHashed(table, scope->entries[i].ident, scope->entries[i].binding);
+        }
+        freeScopeIndex(scope);
+    }
+    return table;
+}
+
+SCOPE_INDEX *extendScope(SCOPE_INDEX *scope, SYMBOL_TABLE_NODE *symbolTable)
+{
+    size_t added = 0;
+    for (SYMBOL_TABLE_NODE *iter = symbolTable; iter != NULL; iter = iter->next)
+        added++;
+
+    if (added == 0)
+        return scope;
+
+    size_t count = scope == NULL ? 0 : scope->count;
+
+    if ((scope == NULL || scope->mask == 0) && count + added <= SCOPE_INLINE_MAX)
+    {
+        SCOPE_INDEX *array = allocScope(count + added);
+        array->mask = 0;
+        array->count = count;
+        if (scope != NULL)
+        {
+            memcpy(array->entries, scope->entries, count * sizeof(SCOPE_ENTRY));
+            freeScopeIndex(scope);
+        }
+
+        for (SYMBOL_TABLE_NODE *iter = symbolTable; iter != NULL; iter = iter->next)
+        {
+            if (scopeLookup(array, iter->ident) == NULL)
+                array->entries[array->count++] = (SCOPE_ENTRY){iter->ident, iter};
+        }
+
+        // duplicates leave the tail unused
+        if (array->count < count + added)
+            array = memRealloc(MEM_SCOPE, array, sizeof(SCOPE_INDEX) + (count + added) * sizeof(SCOPE_ENTRY),
+                               sizeof(SCOPE_INDEX) + array->count * sizeof(SCOPE_ENTRY));
+        return array;
+    }
+
+    if (scope == NULL || scope->mask == 0 || 2 * (count + added) > scope->mask + 1)
+        scope = rehashScope(scope, count + added);
+
+    for (SYMBOL_TABLE_NODE *iter = symbolTable; iter != NULL; iter = iter->next)
+        insertHashed(scope, iter->ident, iter);
+
+    return scope;
+}
+
+SCOPE_INDEX *indexBindings(SYMBOL_TABLE_NODE *const *bindings, size_t count)
+{
+    if (count == 0)
+        return NULL;
+
+    if (count > SCOPE_INLINE_MAX)
+    {
+        SCOPE_INDEX *table = rehashScope(NULL, count);
+        for (size_t i = 0; i < count; i++)
+            insertHashed(table, bindings[i]->ident, bindings[i]);
+        return table;
+    }
+
+    SCOPE_INDEX *array = allocScope(count);
+    array->mask = 0;
+    array->count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (scopeLookup(array, bindings[i]->ident) == NULL)
+            array->entries[array->count++] = (SCOPE_ENTRY){bindings[i]->ident, bindings[i]};
+    }
+
+    if (array->count < count)
+        array = memRealloc(MEM_SCOPE, array, sizeof(SCOPE_INDEX) + count * sizeof(SCOPE_ENTRY),
+                           sizeof(SCOPE_INDEX) + array->count * sizeof(SCOPE_ENTRY));
+    return array;
+}
+
+SYMBOL_TABLE_NODE *scopeLookup(const SCOPE_INDEX *scope, SYMBOL_ID ident)
+{
+    if (scope == NULL)
+        return NULL;
+
+    if (scope->mask == 0)
+    {
+        for (size_t i = 0; i < scope->count; i++)
+        {
+            if (scope->entries[i].ident == ident)
+                return scope->entries[i].binding;
+        }
+        return NULL;
+    }
+
+    size_t i = hashIdent(ident) & scope->mask;
+    while (scope->entries[i].ident != NO_SYMBOL)
+    {
+        if (scope->entries[i].ident == ident)
+            return scope->entries[i].binding;
+        i = (i + 1) & scope->mask;
+    }
+    return NULL;
+}
+
+void freeScopeIndex(SCOPE_INDEX *scope)
+{
+    if (scope == NULL)
+        return;
+
+    memFree(MEM_SCOPE, scope, sizeof(SCOPE_INDEX) + scopeEntries(scope) * sizeof(SCOPE_ENTRY));
+}
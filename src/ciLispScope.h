@@ -0,0 +1,48 @@
+#ifndef __cilisp_scope_h_
+#define __cilisp_scope_h_
+
+#include "ciLisp.h"
+
+// Lookup index of a let section.
+//
+// The SYMBOL_TABLE_NODE list stays the owner of the bindings and is what
+// everything else walks; setSymbolTable also builds an index over it, which
+// findSymbol searches instead. Sections of up to SCOPE_INLINE_MAX bindings
+// keep their ids in one small array that is scanned in order. Longer ones
+// are an open addressing table on the symbol id, kept at most half full, so
+// a lookup costs the same for 10 bindings or 100k.
+//
+// When a name is bound twice in one section the first binding wins, as it
+// always has with the list. Both forms grow as bindings are added, the table
+// by doubling, so stacking lets on one node stays linear.
+
+#define SCOPE_INLINE_MAX 8
+
+typedef struct {
+    SYMBOL_ID ident;                // NO_SYMBOL marks an empty slot
+    SYMBOL_TABLE_NODE *binding;
+} SCOPE_ENTRY;
+
+typedef struct scope_index {
+    size_t mask;                    // slots - 1 when hashed, 0 for the inline array
+    size_t count;                   // names indexed
+    SCOPE_ENTRY entries[];
+} SCOPE_INDEX;
+
+// Adds the bindings of symbolTable to scope, which is NULL for a new section,
+// and returns the index that replaces it. Names scope already binds keep
+// their binding: a let around a let body is attached to the body's node
+// after the body's own let.
+SCOPE_INDEX *extendScope(SCOPE_INDEX *scope, SYMBOL_TABLE_NODE *symbolTable);
+
+// Index of a section whose bindings are already known to be the visible
+// ones, e.g. read back from an image (see ciLispImage.h). If a name repeats,
+// its first binding wins.
+SCOPE_INDEX *indexBindings(SYMBOL_TABLE_NODE *const *bindings, size_t count);
+
+// Binding of ident in this section only, or NULL.
+SYMBOL_TABLE_NODE *scopeLookup(const SCOPE_INDEX *scope, SYMBOL_ID ident);
+
+void freeScopeIndex(SCOPE_INDEX *scope);
+
+#endif
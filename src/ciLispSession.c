@@ -0,0 +1,379 @@
+//CiLisp session definitions
+//Definitions are indexed by interned id. Each one records the session names
+//its expression reads (deps) and the definitions that read it (dependents),
+//which is all the graph the incremental recomputation needs.
+
+#include "ciLispSession.h"
+#include "ciLispBudget.h"
+#include "ciLispFunction.h"
+#include "ciLispTypes.h"
+#include "ciLispWalk.h"
+
+typedef struct {
+    SYMBOL_ID *ids;
+    size_t count;
+    size_t capacity;
+} ID_LIST;
+
+static SESSION_DEF **sessionDefs = NULL; // indexed by SYMBOL_ID
+static size_t sessionCapacity = 0;
+static size_t recomputeCount = 0;
+static uint64_t walkEpoch = 0;     // bumped by every walk that marks definitions
+
+static void appendId(ID_LIST *list, SYMBOL_ID id)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        list->ids = memRealloc(MEM_SESSION, list->ids, list->capacity * sizeof(SYMBOL_ID),
+                               capacity * sizeof(SYMBOL_ID));
+        list->capacity = capacity;
+    }
+    list->ids[list->count++] = id;
+}
+
+static void freeIds(ID_LIST *list)
+{
+    memFree(MEM_SESSION, list->ids, list->capacity * sizeof(SYMBOL_ID));
+}
+
+// Entry for ident, created empty if this is the first time it is mentioned.
+static SESSION_DEF *sessionSlot(SYMBOL_ID ident)
+{
+    if (ident >= sessionCapacity)
+    {
+        size_t capacity = sessionCapacity == 0 ? 64 : sessionCapacity;
+        while (capacity <= ident)
+            capacity *= 2;
+
+        SESSION_DEF **grown = memRealloc(MEM_SESSION, sessionDefs, sessionCapacity * sizeof(SESSION_DEF *),
+                                         capacity * sizeof(SESSION_DEF *));
+        memset(grown + sessionCapacity, 0, (capacity - sessionCapacity) * sizeof(SESSION_DEF *));
+        sessionDefs = grown;
+        sessionCapacity = capacity;
+    }
+
+    if (sessionDefs[ident] == NULL)
+    {
+        sessionDefs[ident] = memAlloc(MEM_SESSION, sizeof(SESSION_DEF));
+        sessionDefs[ident]->ident = ident;
+    }
+
+    return sessionDefs[ident];
+}
+
+// Appends ident unless the current walk has already seen it.
+static void appendUnmarked(ID_LIST *list, SYMBOL_ID ident)
+{
+    SESSION_DEF *def = sessionSlot(ident);
+    if (def->mark == walkEpoch)
+        return;
+    def->mark = walkEpoch;
+    appendId(list, ident);
+}
+
+SESSION_DEF *findSessionDef(SYMBOL_ID ident)
+{
+    if (ident >= sessionCapacity || sessionDefs[ident] == NULL || sessionDefs[ident]->binding == NULL)
+        return NULL;
+    return sessionDefs[ident];
+}
+
+size_t sessionRecomputeCount(void)
+{
+    return recomputeCount;
+}
+
+void visitSessionDefs(void (*visit)(SESSION_DEF *def))
+{
+    for (size_t ident = 0; ident < sessionCapacity; ident++)
+    {
+        SESSION_DEF *def = sessionDefs[ident];
+        if (def != NULL && (def->binding != NULL || def->numDependents > 0))
+            visit(def);
+    }
+}
+
+// Symbols in node that no let inside the definition binds, i.e. the ones
+// eval will end up looking up in the session. A let's values come before
+// the expression they are attached to.
+static void collectFreeSymbols(AST_NODE *node, ID_LIST *deps)
+{
+    WALK_STACK stack;
+    WALK_ITEM item;
+
+    walkEpoch++;
+    initWalk(&stack);
+    pushWalk(&stack, node, NULL, false);
+    while (popWalk(&stack, &item))
+    {
+        node = item.node;
+        if (!item.expanded && node->symbolTable != NULL)
+        {
+            pushWalk(&stack, node, NULL, true);
+            pushBindings(&stack, node, NULL);
+            continue;
+        }
+
+        switch (node->type)
+        {
+            case FUNC_NODE_TYPE:
+                // so do calls to lambdas no enclosing let binds
+                if (node->data.function.oper == CUSTOM_OPER && findSymbol(node->data.function.ident, node) == NULL)
+                    appendUnmarked(deps, node->data.function.ident);
+                pushOperands(&stack, node, NULL);
+                break;
+            case SYM_NODE_TYPE:
+                if (findSymbol(node->data.symbol.ident, node) == NULL)
+                    appendUnmarked(deps, node->data.symbol.ident);
+                break;
+            default:
+                break;
+        }
+    }
+    endWalk(&stack);
+}
+
+// True if evaluating any of deps would read target's definition.
+static bool readsDefinition(const ID_LIST *deps, SYMBOL_ID target)
+{
+    for (size_t i = 0; i < deps->count; i++)
+    {
+        if (deps->ids[i] == target)
+            return true;
+    }
+
+    // any longer way back to target ends in a definition that reads it
+    SESSION_DEF *targetDef = findSessionDef(target);
+    if (targetDef == NULL || targetDef->numDependents == 0)
+        return false;
+
+    ID_LIST pending = {NULL, 0, 0};
+    walkEpoch++;
+    for (size_t i = 0; i < deps->count; i++)
+        appendUnmarked(&pending, deps->ids[i]);
+
+    bool reads = false;
+    while (!reads && pending.count > 0)
+    {
+        SESSION_DEF *def = findSessionDef(pending.ids[--pending.count]);
+        for (size_t i = 0; def != NULL && i < def->numDeps; i++)
+        {
+            if (def->deps[i] == target)
+            {
+                reads = true;
+                break;
+            }
+            appendUnmarked(&pending, def->deps[i]);
+        }
+    }
+    freeIds(&pending);
+    return reads;
+}
+
+static void addDependent(SESSION_DEF *def, SYMBOL_ID dependent)
+{
+    ID_LIST list = {def->dependents, def->numDependents, def->capDependents};
+    appendId(&list, dependent);
+    def->dependents = list.ids;
+    def->numDependents = list.count;
+    def->capDependents = list.capacity;
+}
+
+static void removeDependent(SESSION_DEF *def, SYMBOL_ID dependent)
+{
+    for (size_t i = 0; i < def->numDependents; i++)
+    {
+        if (def->dependents[i] == dependent)
+        {
+            def->dependents[i] = def->dependents[--def->numDependents];
+            return;
+        }
+    }
+}
+
+// Marks every definition that reads def, directly or not, as stale and
+// collects them depth first, each before the ones that read it, so they can be
+// recomputed afterwards. A definition already stale has been collected.
+static void invalidateDependents(SESSION_DEF *def, ID_LIST *stale)
+{
+    typedef struct {
+        SESSION_DEF *def;
+        size_t next;                // index into def->dependents
+    } PENDING;
+
+    PENDING *pending = NULL;
+    size_t numPending = 0, capPending = 0;
+
+    for (;;)
+    {
+        if (def != NULL)
+        {
+            if (numPending == capPending)
+            {
+                size_t capacity = capPending == 0 ? 16 : capPending * 2;
+                pending = memRealloc(MEM_STACKS, pending, capPending * sizeof(PENDING), capacity * sizeof(PENDING));
+                capPending = capacity;
+            }
+            pending[numPending++] = (PENDING){def, 0};
+        }
+        if (numPending == 0)
+            break;
+
+        PENDING *top = &pending[numPending - 1];
+        if (top->next == top->def->numDependents)
+        {
+            numPending--;
+            def = NULL;
+            continue;
+        }
+
+        def = findSessionDef(top->def->dependents[top->next++]);
+        if (def == NULL || !def->valid)
+        {
+            def = NULL;
+            continue;
+        }
+        def->valid = false;
+        appendId(stale, def->ident);
+    }
+    memFree(MEM_STACKS, pending, capPending * sizeof(PENDING));
+}
+
+RET_VAL sessionValue(SESSION_DEF *def)
+{
+    if (def->valid)
+        return def->value;
+
+    if (def->binding->function != NULL)
+    {
+        def->value = (RET_VAL){INT_TYPE, NAN};
+        def->valid = true;
+        return def->value;
+    }
+
+    if (def->evaluating)
+    {
+        outPrintf("ERROR: circular definition of <%s>\n", symbolName(def->ident));
+        return (RET_VAL){INT_TYPE, NAN};
+    }
+
+    def->evaluating = true;
+    def->value = eval(def->binding->val);
+    def->evaluating = false;
+    def->valid = budgetStatus == BUDGET_OK;
+    recomputeCount++;
+
+    return def->value;
+}
+
+void restoreSessionDef(SYMBOL_ID ident, SYMBOL_TABLE_NODE *binding, RET_VAL value, bool valid,
+                       const SYMBOL_ID *dependents, size_t numDependents)
+{
+    SESSION_DEF *def = sessionSlot(ident);
+
+    if (binding != NULL)
+    {
+        ID_LIST deps = {NULL, 0, 0};
+        collectFreeSymbols(binding->val, &deps);
+
+        NUM_TYPE type;
+        inferTypes(binding->val, binding->function, &type);
+
+        memFree(MEM_SESSION, def->deps, def->capDeps * sizeof(SYMBOL_ID));
+        if (def->binding != NULL)
+            freeSymbolTable(def->binding);
+        def->binding = binding;
+        def->deps = deps.ids;
+        def->numDeps = deps.count;
+        def->capDeps = deps.capacity;
+        def->value = value;
+        def->valid = valid;
+    }
+
+    // as they were rather than as they are read back, so a redefinition
+    // recomputes them in the same order
+    ID_LIST list = {def->dependents, 0, def->capDependents};
+    for (size_t i = 0; i < numDependents; i++)
+        appendId(&list, dependents[i]);
+    def->dependents = list.ids;
+    def->numDependents = list.count;
+    def->capDependents = list.capacity;
+}
+
+void defineSymbol(SYMBOL_TABLE_NODE *binding)
+{
+    SYMBOL_ID ident = binding->ident;
+
+    if (binding->val == NULL)
+    {
+        freeSymbolTable(binding);
+        printRetVal((RET_VAL){INT_TYPE, NAN});
+        return;
+    }
+
+    if (budgetStatus != BUDGET_OK)
+    {
+        outPrintf("ERROR: %s\n", budgetError());
+        freeSymbolTable(binding);
+        printRetVal((RET_VAL){INT_TYPE, NAN});
+        return;
+    }
+
+    ID_LIST deps = {NULL, 0, 0};
+    collectFreeSymbols(binding->val, &deps);
+
+    // a lambda may call itself; only values cannot depend on themselves
+    if (binding->function == NULL && readsDefinition(&deps, ident))
+    {
+        outPrintf("ERROR: circular definition of <%s>\n", symbolName(ident));
+        freeIds(&deps);
+        freeSymbolTable(binding);
+        printRetVal((RET_VAL){INT_TYPE, NAN});
+        return;
+    }
+
+    NUM_TYPE type;
+    inferTypes(binding->val, binding->function, &type);
+
+    // swap in the new expression and rewire the graph
+    SESSION_DEF *def = sessionSlot(ident);
+    for (size_t i = 0; i < def->numDeps; i++)
+        removeDependent(sessionSlot(def->deps[i]), ident);
+    memFree(MEM_SESSION, def->deps, def->capDeps * sizeof(SYMBOL_ID));
+    if (def->binding != NULL)
+        freeSymbolTable(def->binding);
+
+    def->binding = binding;
+    def->deps = deps.ids;
+    def->numDeps = deps.count;
+    def->capDeps = deps.capacity;
+    def->valid = false;
+    for (size_t i = 0; i < deps.count; i++)
+        addDependent(sessionSlot(deps.ids[i]), ident);
+
+    ID_LIST stale = {NULL, 0, 0};
+    invalidateDependents(def, &stale);
+
+    RET_VAL result = sessionValue(def);
+
+    // everything else is reused from the cache
+    size_t before = recomputeCount;
+    for (size_t i = 0; i < stale.count; i++)
+        sessionValue(findSessionDef(stale.ids[i]));
+    if (stale.count > 0)
+        outPrintf("INFO: recomputed %zu dependent definitions\n", recomputeCount - before);
+    freeIds(&stale);
+
+    if (budgetStatus != BUDGET_OK)
+    {
+        outPrintf("ERROR: %s\n", budgetError());
+        printRetVal((RET_VAL){INT_TYPE, NAN});
+        return;
+    }
+
+    if (binding->function != NULL)
+        outPrintf("INFO: defined function <%s>", symbolName(ident));
+    else
+        printRetVal(castToBinding(binding, result));
+}
@@ -0,0 +1,55 @@
+#ifndef __cilisp_session_h_
+#define __cilisp_session_h_
+
+#include <stdint.h>
+
+#include "ciLisp.h"
+
+// Session definitions: (define name s_expr) at the top level.
+// Unlike let bindings they outlive the line they were typed on, and any
+// symbol no enclosing let binds is looked up here. Each definition caches its
+// value; redefining a name re-evaluates only the definitions that depend on
+// it, directly or transitively.
+
+typedef struct session_def {
+    SYMBOL_ID ident;
+    SYMBOL_TABLE_NODE *binding;     // NULL while referenced but not defined
+    RET_VAL value;                  // cached result of eval(binding->val)
+    bool valid;
+    bool evaluating;
+    SYMBOL_ID *deps;                // session names binding->val reads
+    size_t numDeps;
+    size_t capDeps;
+    SYMBOL_ID *dependents;          // definitions whose deps include ident
+    size_t numDependents;
+    size_t capDependents;
+    uint64_t mark;                  // epoch of the last walk that reached it
+} SESSION_DEF;
+
+// Takes ownership of binding. Prints the new value (or, for a lambda, that it
+// was defined), preceded by the number of dependent definitions that had to
+// be recomputed.
+void defineSymbol(SYMBOL_TABLE_NODE *binding);
+
+// The session binding of ident, or NULL if ident is not defined.
+SESSION_DEF *findSessionDef(SYMBOL_ID ident);
+
+// Cached value of a definition, evaluated first if it is stale.
+// Lambdas have no value of their own; they are called (see ciLispFunction.h).
+RET_VAL sessionValue(SESSION_DEF *def);
+
+// Number of definitions re-evaluated since the session started.
+size_t sessionRecomputeCount(void);
+
+// Calls visit on every entry that is defined or read by a definition, in the
+// order of their ids.
+void visitSessionDefs(void (*visit)(SESSION_DEF *def));
+
+// Restores the entry for ident as a snapshot saved it (see ciLispImage.h),
+// without evaluating or printing anything: binding, if not NULL, with value
+// as its cached value if valid, and the definitions that read ident in the
+// order they will be recomputed in. Takes ownership of binding.
+void restoreSessionDef(SYMBOL_ID ident, SYMBOL_TABLE_NODE *binding, RET_VAL value, bool valid,
+                       const SYMBOL_ID *dependents, size_t numDependents);
+
+#endif
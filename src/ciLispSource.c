@@ -0,0 +1,119 @@
+//CiLisp source positions
+//Byte offsets of what the scanner matches, and the input kept to quote it.
+
+#include "ciLispSource.h"
+#include "ciLispMemory.h"
+
+#include <string.h>
+
+#define MIN_SOURCE_SIZE (64 * 1024)
+#define MIN_LINES 1024
+
+static uint64_t scanned = 0;
+
+static bool sourceKept = false;
+static char *source = NULL;
+static size_t sourceLength = 0;
+static size_t sourceCapacity = 0;
+
+// offset each line starts at
+static uint32_t *lineStarts = NULL;
+static size_t numLines = 0;
+static size_t lineCapacity = 0;
+
+static uint32_t clampOffset(uint64_t offset)
+{
+    return offset < UINT32_MAX ? (uint32_t) offset : UINT32_MAX;
+}
+
+SOURCE_SPAN sourceSpan(uint64_t offset, size_t length)
+{
+    SOURCE_SPAN span;
+
+    span.first = clampOffset(offset);
+    span.last = clampOffset(offset + length);
+    return span;
+}
+
+SOURCE_SPAN scanSource(size_t length)
+{
+    SOURCE_SPAN span = sourceSpan(scanned, length);
+    scanned += length;
+    return span;
+}
+
+static void addLine(uint32_t start)
+{
+    if (numLines == lineCapacity)
+    {
+        size_t capacity = lineCapacity == 0 ? MIN_LINES : 2 * lineCapacity;
+        lineStarts = memRealloc(MEM_SAMPLES, lineStarts, lineCapacity * sizeof(uint32_t),
+                                capacity * sizeof(uint32_t));
+        lineCapacity = capacity;
+    }
+    lineStarts[numLines++] = start;
+}
+
+void keepSource(void)
+{
+    if (sourceKept)
+        return;
+
+    sourceKept = true;
+    addLine(0);
+}
+
+void appendSource(const char *text, size_t length)
+{
+    if (!sourceKept)
+        return;
+
+    // nothing past the last offset a span can hold
+    if (length > UINT32_MAX - sourceLength)
+        length = UINT32_MAX - sourceLength;
+
+    if (sourceLength + length > sourceCapacity)
+    {
+        size_t capacity = sourceCapacity == 0 ? MIN_SOURCE_SIZE : sourceCapacity;
+        while (capacity < sourceLength + length)
+            capacity *= 2;
+        source = memRealloc(MEM_SAMPLES, source, sourceCapacity, capacity);
+        sourceCapacity = capacity;
+    }
+
+    memcpy(source + sourceLength, text, length);
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] == '\n')
+            addLine((uint32_t) (sourceLength + i + 1));
+    }
+    sourceLength += length;
+}
+
+bool sourceText(SOURCE_SPAN span, const char **text, size_t *length)
+{
+    if (span.first >= span.last || span.last > sourceLength)
+        return false;
+
+    *text = source + span.first;
+    *length = span.last - span.first;
+    return true;
+}
+
+void sourcePosition(uint32_t offset, size_t *line, size_t *column)
+{
+    // the last line starting at or before offset
+    size_t low = 0;
+    size_t high = numLines;
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (lineStarts[middle] <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    *line = low + 1;
+    *column = offset - (numLines > 0 ? lineStarts[low] : 0) + 1;
+}
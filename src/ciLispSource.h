@@ -0,0 +1,42 @@
+#ifndef __cilisp_source_h_
+#define __cilisp_source_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Where nodes come from in the input.
+//
+// The scanner counts every byte it matches, so each token and, through the
+// parser's locations, each node knows the bytes of stdin it was read from,
+// counted from the start of the session. Nodes built any other way, loaded
+// from an image or made up by the parser, have an empty span. Offsets stop
+// at UINT32_MAX, so anything read after the first 4 GiB has an empty span too.
+//
+// The input itself is only kept when something asks for it (see
+// ciLispSampler.h), for quoting a node's text and finding its line.
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;      // one past the last byte
+} SOURCE_SPAN;
+
+// The span of the next length bytes the scanner matched.
+SOURCE_SPAN scanSource(size_t length);
+
+// The span of length bytes from offset, for a scanner that counts them itself.
+SOURCE_SPAN sourceSpan(uint64_t offset, size_t length);
+
+// Keeps the input from here on; must be called before any of it is read.
+void keepSource(void);
+
+// Adds what was read from stdin, if the input is kept.
+void appendSource(const char *text, size_t length);
+
+// The kept text of span, or false if it is empty or was not kept.
+bool sourceText(SOURCE_SPAN span, const char **text, size_t *length);
+
+// Line and column, both from 1, of a kept offset.
+void sourcePosition(uint32_t offset, size_t *line, size_t *column);
+
+#endif
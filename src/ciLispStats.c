@@ -0,0 +1,329 @@
+//CiLisp live statistics
+//Per-phase latency histograms of the top-level forms and counters, written
+//as JSON with async-signal-safe calls only.
+
+#include "ciLispStats.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+// Most phases in flight: lex or parse, eval or print within it, and input;
+// any deeper are counted but not timed.
+#define STATS_MAX_DEPTH 8
+
+// Room for the dump; the buckets that are not empty are all that can grow it.
+#define STATS_DUMP_SIZE (1 << 18)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} LATENCY_HISTOGRAM;
+
+bool statsEnabled = false;
+
+static const char *phaseNames[STATS_PHASES] = {
+        [LEX_PHASE] = "lex",
+        [PARSE_PHASE] = "parse",
+        [EVAL_PHASE] = "eval",
+        [PRINT_PHASE] = "print",
+};
+
+static LATENCY_HISTOGRAM histograms[STATS_PHASES];
+static uint64_t formNanos[STATS_PHASES];        // of the form being read
+static STATS_PHASE statsStack[STATS_MAX_DEPTH];
+static size_t statsDepth = 0;
+static uint64_t statsLast;                      // when the phase on top was entered or resumed
+static bool formEnded = false;
+
+static uint64_t expressions = 0;
+static uint64_t definitions = 0;
+static uint64_t errors = 0;
+static uint64_t warnings = 0;
+static uint64_t syntaxErrors = 0;
+static uint64_t nanResults = 0;
+
+// the file, and the one the dump is written to before it replaces it
+static const char *statsPath = NULL;
+static char *statsTempPath = NULL;
+static char dump[STATS_DUMP_SIZE];
+static size_t dumpLength;
+
+static uint64_t statsClock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static size_t latencyBucket(uint64_t nanos)
+{
+    if (nanos < (1u << STATS_SUB_BITS))
+        return nanos;
+
+    int shift = 63 - __builtin_clzll(nanos) - STATS_SUB_BITS;
+    return ((size_t) (shift + 1) << STATS_SUB_BITS) + ((nanos >> shift) & ((1u << STATS_SUB_BITS) - 1));
+}
+
+// Smallest value in bucket.
+static uint64_t bucketValue(size_t bucket)
+{
+    if (bucket < (1u << STATS_SUB_BITS))
+        return bucket;
+
+    int shift = (int) (bucket >> STATS_SUB_BITS) - 1;
+    return ((uint64_t) (1u << STATS_SUB_BITS) + (bucket & ((1u << STATS_SUB_BITS) - 1))) << shift;
+}
+
+static void recordLatency(LATENCY_HISTOGRAM *histogram, uint64_t nanos)
+{
+    if (histogram->count == 0 || nanos < histogram->min)
+        histogram->min = nanos;
+    if (nanos > histogram->max)
+        histogram->max = nanos;
+    histogram->total += nanos;
+    histogram->buckets[latencyBucket(nanos)]++;
+    histogram->count++;
+}
+
+static void recordForm(void)
+{
+    for (int phase = 0; phase < STATS_PHASES; phase++)
+    {
+        recordLatency(&histograms[phase], formNanos[phase]);
+        formNanos[phase] = 0;
+    }
+    formEnded = false;
+}
+
+void enableStats(const char *path)
+{
+    if (!statsEnabled)
+        atexit(writeStats);
+
+    free(statsTempPath);
+    statsTempPath = malloc(strlen(path) + sizeof(".tmp"));
+    if (statsTempPath == NULL)
+    {
+        yyerror("Memory allocation failed!");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(statsTempPath, path);
+    strcat(statsTempPath, ".tmp");
+
+    statsEnabled = true;
+    statsPath = path;
+}
+
+// Charges the time since the last transition to the phase on top, so every
+// transition reads the clock once.
+static void statsCharge(void)
+{
+    uint64_t now = statsClock();
+    if (statsDepth > 0 && statsDepth <= STATS_MAX_DEPTH && statsStack[statsDepth - 1] < STATS_PHASES)
+        formNanos[statsStack[statsDepth - 1]] += now - statsLast;
+    statsLast = now;
+}
+
+void statsEnter(STATS_PHASE phase)
+{
+    if (!statsEnabled)
+        return;
+
+    statsCharge();
+    if (statsDepth < STATS_MAX_DEPTH)
+        statsStack[statsDepth] = phase;
+    statsDepth++;
+}
+
+void statsExit(void)
+{
+    if (!statsEnabled || statsDepth == 0)
+        return;
+
+    statsCharge();
+    statsDepth--;
+    if (statsDepth == 0 && formEnded)
+        recordForm();
+}
+
+void statsSwitch(STATS_PHASE phase)
+{
+    if (!statsEnabled || statsDepth == 0)
+        return;
+
+    statsCharge();
+    if (statsDepth <= STATS_MAX_DEPTH)
+        statsStack[statsDepth - 1] = phase;
+    if (statsDepth == 1 && formEnded)
+        recordForm();
+}
+
+void statsEndForm(bool definition)
+{
+    if (!statsEnabled)
+        return;
+
+    if (definition)
+        definitions++;
+    else
+        expressions++;
+
+    // the phase it ended in is still running, unless it ended two
+    if (formEnded)
+        recordForm();
+    formEnded = true;
+    if (statsDepth == 0)
+        recordForm();
+}
+
+void statsCountMessage(const char *text)
+{
+    if (!statsEnabled)
+        return;
+
+    while (*text == '\n')
+        text++;
+    if (strncmp(text, "ERROR", 5) == 0)
+        errors++;
+    else if (strncmp(text, "WARNING", 7) == 0)
+        warnings++;
+}
+
+void statsCountSyntaxError(void)
+{
+    if (statsEnabled)
+        syntaxErrors++;
+}
+
+void statsCountResult(RET_VAL result)
+{
+    if (statsEnabled && isnan(result.value))
+        nanResults++;
+}
+
+/*
+ * Dumping. Nothing below may call stdio or allocate, since it runs in a
+ * signal handler; numbers are formatted by hand into a static buffer.
+ */
+
+static void dumpText(const char *text)
+{
+    size_t length = strlen(text);
+    if (dumpLength + length > sizeof(dump))
+        length = sizeof(dump) - dumpLength;
+    memcpy(dump + dumpLength, text, length);
+    dumpLength += length;
+}
+
+static void dumpNumber(uint64_t value)
+{
+    char digits[21];
+    size_t pos = sizeof(digits) - 1;
+    digits[pos] = '\0';
+    do
+    {
+        digits[--pos] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    dumpText(digits + pos);
+}
+
+static void dumpField(const char *name, uint64_t value)
+{
+    dumpText(", \"");
+    dumpText(name);
+    dumpText("\": ");
+    dumpNumber(value);
+}
+
+// Largest value within the bucket that holds the permille-th value.
+static uint64_t latencyAtPermille(const LATENCY_HISTOGRAM *histogram, uint64_t permille)
+{
+    uint64_t rank = (histogram->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (size_t bucket = 0; bucket < STATS_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank && seen > 0)
+        {
+            uint64_t highest = bucket + 1 < STATS_BUCKETS ? bucketValue(bucket + 1) - 1 : UINT64_MAX;
+            return highest < histogram->max ? highest : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void dumpHistogram(int phase)
+{
+    const LATENCY_HISTOGRAM *histogram = &histograms[phase];
+
+    dumpText(phase == 0 ? "\n  {\"phase\": \"" : ",\n  {\"phase\": \"");
+    dumpText(phaseNames[phase]);
+    dumpText("\"");
+    dumpField("count", histogram->count);
+    dumpField("total", histogram->total);
+    dumpField("min", histogram->min);
+    dumpField("max", histogram->max);
+    dumpField("p50", latencyAtPermille(histogram, 500));
+    dumpField("p90", latencyAtPermille(histogram, 900));
+    dumpField("p99", latencyAtPermille(histogram, 990));
+    dumpField("p999", latencyAtPermille(histogram, 999));
+
+    // [smallest value, count] of every bucket that is not empty
+    dumpText(", \"buckets\": [");
+    bool first = true;
+    for (size_t bucket = 0; bucket < STATS_BUCKETS; bucket++)
+    {
+        if (histogram->buckets[bucket] == 0)
+            continue;
+        dumpText(first ? "[" : ", [");
+        dumpNumber(bucketValue(bucket));
+        dumpText(", ");
+        dumpNumber(histogram->buckets[bucket]);
+        dumpText("]");
+        first = false;
+    }
+    dumpText("]}");
+}
+
+void writeStats(void)
+{
+    if (!statsEnabled)
+        return;
+
+    dumpLength = 0;
+    dumpText("{\"unit\": \"ns\"");
+    dumpField("expressions", expressions);
+    dumpField("definitions", definitions);
+    dumpField("errors", errors);
+    dumpField("warnings", warnings);
+    dumpField("syntax_errors", syntaxErrors);
+    dumpField("nan_results", nanResults);
+    dumpText(", \"phases\": [");
+    for (int phase = 0; phase < STATS_PHASES; phase++)
+        dumpHistogram(phase);
+    dumpText("\n]}\n");
+
+    // written aside and renamed over the file, so a reader never sees half a dump
+    int fd = open(statsTempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    size_t written = 0;
+    while (written < dumpLength)
+    {
+        ssize_t count = write(fd, dump + written, dumpLength - written);
+        if (count <= 0)
+            break;
+        written += count;
+    }
+    close(fd);
+    if (written == dumpLength)
+        rename(statsTempPath, statsPath);
+    else
+        unlink(statsTempPath);
+}
@@ -0,0 +1,69 @@
+#ifndef __cilisp_stats_h_
+#define __cilisp_stats_h_
+
+#include "ciLisp.h"
+
+#include <stdint.h>
+
+// Optional live statistics of the top-level forms, for a process that runs
+// for a long time.
+//
+// Every form's time is split into the phases below, each phase's share of a
+// form going to a latency histogram of its own, and the forms, errors,
+// warnings and NaN results are counted. The statistics are written to a file
+// as JSON at exit and whenever the process receives SIGUSR1. The dump is
+// written from the signal handler with nothing but write(2) and rename(2),
+// so it arrives while a form is still being evaluated, or while input is
+// awaited, and never leaves a half-written file behind. A dump taken in the
+// middle of a form may count it in some fields and not yet in others.
+//
+// The histograms are log-linear, as in HDR histograms: exact below
+// 2^STATS_SUB_BITS nanoseconds, then 2^STATS_SUB_BITS buckets to each power
+// of two, so every value is within 1/2^STATS_SUB_BITS of its bucket.
+
+typedef enum {
+    LEX_PHASE,      // scanning tokens
+    PARSE_PHASE,    // pushing them through the parser, building and freeing trees
+    EVAL_PHASE,     // evaluating an expression, or defining and printing a definition
+    PRINT_PHASE,    // printing an expression's result
+    INPUT_PHASE     // waiting for input, taken out of scanning and not recorded
+} STATS_PHASE;
+
+// phases with a histogram
+#define STATS_PHASES INPUT_PHASE
+
+#define STATS_SUB_BITS 4
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+extern bool statsEnabled;
+
+// Turns the statistics on; they are written to path at exit and by writeStats.
+void enableStats(const char *path);
+
+// Bracket the time spent in a phase; phases entered in between are taken out
+// of it, as eval and print run inside the parser's actions.
+void statsEnter(STATS_PHASE phase);
+void statsExit(void);
+
+// Leaves the phase entered last for another, reading the clock once, as the
+// main loop does for every token.
+void statsSwitch(STATS_PHASE phase);
+
+// Ends the current top-level form: its time in each phase goes to the
+// phase's histogram, once the phase it ended in is left or switched from.
+void statsEndForm(bool definition);
+
+// Counts an ERROR or WARNING message, given its text or format.
+void statsCountMessage(const char *text);
+
+// Counts a form the parser could not read (see error in ciLisp.y).
+void statsCountSyntaxError(void);
+
+// Counts a printed result.
+void statsCountResult(RET_VAL result);
+
+// Writes the statistics to the file given to enableStats. Safe to call from
+// a signal handler.
+void writeStats(void);
+
+#endif
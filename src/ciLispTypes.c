@@ -0,0 +1,190 @@
+//CiLisp static type inference
+//Decides result types from literals and declarations before anything is
+//evaluated.
+
+#include "ciLispTypes.h"
+#include "ciLispRange.h"
+#include "ciLispWalk.h"
+
+// Type of node as far as it is known: literals, parameters and let-bound
+// values by declaration, calls by what inferCall recorded on them.
+static bool knownType(AST_NODE *node, FUNC_DEF *enclosing, NUM_TYPE *type)
+{
+    if (node == NULL)
+        return false;
+
+    switch (node->type)
+    {
+        case NUM_NODE_TYPE:
+            *type = node->data.number.type;
+            return true;
+        case ARG_NODE_TYPE:
+            // arguments are cast to the parameter type on the way in
+            if (enclosing == NULL || node->data.arg.slot >= enclosing->numParams)
+                return false;
+            *type = enclosing->params[node->data.arg.slot].val_type;
+            return true;
+        case SYM_NODE_TYPE:
+        {
+            // and let-bound values to the binding type
+            SYMBOL_TABLE_NODE *binding = findSymbol(node->data.symbol.ident, node);
+            if (binding == NULL || binding->function != NULL)
+                return false;
+            *type = binding->val_type;
+            return true;
+        }
+        case FUNC_NODE_TYPE:
+            if (!node->data.function.typed)
+                return false;
+            *type = node->data.function.staticType;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Looks at every operand of funcNode, which inferTypes has already been
+// through, and counts the leading INT ones.
+// The types of the first three operands go to opTypes (cond needs them).
+static bool inferOperands(FUNC_AST_NODE *funcNode, FUNC_DEF *enclosing, int *numOps, bool *anyDouble,
+                          NUM_TYPE opTypes[3])
+{
+    bool known = true;
+    bool leading = true;
+
+    *numOps = 0;
+    *anyDouble = false;
+    funcNode->intOperands = 0;
+
+    for (int i = 0; i < funcNode->numOps; i++)
+    {
+        NUM_TYPE opType = INT_TYPE;
+        (*numOps)++;
+        if (!knownType(funcNode->ops[i], enclosing, &opType))
+        {
+            known = false;
+            continue;
+        }
+        if (*numOps <= 3)
+            opTypes[*numOps - 1] = opType;
+        if (opType == DOUBLE_TYPE)
+        {
+            *anyDouble = true;
+            leading = false;
+        }
+        else if (leading)
+        {
+            funcNode->intOperands++;
+        }
+    }
+
+    return known;
+}
+
+// A range has the type its reducer gives elements of the element's type.
+static bool inferRange(AST_NODE *node, FUNC_DEF *enclosing, NUM_TYPE *type)
+{
+    FUNC_AST_NODE *funcNode = &node->data.function;
+    const OPER_DESC *desc = &operTable[resolveFunc(funcNode->ident)];
+    NUM_TYPE elementType;
+
+    funcNode->typed = false;
+    if ((desc->shape != FOLD_SHAPE && desc->shape != REDUCE_SHAPE) ||
+        !knownType(rangeElement(funcNode), enclosing, &elementType))
+        return false;
+
+    *type = promoteType(desc, elementType, elementType);
+    funcNode->typed = true;
+    funcNode->staticType = *type;
+    return true;
+}
+
+static bool inferCall(AST_NODE *node, FUNC_DEF *enclosing, NUM_TYPE *type)
+{
+    FUNC_AST_NODE *funcNode = &node->data.function;
+    int numOps;
+    bool anyDouble;
+    NUM_TYPE opTypes[3];
+
+    if (funcNode->oper == RANGE_OPER)
+        return inferRange(node, enclosing, type);
+
+    funcNode->typed = false;
+    if (!inferOperands(funcNode, enclosing, &numOps, &anyDouble, opTypes))
+        return false;
+
+    if (funcNode->oper == CUSTOM_OPER)
+    {
+        // only a let-bound lambda is certain to be the one called
+        SYMBOL_TABLE_NODE *binding = findSymbol(funcNode->ident, node);
+        if (binding == NULL || binding->function == NULL || numOps != (int) binding->function->numParams)
+            return false;
+        *type = binding->val_type;
+        funcNode->typed = true;
+        funcNode->staticType = *type;
+        return true;
+    }
+
+    // calls that get an arity message keep the dynamic path, which prints it
+    const OPER_DESC *desc = &operTable[funcNode->oper];
+    if (numOps < desc->minOps || (desc->maxOps != ANY_OPS && numOps > desc->maxOps))
+        return false;
+
+    switch (desc->shape)
+    {
+        case UNARY_SHAPE:
+        case FOLD_SHAPE:
+        case REDUCE_SHAPE:
+            *type = anyDouble ? DOUBLE_TYPE : INT_TYPE;
+            break;
+        case BINARY_SHAPE:
+            *type = promoteType(desc, opTypes[0], opTypes[1]);
+            funcNode->kernel = desc->kernels[opTypes[0]][opTypes[1]];
+            break;
+        case COND_SHAPE:
+            // both branches must agree, whichever the test picks
+            if (opTypes[1] != opTypes[2])
+                return false;
+            *type = opTypes[1];
+            break;
+        case SOURCE_SHAPE:
+            if (desc->promotion != ALWAYS_DOUBLE)
+                return false;
+            *type = DOUBLE_TYPE;
+            break;
+        default:
+            return false;
+    }
+
+    funcNode->typed = true;
+    funcNode->staticType = *type;
+    return true;
+}
+
+// Calls are annotated after their operands and let-bound values, like the
+// recursion this walk replaces.
+bool inferTypes(AST_NODE *node, FUNC_DEF *enclosing, NUM_TYPE *type)
+{
+    WALK_STACK stack;
+    WALK_ITEM item;
+    NUM_TYPE callType;
+
+    initWalk(&stack);
+    pushWalk(&stack, node, enclosing, false);
+    while (popWalk(&stack, &item))
+    {
+        if (item.expanded)
+        {
+            inferCall(item.node, item.enclosing, &callType);
+            continue;
+        }
+
+        if (item.node->type == FUNC_NODE_TYPE)
+            pushWalk(&stack, item.node, item.enclosing, true);
+        pushOperands(&stack, item.node, item.enclosing);
+        pushBindings(&stack, item.node, item.enclosing);
+    }
+    endWalk(&stack);
+
+    return knownType(node, enclosing, type);
+}
@@ -0,0 +1,30 @@
+#ifndef __cilisp_types_h_
+#define __cilisp_types_h_
+
+#include "ciLisp.h"
+#include "ciLispFunction.h"
+#include "ciLispOperators.h"
+
+// Static type inference.
+//
+// Literals, int/double annotations on let bindings and lambda parameters,
+// and the promotion rules in operTable (see ciLispOperators.h) fix the
+// result type of most calls before anything is evaluated. inferTypes records
+// that type on every call it can decide, together with the kernel those
+// types select, and eval then computes the call without looking at
+// RET_VAL.type (see ciLispEval.c).
+//
+// Inference gives up (and the call keeps the dynamic checks) on
+//   - names defined with define, since they can be redefined with another type,
+//   - calls with the wrong number of operands, so the usual messages are printed,
+//   - print and read, and any call that has them as an operand.
+//
+// rand is always a DOUBLE, so it is typed like a literal; fused ranges rely
+// on that to compute an element with rand a block at a time.
+
+// Annotates node and everything under it, including let-bound values and
+// lambda bodies. enclosing is the lambda whose body node is part of, if any.
+// Returns whether node's type is known and, if so, stores it in type.
+bool inferTypes(AST_NODE *node, FUNC_DEF *enclosing, NUM_TYPE *type);
+
+#endif
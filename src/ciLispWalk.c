@@ -0,0 +1,96 @@
+//CiLisp tree walks
+//A growable stack of nodes to visit, starting out in place.
+
+#include "ciLispWalk.h"
+
+// The largest stack a finished walk has given back. Passes run one after the
+// other over the same tree, so the next walk starts from it instead of
+// growing and faulting in a new one.
+static WALK_ITEM *spareItems = NULL;
+static size_t spareCapacity = 0;
+
+void initWalk(WALK_STACK *stack)
+{
+    stack->items = stack->inlineItems;
+    stack->count = 0;
+    stack->capacity = WALK_INLINE_ITEMS;
+}
+
+void endWalk(WALK_STACK *stack)
+{
+    if (stack->items != stack->inlineItems)
+    {
+        if (stack->capacity > spareCapacity)
+        {
+            memFree(MEM_STACKS, spareItems, spareCapacity * sizeof(WALK_ITEM));
+            spareItems = stack->items;
+            spareCapacity = stack->capacity;
+        }
+        else
+        {
+            memFree(MEM_STACKS, stack->items, stack->capacity * sizeof(WALK_ITEM));
+        }
+    }
+    initWalk(stack);
+}
+
+void pushWalk(WALK_STACK *stack, AST_NODE *node, struct function_def *enclosing, bool expanded)
+{
+    if (node == NULL)
+        return;
+
+    if (stack->count == stack->capacity)
+    {
+        WALK_ITEM *items;
+        size_t capacity;
+        if (stack->items == stack->inlineItems && spareItems != NULL)
+        {
+            // a walk nested in another one finds no spare and allocates
+            items = spareItems;
+            capacity = spareCapacity;
+            spareItems = NULL;
+            spareCapacity = 0;
+        }
+        else
+        {
+            capacity = 2 * stack->capacity;
+            items = memAlloc(MEM_STACKS, capacity * sizeof(WALK_ITEM));
+        }
+        memcpy(items, stack->items, stack->count * sizeof(WALK_ITEM));
+        if (stack->items != stack->inlineItems)
+            memFree(MEM_STACKS, stack->items, stack->capacity * sizeof(WALK_ITEM));
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+
+    stack->items[stack->count++] = (WALK_ITEM){node, enclosing, expanded};
+}
+
+// Reverses what was pushed since from, so it pops in the order it was pushed.
+static void reverseFrom(WALK_STACK *stack, size_t from)
+{
+    for (size_t i = from, j = stack->count; i + 1 < j; i++, j--)
+    {
+        WALK_ITEM item = stack->items[i];
+        stack->items[i] = stack->items[j - 1];
+        stack->items[j - 1] = item;
+    }
+}
+
+void pushBindings(WALK_STACK *stack, AST_NODE *node, struct function_def *enclosing)
+{
+    size_t from = stack->count;
+
+    for (SYMBOL_TABLE_NODE *iter = node->symbolTable; iter != NULL; iter = iter->next)
+        pushWalk(stack, iter->val, iter->function != NULL ? iter->function : enclosing, false);
+    reverseFrom(stack, from);
+}
+
+void pushOperands(WALK_STACK *stack, AST_NODE *node, struct function_def *enclosing)
+{
+    if (node->type != FUNC_NODE_TYPE)
+        return;
+
+    for (int i = node->data.function.numOps - 1; i >= 0; i--)
+        pushWalk(stack, node->data.function.ops[i], enclosing, false);
+}
@@ -0,0 +1,52 @@
+#ifndef __cilisp_walk_h_
+#define __cilisp_walk_h_
+
+#include "ciLisp.h"
+
+// Explicit stack for passes over an AST, so that typing, inlining and
+// freeing a tree take no native stack however deep it is nested.
+//
+// An item is a node still to be visited and the lambda whose body it is part
+// of, if any. Children are pushed in reverse so they are visited in source
+// order. A pass that has to see a node again after its children pushes it
+// back first, marked expanded, underneath them.
+//
+// The first WALK_INLINE_ITEMS items are held in the WALK_STACK itself, so a
+// walk over a shallow tree does not allocate.
+
+#define WALK_INLINE_ITEMS 32
+
+typedef struct {
+    AST_NODE *node;
+    struct function_def *enclosing;
+    bool expanded;
+} WALK_ITEM;
+
+typedef struct {
+    WALK_ITEM *items;
+    size_t count;
+    size_t capacity;
+    WALK_ITEM inlineItems[WALK_INLINE_ITEMS];
+} WALK_STACK;
+
+void initWalk(WALK_STACK *stack);
+void endWalk(WALK_STACK *stack);
+
+// NULL nodes are not pushed.
+void pushWalk(WALK_STACK *stack, AST_NODE *node, struct function_def *enclosing, bool expanded);
+
+// The values node's let section binds; the body of a lambda is enclosed by the lambda.
+void pushBindings(WALK_STACK *stack, AST_NODE *node, struct function_def *enclosing);
+
+// The operands of a FUNC node.
+void pushOperands(WALK_STACK *stack, AST_NODE *node, struct function_def *enclosing);
+
+static inline bool popWalk(WALK_STACK *stack, WALK_ITEM *item)
+{
+    if (stack->count == 0)
+        return false;
+    *item = stack->items[--stack->count];
+    return true;
+}
+
+#endif
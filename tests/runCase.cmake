@@ -0,0 +1,42 @@
+# Pipes CASE.cil into CILISP, run with OPTIONS (a ;-list), and fails unless it
+# exits normally and prints exactly EXPECTED, by default CASE.out. If there is
+# a CASE.before.cil, it is piped into CILISP with BEFORE_OPTIONS first, e.g. to
+# write an image the case loads; that run must exit normally too, but what it
+# prints is not checked.
+#
+#    cmake -DCILISP=... -DCASE=.../cases/NAME [-DEXPECTED=...] [-DOPTIONS=...] [-DBEFORE_OPTIONS=...]
+#          -P runCase.cmake
+
+if (NOT DEFINED EXPECTED)
+    set(EXPECTED ${CASE}.out)
+endif ()
+
+if (EXISTS ${CASE}.before.cil)
+    execute_process(
+            COMMAND ${CILISP} ${BEFORE_OPTIONS}
+            INPUT_FILE ${CASE}.before.cil
+            OUTPUT_QUIET
+            ERROR_QUIET
+            RESULT_VARIABLE result
+    )
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "cilisp exited with ${result} on ${CASE}.before.cil")
+    endif ()
+endif ()
+
+execute_process(
+        COMMAND ${CILISP} ${OPTIONS}
+        INPUT_FILE ${CASE}.cil
+        OUTPUT_VARIABLE output
+        ERROR_QUIET
+        RESULT_VARIABLE result
+)
+
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "cilisp exited with ${result}")
+endif ()
+
+file(READ ${EXPECTED} expected)
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "expected:\n${expected}\ngot:\n${output}")
+endif ()
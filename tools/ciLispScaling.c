@@ -0,0 +1,285 @@
+//CiLisp scaling check
+//Pipes a cilisp_workload family into cilisp at growing sizes, fits how the
+//CPU time and peak memory of cilisp grow with the size, and fails if either
+//grows faster than the family allows:
+//
+//    cilisp_scaling CILISP WORKLOAD FAMILY
+//
+//Each size is measured over and above the family's base size, so the fixed
+//cost of starting cilisp does not flatten the curve, except for a family
+//whose whole cost should hardly grow. Given a size and limits,
+//it instead runs that size once and fails if it takes more CPU time or peak
+//memory than that:
+//
+//    cilisp_scaling CILISP WORKLOAD FAMILY SIZE SECONDS MIB
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_SIZES 8
+#define RUNS 3              // of each size, the least time and memory are kept
+
+// Smaller differences from the base size are noise and left out of the fit.
+#define MIN_SECONDS 0.02
+#define MIN_KILOBYTES 2048.0
+
+typedef enum {
+    POWER_GROWTH,           // cost ~ SIZE^exponent
+    EXPONENTIAL_GROWTH,     // cost ~ 2^(exponent * SIZE)
+    TOTAL_GROWTH,           // like POWER_GROWTH, base included, for a cost that should hardly grow
+    NO_GROWTH               // not checked
+} GROWTH;
+
+typedef struct {
+    GROWTH growth;
+    double maxExponent;
+} LIMIT;
+
+typedef struct {
+    const char *family;
+    size_t count;                   // expressions per run
+    size_t base;
+    size_t sizes[MAX_SIZES];        // ascending, 0 after the last
+    LIMIT time;
+    LIMIT memory;
+} SCALING;
+
+typedef struct {
+    double seconds;
+    double kilobytes;
+} COST;
+
+// Linear families may fit up to 1.3 before they count as superlinear; letdeps
+// doubles with each binding, and its memory is too small to measure. lookups
+// crosses SCOPE_INLINE_MAX, and its time is mostly the same 200000 lookups
+// whatever the size. The sizes keep the largest run of each family around a
+// second in a Debug build.
+static const SCALING scalings[] = {
+        {"width", 1, 0, {250000, 500000, 1000000, 2000000}, {POWER_GROWTH, 1.3}, {POWER_GROWTH, 1.3}},
+        {"depth", 400, 0, {375, 750, 1500, 3000}, {POWER_GROWTH, 1.3}, {NO_GROWTH, 0}},
+        {"letwide", 1, 0, {50000, 100000, 200000, 400000}, {POWER_GROWTH, 1.3}, {POWER_GROWTH, 1.3}},
+        {"letchain", 1, 0, {25000, 50000, 100000, 200000}, {POWER_GROWTH, 1.3}, {POWER_GROWTH, 1.3}},
+        {"letdeps", 1, 1, {16, 18, 20, 22}, {EXPONENTIAL_GROWTH, 1.2}, {NO_GROWTH, 0}},
+        {"repeat", 1, 0, {25000, 50000, 100000, 200000}, {POWER_GROWTH, 1.3}, {POWER_GROWTH, 1.3}},
+        {"names", 1, 1, {400000, 800000, 1600000, 3200000}, {POWER_GROWTH, 1.3}, {POWER_GROWTH, 1.3}},
+        {"lookups", 1, 1, {8, 9, 100, 1000, 10000, 100000}, {TOTAL_GROWTH, 0.25}, {NO_GROWTH, 0}},
+        {"defines", 1, 0, {25000, 50000, 100000, 200000}, {POWER_GROWTH, 1.3}, {POWER_GROWTH, 1.3}},
+};
+
+#define NUM_SCALINGS (sizeof(scalings) / sizeof(scalings[0]))
+
+static void usage(const char *program)
+{
+    printf("usage: %s CILISP WORKLOAD FAMILY [SIZE SECONDS MIB]\n", program);
+    for (size_t i = 0; i < NUM_SCALINGS; i++)
+        printf("    %s\n", scalings[i].family);
+    exit(EXIT_FAILURE);
+}
+
+static void redirect(int fd, int to)
+{
+    if (dup2(to, fd) < 0)
+        _exit(127);
+    close(to);
+}
+
+// Runs workload | cilisp once, and returns false if either fails.
+static bool runOnce(const char *cilisp, const char *workload, const SCALING *scaling, size_t size, COST *cost)
+{
+    char sizeArg[32], countArg[32];
+    snprintf(sizeArg, sizeof(sizeArg), "%zu", size);
+    snprintf(countArg, sizeof(countArg), "%zu", scaling->count);
+
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0)
+    {
+        perror("pipe");
+        return false;
+    }
+
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        close(pipeFds[0]);
+        redirect(STDOUT_FILENO, pipeFds[1]);
+        execl(workload, workload, scaling->family, sizeArg, countArg, (char *) NULL);
+        _exit(127);
+    }
+
+    pid_t reader = fork();
+    if (reader == 0)
+    {
+        close(pipeFds[1]);
+        redirect(STDIN_FILENO, pipeFds[0]);
+        redirect(STDOUT_FILENO, open("/dev/null", O_WRONLY));
+        redirect(STDERR_FILENO, open("/dev/null", O_WRONLY));
+        execl(cilisp, cilisp, (char *) NULL);
+        _exit(127);
+    }
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    if (writer < 0 || reader < 0)
+    {
+        perror("fork");
+        return false;
+    }
+
+    int readerStatus, writerStatus;
+    struct rusage usage;
+    wait4(reader, &readerStatus, 0, &usage);
+    waitpid(writer, &writerStatus, 0);
+
+    if (!WIFEXITED(readerStatus) || WEXITSTATUS(readerStatus) != 0 || !WIFEXITED(writerStatus) ||
+        WEXITSTATUS(writerStatus) != 0)
+    {
+        printf("%s %s %zu | %s failed\n", workload, scaling->family, size, cilisp);
+        return false;
+    }
+
+    cost->seconds = (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+                    (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    cost->kilobytes = (double) usage.ru_maxrss;
+    return true;
+}
+
+static bool measure(const char *cilisp, const char *workload, const SCALING *scaling, size_t size, COST *cost)
+{
+    for (int run = 0; run < RUNS; run++)
+    {
+        COST once;
+        if (!runOnce(cilisp, workload, scaling, size, &once))
+            return false;
+        if (run == 0 || once.seconds < cost->seconds)
+            cost->seconds = once.seconds;
+        if (run == 0 || once.kilobytes < cost->kilobytes)
+            cost->kilobytes = once.kilobytes;
+    }
+    return true;
+}
+
+// Least squares slope of log(cost) over log(size), or over size in base 2 for
+// EXPONENTIAL_GROWTH, of the costs of at least minCost. Returns false if
+// fewer than two sizes are left to fit.
+static bool fitExponent(GROWTH growth, const size_t *sizes, const double *costs, int numSizes, double minCost,
+                        double *exponent)
+{
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    int n = 0;
+
+    for (int i = 0; i < numSizes; i++)
+    {
+        if (costs[i] < minCost)
+            continue;
+        double x = growth == EXPONENTIAL_GROWTH ? (double) sizes[i] * log(2.0) : log((double) sizes[i]);
+        double y = log(costs[i]);
+        sumX += x;
+        sumY += y;
+        sumXX += x * x;
+        sumXY += x * y;
+        n++;
+    }
+    if (n < 2)
+        return false;
+
+    *exponent = (n * sumXY - sumX * sumY) / (n * sumXX - sumX * sumX);
+    return true;
+}
+
+// Reports how the costs grow, over base unless the growth is TOTAL_GROWTH;
+// false if they grow too fast or cannot be fitted.
+static bool checkGrowth(const char *what, LIMIT limit, const size_t *sizes, const double *costs, int numSizes,
+                        double base, double minCost)
+{
+    if (limit.growth == NO_GROWTH)
+        return true;
+
+    double over[MAX_SIZES];
+    for (int i = 0; i < numSizes; i++)
+        over[i] = limit.growth == TOTAL_GROWTH ? costs[i] : costs[i] - base;
+
+    double exponent;
+    if (!fitExponent(limit.growth, sizes, over, numSizes, minCost, &exponent))
+    {
+        printf("%s: too small to fit, the sizes need to be larger\n", what);
+        return false;
+    }
+
+    bool ok = exponent <= limit.maxExponent;
+    if (limit.growth == EXPONENTIAL_GROWTH)
+        printf("%s grows as 2^(%.2f SIZE), at most 2^(%.2f SIZE)", what, exponent, limit.maxExponent);
+    else
+        printf("%s grows as SIZE^%.2f, at most SIZE^%.2f", what, exponent, limit.maxExponent);
+    printf(ok ? "\n" : ": TOO FAST\n");
+    return ok;
+}
+
+static int checkScaling(const char *cilisp, const char *workload, const SCALING *scaling)
+{
+    COST base;
+    if (!measure(cilisp, workload, scaling, scaling->base, &base))
+        return EXIT_FAILURE;
+    printf("%10s %10s %10s\n", "size", "seconds", "MiB");
+    printf("%10zu %10.3f %10.1f\n", scaling->base, base.seconds, base.kilobytes / 1024);
+
+    double seconds[MAX_SIZES], kilobytes[MAX_SIZES];
+    int numSizes = 0;
+    while (numSizes < MAX_SIZES && scaling->sizes[numSizes] != 0)
+    {
+        COST cost;
+        if (!measure(cilisp, workload, scaling, scaling->sizes[numSizes], &cost))
+            return EXIT_FAILURE;
+        printf("%10zu %10.3f %10.1f\n", scaling->sizes[numSizes], cost.seconds, cost.kilobytes / 1024);
+        seconds[numSizes] = cost.seconds;
+        kilobytes[numSizes] = cost.kilobytes;
+        numSizes++;
+    }
+
+    bool ok = checkGrowth("time", scaling->time, scaling->sizes, seconds, numSizes, base.seconds, MIN_SECONDS);
+    ok &= checkGrowth("memory", scaling->memory, scaling->sizes, kilobytes, numSizes, base.kilobytes, MIN_KILOBYTES);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// One run of a single size, which must stay within maxSeconds of CPU time and
+// maxMiB of peak memory.
+static int checkLimits(const char *cilisp, const char *workload, const char *family, size_t size, double maxSeconds,
+                       double maxMiB)
+{
+    SCALING single = {family, 1};
+    COST cost;
+
+    if (!runOnce(cilisp, workload, &single, size, &cost))
+        return EXIT_FAILURE;
+
+    double mib = cost.kilobytes / 1024;
+    bool ok = cost.seconds <= maxSeconds && mib <= maxMiB;
+    printf("%s %zu took %.3f s (at most %.3f) and %.1f MiB (at most %.1f)%s\n", family, size, cost.seconds,
+           maxSeconds, mib, maxMiB, ok ? "" : ": TOO MUCH");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 7)
+        return checkLimits(argv[1], argv[2], argv[3], strtoull(argv[4], NULL, 10), atof(argv[5]), atof(argv[6]));
+    if (argc != 4)
+        usage(argv[0]);
+
+    const SCALING *scaling = NULL;
+    for (size_t i = 0; i < NUM_SCALINGS; i++)
+    {
+        if (strcmp(argv[3], scalings[i].family) == 0)
+            scaling = &scalings[i];
+    }
+    if (scaling == NULL)
+        usage(argv[0]);
+
+    return checkScaling(argv[1], argv[2], scaling);
+}
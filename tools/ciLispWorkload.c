@@ -0,0 +1,234 @@
+//CiLisp workload generator
+//Writes inputs that stress one dimension of the interpreter at a chosen size,
+//for timing and memory scaling runs:
+//
+//    cilisp_workload FAMILY SIZE [COUNT] | cilisp
+//
+//Each family is one top-level expression, or for defines one session, written
+//COUNT times (default 1).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOOKUP_REFERENCES 200000
+
+typedef void (*WRITE_WORKLOAD)(FILE *out, size_t size);
+
+typedef struct {
+    const char *name;
+    const char *description;
+    WRITE_WORKLOAD write;
+} WORKLOAD;
+
+// Symbols are letters only. The leading v keeps them clear of every keyword
+// and function name; the index is written in base 26, padded to length.
+static void writeName(FILE *out, size_t index, size_t length)
+{
+    char digits[64];
+    size_t numDigits = 0;
+
+    do
+    {
+        digits[numDigits++] = (char) ('a' + index % 26);
+        index /= 26;
+    } while (index > 0);
+
+    fputc('v', out);
+    for (size_t i = numDigits + 1; i < length; i++)
+        fputc('a', out);
+    while (numDigits > 0)
+        fputc(digits[--numDigits], out);
+}
+
+// (add 1 1 ... 1)
+static void writeWidth(FILE *out, size_t size)
+{
+    fputs("(add", out);
+    for (size_t i = 0; i < size; i++)
+        fputs(" 1", out);
+    fputc(')', out);
+}
+
+// (add 1 (add 1 ... (add 1 1)))
+static void writeDepth(FILE *out, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        fputs("(add 1 ", out);
+    fputc('1', out);
+    for (size_t i = 0; i < size; i++)
+        fputc(')', out);
+}
+
+// ((let (va 0) (vb 1) ...) (add vlast 1))
+static void writeLetWide(FILE *out, size_t size)
+{
+    fputs("((let", out);
+    for (size_t i = 0; i < size; i++)
+    {
+        fputs(" (int ", out);
+        writeName(out, i, 0);
+        fprintf(out, " %zu)", i % 7);
+    }
+    fputs(") (add ", out);
+    writeName(out, size == 0 ? 0 : size - 1, 0);
+    fputs(" 1))", out);
+}
+
+// ((let (va 1)) ((let (vb (add va 1))) ... vlast)), one scope per binding
+static void writeLetChain(FILE *out, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        fputs("((let (int ", out);
+        writeName(out, i, 0);
+        if (i == 0)
+        {
+            fputs(" 1)) ", out);
+            continue;
+        }
+        fputs(" (add ", out);
+        writeName(out, i - 1, 0);
+        fputs(" 1))) ", out);
+    }
+    if (size == 0)
+        fputc('0', out);
+    else
+        writeName(out, size - 1, 0);
+    for (size_t i = 0; i < size; i++)
+        fputc(')', out);
+}
+
+// ((let (va 1) (vb (add va va)) (vc (add vb vb)) ...) vlast): every binding
+// reads the one before it twice
+static void writeLetDeps(FILE *out, size_t size)
+{
+    fputs("((let (int va 1)", out);
+    for (size_t i = 1; i < size; i++)
+    {
+        fputs(" (int ", out);
+        writeName(out, i, 0);
+        fputs(" (add ", out);
+        writeName(out, i - 1, 0);
+        fputc(' ', out);
+        writeName(out, i - 1, 0);
+        fputs("))", out);
+    }
+    fputs(") ", out);
+    writeName(out, size == 0 ? 0 : size - 1, 0);
+    fputc(')', out);
+}
+
+// (add S S ... S) with the same small subtree S as every operand
+static void writeRepeat(FILE *out, size_t size)
+{
+    fputs("(add", out);
+    for (size_t i = 0; i < size; i++)
+        fputs(" (mult (sub 3 1) (max 2 1.5))", out);
+    fputc(')', out);
+}
+
+// 16 bindings whose names are size letters long, all added up
+static void writeNames(FILE *out, size_t size)
+{
+    fputs("((let", out);
+    for (size_t i = 0; i < 16; i++)
+    {
+        fputs(" (", out);
+        writeName(out, i, size);
+        fprintf(out, " %zu)", i);
+    }
+    fputs(") (add", out);
+    for (size_t i = 0; i < 16; i++)
+    {
+        fputc(' ', out);
+        writeName(out, i, size);
+    }
+    fputs("))", out);
+}
+
+// ((let (va 0) ... (vlast 0)) (add vlast vlast ...)): SIZE bindings read
+// LOOKUP_REFERENCES times, always the last one, the slowest to look up in a
+// list of the bindings
+static void writeLookups(FILE *out, size_t size)
+{
+    fputs("((let", out);
+    for (size_t i = 0; i < size; i++)
+    {
+        fputs(" (int ", out);
+        writeName(out, i, 0);
+        fputs(" 0)", out);
+    }
+    fputs(") (add", out);
+    for (size_t i = 0; i < LOOKUP_REFERENCES; i++)
+    {
+        fputc(' ', out);
+        writeName(out, size == 0 ? 0 : size - 1, 0);
+    }
+    fputs("))", out);
+}
+
+// (define va 1) (define vb (add va 1)) ... one line each, then va redefined
+// to read vlast, which is circular, and to 2, which recomputes the chain
+static void writeDefines(FILE *out, size_t size)
+{
+    fputs("(define va 1)\n", out);
+    for (size_t i = 1; i < size; i++)
+    {
+        fputs("(define ", out);
+        writeName(out, i, 0);
+        fputs(" (add ", out);
+        writeName(out, i - 1, 0);
+        fputs(" 1))\n", out);
+    }
+    fputs("(define va (add ", out);
+    writeName(out, size == 0 ? 0 : size - 1, 0);
+    fputs(" 1))\n(define va 2)", out);
+}
+
+static const WORKLOAD workloads[] = {
+        {"width", "one add with SIZE operands", writeWidth},
+        {"depth", "SIZE nested adds", writeDepth},
+        {"letwide", "one let section with SIZE bindings", writeLetWide},
+        {"letchain", "SIZE nested lets, each reading the one outside it", writeLetChain},
+        {"letdeps", "SIZE bindings in one let, each reading the previous one twice", writeLetDeps},
+        {"repeat", "one add over SIZE copies of the same subtree", writeRepeat},
+        {"names", "16 bindings with names SIZE letters long", writeNames},
+        {"lookups", "one let section with SIZE bindings, the last read 200000 times", writeLookups},
+        {"defines", "SIZE session definitions, each reading the previous one", writeDefines},
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static void usage(const char *program)
+{
+    printf("usage: %s FAMILY SIZE [COUNT]\n", program);
+    for (size_t i = 0; i < NUM_WORKLOADS; i++)
+        printf("    %-10s %s\n", workloads[i].name, workloads[i].description);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4)
+        usage(argv[0]);
+
+    const WORKLOAD *workload = NULL;
+    for (size_t i = 0; i < NUM_WORKLOADS; i++)
+    {
+        if (strcmp(argv[1], workloads[i].name) == 0)
+            workload = &workloads[i];
+    }
+    if (workload == NULL)
+        usage(argv[0]);
+
+    size_t size = strtoull(argv[2], NULL, 10);
+    size_t count = argc == 4 ? strtoull(argv[3], NULL, 10) : 1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        workload->write(stdout, size);
+        fputc('\n', stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+#!/bin/bash
+#Builds cilisp in Debug, Release (LTO) and profile-guided Release configurations
+#and reports how fast each one runs the training corpus compared to Debug.
+#
+#    tools/pgo.sh [BUILD_ROOT]
+#
+#The corpus is tools/training/eval.txt plus the cilisp_workload families listed
+#in tools/training/workloads.txt. The profile-guided binary is left in
+#BUILD_ROOT/pgo/cilisp.
+
+set -e
+
+source=$(cd "$(dirname "$0")/.." && pwd)
+root=${1:-$source/_pgo}
+runs=5
+
+configure() {
+    cmake -S "$source" -B "$root/$1" "${@:2}" > /dev/null
+    cmake --build "$root/$1" -j"$(nproc)" > /dev/null
+}
+
+# best wall clock time of $runs runs, in seconds
+timeCorpus() {
+    local TIMEFORMAT=%R
+    for ((i = 0; i < runs; i++)); do
+        { time "$1" < "$root/corpus.txt" > /dev/null 2>&1; } 2>&1
+    done | sort -n | head -1
+}
+
+configure debug -DCMAKE_BUILD_TYPE=Debug
+configure release -DCMAKE_BUILD_TYPE=Release
+
+: > "$root/corpus.txt"
+grep -v '^#\|^$' "$source/tools/training/workloads.txt" | while read -r family size count; do
+    "$root/release/cilisp_workload" "$family" "$size" "$count" >> "$root/corpus.txt"
+done
+cat "$source/tools/training/eval.txt" >> "$root/corpus.txt"
+
+rm -rf "$root/pgo/profile"
+configure pgo -DCMAKE_BUILD_TYPE=Release -DCILISP_PGO=GENERATE -DCILISP_PGO_DIR="$root/pgo/profile"
+"$root/pgo/cilisp" < "$root/corpus.txt" > /dev/null
+if [ -n "$(ls "$root/pgo/profile"/*.profraw 2> /dev/null)" ]; then
+    llvm-profdata merge -o "$root/pgo/profile/cilisp.profdata" "$root/pgo/profile"/*.profraw
+fi
+configure pgo -DCILISP_PGO=USE
+
+baseline=$(timeCorpus "$root/debug/cilisp")
+printf "%-10s %8.3fs %6.2fx\n" debug "$baseline" 1
+for config in release pgo; do
+    elapsed=$(timeCorpus "$root/$config/cilisp")
+    awk -v c="$config" -v t="$elapsed" -v b="$baseline" 'BEGIN { printf "%-10s %8.3fs %6.2fx\n", c, t, b / t }'
+done